@@ -0,0 +1,391 @@
+#include "callib.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "simd.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Micro benchmarks of the math layer: matrices::Matrix products, inverse,
+// transposes and determinant over a sweep of sizes, and CalLib::calibrate
+// over a sweep of sample counts. With --scaling every case is rerun on 1,
+// 2, 4 ... threads to show strong scaling. Results go out as JSON so runs
+// can be compared, a readable table goes to stderr.
+
+namespace {
+
+// every allocation of the process goes through here, see operator new below
+std::atomic<long> allocations(0);
+
+size_t peak_rss() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                              sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024L;
+#endif
+#endif
+}
+
+// keeps the results of the measured calls alive
+volatile double sink;
+
+struct Case {
+    QString name;
+    long size;    // matrix order, or number of samples
+    double flops; // per call, 0 when not meaningful
+    double bytes; // per call, 0 when not meaningful
+    std::function<void()> run;
+};
+
+struct Measurement {
+    double ns_per_op;     // median of the repeats
+    double ns_per_op_min; // best repeat
+    double allocs_per_op;
+    long iterations; // per repeat
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+// doubles the iteration count until one repeat takes min_time, then times
+// the given number of repeats of that many calls
+Measurement measure(const Case& c, double min_time, int repeats) {
+    c.run(); // warm up caches and lazy allocations
+    long iterations = 1;
+    for (;;) {
+        const auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++)
+            c.run();
+        const double elapsed = seconds_since(start);
+        if (elapsed >= min_time || iterations >= (1L << 30)) break;
+        // aim a little past min_time, but never more than 10x at once
+        const double factor =
+            elapsed > 0 ? std::min(10.0, 1.4 * min_time / elapsed) : 10.0;
+        iterations = std::max(iterations + 1, long(iterations * factor));
+    }
+
+    std::vector<double> times;
+    const long allocated = allocations.load();
+    for (int r = 0; r < repeats; r++) {
+        const auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++)
+            c.run();
+        times.push_back(seconds_since(start) * 1e9 / iterations);
+    }
+    const double allocs =
+        double(allocations.load() - allocated) / (iterations * repeats);
+
+    std::sort(times.begin(), times.end());
+    Measurement m = {times[times.size() / 2], times.front(), allocs,
+                     iterations};
+    return m;
+}
+
+// diagonally dominant, so invert() and the determinant are well defined
+matrices::Matrix<double> random_matrix(int n, std::mt19937& random) {
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    matrices::Matrix<double> m(n, n);
+    for (int row = 0; row < n; row++)
+        for (int col = 0; col < n; col++)
+            m.add(uniform(random) + (row == col ? n : 0), col, row);
+    return m;
+}
+
+// noisy samples of an offset, axis-aligned ellipsoid, like a capture
+void random_samples(int n, std::mt19937& random, QVector<double>& x,
+                    QVector<double>& y, QVector<double>& z) {
+    std::normal_distribution<double> normal(0, 1);
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    for (int i = 0; i < n; i++) {
+        double u[3] = {normal(random), normal(random), normal(random)};
+        const double norm = std::sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+        x[i] = 120 + 500 * u[0] / norm + 5 * normal(random);
+        y[i] = -340 + 520 * u[1] / norm + 5 * normal(random);
+        z[i] = 80 + 480 * u[2] / norm + 5 * normal(random);
+    }
+}
+
+// 1, 2, 4 ... up to and including max
+QList<int> thread_sweep(int max) {
+    QList<int> counts;
+    for (int count = 1; count < max; count *= 2)
+        counts.append(count);
+    counts.append(max);
+    return counts;
+}
+
+QList<int> parse_sizes(const QString& text) {
+    // Qt::SkipEmptyParts is new in 5.14, the QString one is deprecated there
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    const auto skip_empty = Qt::SkipEmptyParts;
+#else
+    const auto skip_empty = QString::SkipEmptyParts;
+#endif
+    QList<int> sizes;
+    for (const QString& part : text.split(",", skip_empty)) {
+        const int value = part.trimmed().toInt();
+        if (value > 0) sizes.append(value);
+    }
+    return sizes;
+}
+
+} // namespace
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("benchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Times the matrices::Matrix operations and CalLib::calibrate");
+    parser.addHelpOption();
+    QCommandLineOption sizesOption(
+        QStringList() << "n"
+                      << "sizes",
+        "Matrix orders, comma separated.", "list", "4,8,16,32,64,128,256");
+    QCommandLineOption samplesOption(
+        QStringList() << "s"
+                      << "samples",
+        "Sample counts for the calibration, comma separated.", "list",
+        "1000,10000,100000,1000000");
+    QCommandLineOption filterOption(
+        QStringList() << "f"
+                      << "filter",
+        "Only runs the benchmarks whose name contains this text.", "text");
+    QCommandLineOption timeOption(
+        QStringList() << "t"
+                      << "min-time",
+        "Minimum duration of one repeat, in milliseconds.", "ms", "200");
+    QCommandLineOption repeatsOption(
+        QStringList() << "r"
+                      << "repeats",
+        "Timed repeats per benchmark, the median is reported.", "count", "5");
+    QCommandLineOption threadsOption(
+        QStringList() << "j"
+                      << "threads",
+        "Threads of the parallel loops, defaults to the core count.",
+        "count");
+    QCommandLineOption scalingOption(
+        "scaling", "Reruns every benchmark on 1, 2, 4 ... up to --threads "
+                   "threads and reports the speedup over one thread.");
+    QCommandLineOption outputOption(
+        QStringList() << "o"
+                      << "output",
+        "JSON results. Defaults to the standard output.", "file");
+    parser.addOption(sizesOption);
+    parser.addOption(samplesOption);
+    parser.addOption(filterOption);
+    parser.addOption(timeOption);
+    parser.addOption(repeatsOption);
+    parser.addOption(threadsOption);
+    parser.addOption(scalingOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    if (parser.isSet(threadsOption))
+        parallel::setMaxThreads(parser.value(threadsOption).toInt());
+    const double min_time = parser.value(timeOption).toDouble() / 1000;
+    const int repeats = std::max(1, parser.value(repeatsOption).toInt());
+    const QString filter = parser.value(filterOption);
+    const int max_threads = parallel::threadCount();
+    const QList<int> thread_counts = parser.isSet(scalingOption)
+        ? thread_sweep(max_threads)
+        : QList<int>() << max_threads;
+
+    // inputs are built once per size and shared by the cases through the
+    // closures, so setting them up is never timed
+    std::mt19937 random(1);
+    std::vector<Case> cases;
+    for (int n : parse_sizes(parser.value(sizesOption))) {
+        auto a = std::make_shared<matrices::Matrix<double>>(
+            random_matrix(n, random));
+        auto b = std::make_shared<matrices::Matrix<double>>(
+            random_matrix(n, random));
+        auto out = std::make_shared<matrices::Matrix<double>>(n, n);
+        const double n3 = double(n) * n * n;
+        const double n2_bytes = double(n) * n * sizeof(double);
+
+        cases.push_back({"matrix.multiply", n, 2 * n3, 3 * n2_bytes, [=]() {
+                             matrices::Matrix<double> c = *a * *b;
+                             sink = c.coeff(0, 0);
+                         }});
+        cases.push_back({"matrix.multiply_into", n, 2 * n3, 3 * n2_bytes,
+                         [=]() {
+                             matrices::Matrix<double>::multiply(*a, *b, *out);
+                             sink = out->coeff(0, 0);
+                         }});
+        cases.push_back({"matrix.gram", n, n3, 2 * n2_bytes, [=]() {
+                             matrices::Matrix<double> c = a->transpose() * *a;
+                             sink = c.coeff(0, 0);
+                         }});
+        cases.push_back({"matrix.multiply_transposed", n, 2 * n3,
+                         3 * n2_bytes, [=]() {
+                             matrices::Matrix<double> c =
+                                 *a * b->transpose();
+                             sink = c.coeff(0, 0);
+                         }});
+        cases.push_back({"matrix.add", n, double(n) * n, 3 * n2_bytes,
+                         [=]() {
+                             matrices::Matrix<double> c = *a + *b;
+                             sink = c.coeff(0, 0);
+                         }});
+        cases.push_back({"matrix.transpose", n, 0, 2 * n2_bytes, [=]() {
+                             matrices::Matrix<double> t = a->transpose();
+                             sink = t.coeff(0, 0);
+                         }});
+        cases.push_back({"matrix.transpose_in_place", n, 0, 2 * n2_bytes,
+                         [=]() {
+                             out->transposeInPlace();
+                             sink = out->coeff(0, 0);
+                         }});
+        // LU is 2/3 n^3, the inverse from it another 4/3 n^3
+        cases.push_back({"matrix.invert", n, 2 * n3, 2 * n2_bytes, [=]() {
+                             matrices::Matrix<double> inverse = a->invert();
+                             sink = inverse.coeff(0, 0);
+                         }});
+        cases.push_back({"matrix.determinant", n, 2 * n3 / 3, n2_bytes,
+                         [=]() { sink = a->getDeterminant(); }});
+    }
+    for (int n : parse_sizes(parser.value(samplesOption))) {
+        auto x = std::make_shared<QVector<double>>();
+        auto y = std::make_shared<QVector<double>>();
+        auto z = std::make_shared<QVector<double>>();
+        random_samples(n, random, *x, *y, *z);
+        const double bytes = 3.0 * n * sizeof(double);
+
+        cases.push_back({"callib.calibrate", n, 0, bytes, [=]() {
+                             auto fit = CalLib::calibrate(*x, *y, *z);
+                             sink = fit.second[0];
+                         }});
+        cases.push_back({"callib.calibrate_rotated", n, 0, bytes, [=]() {
+                             QuadricMoments moments;
+                             moments.add(x->constData(), y->constData(),
+                                         z->constData(), x->size());
+                             sink = CalLib::calibrate_rotated(moments)
+                                        .offset[0];
+                         }});
+        // every replicate streams the whole capture once
+        const int replicates = 100;
+        cases.push_back({"callib.bootstrap", n, 0, replicates * bytes, [=]() {
+                             BootstrapOptions options;
+                             options.replicates = replicates;
+                             sink = CalLib::bootstrap(*x, *y, *z, options)
+                                        .standard_error[0];
+                         }});
+    }
+
+    fprintf(stderr, "Numeric kernels: %s\n", simd::name(simd::active()));
+    fprintf(stderr, "%-26s %9s %7s %14s %8s %10s %10s %10s %12s\n",
+            "benchmark", "size", "threads", "ns/op", "speedup", "GFLOP/s",
+            "GB/s", "allocs/op", "peak RSS MB");
+    QJsonArray results;
+    for (const Case& c : cases) {
+        if (!filter.isEmpty() && !c.name.contains(filter)) continue;
+        double first_ns = 0; // the fewest threads of the sweep
+        for (int threads : thread_counts) {
+            parallel::setMaxThreads(threads);
+            const Measurement m = measure(c, min_time, repeats);
+            const size_t rss = peak_rss();
+            if (first_ns == 0) first_ns = m.ns_per_op;
+            const double speedup = first_ns / m.ns_per_op;
+
+            QJsonObject result;
+            result["name"] = c.name;
+            result["size"] = double(c.size);
+            result["threads"] = threads;
+            result["iterations"] = double(m.iterations);
+            result["ns_per_op"] = m.ns_per_op;
+            result["ns_per_op_min"] = m.ns_per_op_min;
+            result["allocs_per_op"] = m.allocs_per_op;
+            // process peak so far, the sweeps grow so it tracks the largest
+            // case
+            result["peak_rss_bytes"] = double(rss);
+            const double gflops = c.flops / m.ns_per_op;
+            const double gbytes = c.bytes / m.ns_per_op;
+            if (c.flops > 0) result["gflops"] = gflops;
+            if (c.bytes > 0) result["gbytes_per_s"] = gbytes;
+            if (c.name.startsWith("callib."))
+                result["samples_per_s"] = c.size * 1e9 / m.ns_per_op;
+            if (thread_counts.size() > 1) {
+                result["speedup"] = speedup;
+                result["efficiency"] = speedup / threads;
+            }
+            results.append(result);
+
+            fprintf(stderr,
+                    "%-26s %9ld %7d %14.1f %8.2f %10.3f %10.3f %10.2f "
+                    "%12.1f\n",
+                    qPrintable(c.name), c.size, threads, m.ns_per_op, speedup,
+                    gflops, gbytes, m.allocs_per_op, rss / 1048576.0);
+        }
+    }
+
+    QJsonObject report;
+    report["threads"] = max_threads;
+    report["simd"] = simd::name(simd::active());
+    report["min_time_ms"] = min_time * 1000;
+    report["repeats"] = repeats;
+    report["peak_rss_bytes"] = double(peak_rss());
+    report["results"] = results;
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(outputOption)) {
+        QFile output(parser.value(outputOption));
+        if (!output.open(QFile::WriteOnly)) {
+            fprintf(stderr, "Cannot write %s\n",
+                    qPrintable(output.fileName()));
+            return 1;
+        }
+        output.write(json);
+    } else {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    }
+    return 0;
+}
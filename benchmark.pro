@@ -0,0 +1,42 @@
+QT       -= gui
+QT       += core
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# freeimu.pro builds the other projects of this directory alongside
+OBJECTS_DIR = .obj/benchmark
+
+TARGET = benchmark
+
+# PeakWorkingSetSize
+win32: LIBS += -lpsapi
+
+SOURCES += \
+    benchmark.cpp \
+    bootstrap.cpp \
+    callib.cpp \
+    calkernels.cpp \
+    captureparser.cpp \
+    matrixkernels.cpp \
+    parallel.cpp \
+    simd.cpp
+
+HEADERS += \
+    callib.h \
+    calkernels.h \
+    factorization.h \
+    fixedmatrix.h \
+    histogram.h \
+    matrix.h \
+    matrixexpr.h \
+    matrixkernels.h \
+    parallel.h \
+    poissontable.h \
+    simd.h \
+    symmetriceigen.h
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,125 @@
+#include "callib.h"
+#include "parallel.h"
+#include "poissontable.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+// Poisson bootstrap: every replicate weighs each sample by an independent
+// Poisson(1) count instead of drawing n samples with replacement. For large
+// n it has the same distribution, needs no resampled copy of the capture
+// and folds straight into the moments, so a replicate is one streaming
+// pass over x, y and z.
+
+namespace {
+
+// offset x, y, z then scale x, y, z
+const int parameters = 6;
+
+bool fit(const EllipsoidMoments& moments, double out[parameters]) {
+    return moments.solve_ellipsoid(out, out + 3);
+}
+
+// linear interpolation between the closest ranks of sorted values
+double percentile(const std::vector<double>& sorted, double p) {
+    const double position = p * (sorted.size() - 1);
+    const int below = static_cast<int>(std::floor(position));
+    const int above = std::min(below + 1, static_cast<int>(sorted.size()) - 1);
+    const double t = position - below;
+    return sorted[below] * (1 - t) + sorted[above] * t;
+}
+
+} // namespace
+
+BootstrapResult CalLib::bootstrap(const QVector<double>& x,
+                                  const QVector<double>& y,
+                                  const QVector<double>& z,
+                                  const BootstrapOptions& options) {
+    const auto start = std::chrono::steady_clock::now();
+    const int n = x.size();
+    if (n < EllipsoidMoments::unknowns)
+        throw std::runtime_error("Not enough samples to fit an ellipsoid");
+    if (options.replicates < 2)
+        throw std::invalid_argument("The bootstrap needs two replicates");
+
+    // the fit of the samples themselves, in blocks of a fixed length merged
+    // in order, so that like the replicates it doesn't depend on the number
+    // of threads
+    const int block = 4096;
+    const int chunks = (n + block - 1) / block;
+    std::vector<EllipsoidMoments> partials(chunks);
+    parallel::forChunks(n, chunks, [&](int begin, int end, int c) {
+        for (int i = begin; i < end; ++i) {
+            partials[c].add(x[i], y[i], z[i]);
+        }
+    });
+    EllipsoidMoments all;
+    for (const EllipsoidMoments& partial : partials) {
+        all.merge(partial);
+    }
+    double estimate[parameters];
+    if (!fit(all, estimate))
+        throw std::runtime_error("Cannot fit an ellipsoid to the samples");
+
+    // replicates are independent and seeded by their index, each thread
+    // refits a contiguous range of them into its own moments and reuses
+    // one buffer of counts
+    static const PoissonTable poisson;
+    std::vector<double> values(options.replicates * parameters);
+    std::vector<char> fitted(options.replicates, 0);
+    parallel::forChunks(options.replicates, [&](int begin, int end, int) {
+        EllipsoidMoments moments;
+        std::vector<unsigned char> copies(n);
+        for (int replicate = begin; replicate < end; ++replicate) {
+            if (options.cancel && options.cancel->load()) break;
+            std::seed_seq seed = {options.seed, (unsigned) replicate};
+            std::mt19937_64 rng(seed);
+            poisson.draw(rng, copies.data(), n);
+            moments.clear();
+            moments.add(x.constData(), y.constData(), z.constData(),
+                        copies.data(), n);
+            fitted[replicate] =
+                fit(moments, &values[replicate * parameters]);
+        }
+    });
+    if (options.cancel && options.cancel->load())
+        throw std::runtime_error("Calibration cancelled");
+
+    BootstrapResult result;
+    result.replicates = std::count(fitted.begin(), fitted.end(), 1);
+    if (result.replicates < 2)
+        throw std::runtime_error("Too few bootstrap replicates could be fitted");
+
+    const double tail = (1 - options.confidence) / 2;
+    std::vector<double> column(result.replicates);
+    for (int p = 0; p < parameters; ++p) {
+        int k = 0;
+        for (int replicate = 0; replicate < options.replicates; ++replicate) {
+            if (fitted[replicate])
+                column[k++] = values[replicate * parameters + p];
+        }
+        double mean = 0;
+        for (double value : column) {
+            mean += value;
+        }
+        mean /= column.size();
+        double squares = 0;
+        for (double value : column) {
+            squares += (value - mean) * (value - mean);
+        }
+        std::sort(column.begin(), column.end());
+
+        result.estimate.append(estimate[p]);
+        result.standard_error.append(std::sqrt(squares / (column.size() - 1)));
+        result.lower.append(percentile(column, tail));
+        result.upper.append(percentile(column, 1 - tail));
+    }
+    result.milliseconds = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    return result;
+}
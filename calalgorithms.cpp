@@ -0,0 +1,257 @@
+#include "calalgorithms.h"
+
+#include <QMutex>
+#include <QtConcurrent>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+
+// Levenberg-Marquardt on an axis-aligned fit, over the masked samples
+void refine(const QVector<double>& x, const QVector<double>& y,
+            const QVector<double>& z, const QVector<bool>& mask,
+            const AlgorithmOptions& options, AlgorithmFit& fit) {
+    RefineOptions refine;
+    refine.cancel = options.cancel;
+    auto refined =
+        CalLib::refine(x, y, z, fit.offsets, fit.scale, mask, refine);
+    fit.offsets = refined.offsets;
+    fit.scale = refined.scale;
+    CalAlgorithms::append_status(fit.status,
+                                 QString("LM %1 it, RMS %2, %3 ms")
+                                     .arg(refined.iterations)
+                                     .arg(refined.rms, 0, 'g', 3)
+                                     .arg(refined.milliseconds, 0, 'f', 1));
+}
+
+AlgorithmFit fit_sphere(const QVector<double>& x, const QVector<double>& y,
+                        const QVector<double>& z,
+                        const AlgorithmOptions& options) {
+    AlgorithmFit fit;
+    auto params = CalLib::calibrate(x, y, z);
+    fit.offsets = params.first;
+    fit.scale = params.second;
+    if (options.refine) refine(x, y, z, QVector<bool>(), options, fit);
+    fit.calibration = CalLib::to_rotated(fit.offsets, fit.scale);
+    return fit;
+}
+
+// the geometric refinement only applies to the axis-aligned model
+AlgorithmFit fit_rotated(const QVector<double>& x, const QVector<double>& y,
+                         const QVector<double>& z, const AlgorithmOptions&) {
+    AlgorithmFit fit;
+    QuadricMoments moments;
+    moments.add(x.constData(), y.constData(), z.constData(), x.size());
+    fit.calibration = CalLib::calibrate_rotated(moments);
+    // the offset/scale formats only keep the diagonal
+    fit.offsets = {std::lround(fit.calibration.offset[0]),
+                   std::lround(fit.calibration.offset[1]),
+                   std::lround(fit.calibration.offset[2])};
+    fit.scale = fit.calibration.scale();
+    return fit;
+}
+
+AlgorithmFit fit_ransac(const QVector<double>& x, const QVector<double>& y,
+                        const QVector<double>& z,
+                        const AlgorithmOptions& options) {
+    AlgorithmFit fit;
+    RansacOptions ransac;
+    ransac.cancel = options.cancel;
+    auto result = CalLib::calibrate_ransac(x, y, z, ransac);
+    fit.offsets = result.offsets;
+    fit.scale = result.scale;
+    CalAlgorithms::append_status(
+        fit.status, QString("%1 inliers").arg(result.inlier_count));
+    if (options.refine) refine(x, y, z, result.inliers, options, fit);
+    fit.calibration = CalLib::to_rotated(fit.offsets, fit.scale);
+    return fit;
+}
+
+// root of the mean squared radial residual, each square capped at
+// threshold^2 as in MSAC so that outliers can't decide the choice
+double held_out_score(const QVector<double>& x, const QVector<double>& y,
+                      const QVector<double>& z,
+                      const EllipsoidCalibration& calibration,
+                      double threshold) {
+    const double* o = calibration.offset.data_;
+    const double* m = calibration.correction.data_;
+    const double cap = threshold * threshold;
+    double sum = 0;
+    for (int i = 0; i < x.size(); i++) {
+        const double dx = x[i] - o[0];
+        const double dy = y[i] - o[1];
+        const double dz = z[i] - o[2];
+        const double cx = m[0] * dx + m[1] * dy + m[2] * dz;
+        const double cy = m[3] * dx + m[4] * dy + m[5] * dz;
+        const double cz = m[6] * dx + m[7] * dy + m[8] * dz;
+        const double r = std::sqrt(cx * cx + cy * cy + cz * cz) - 1;
+        sum += std::min(r * r, cap);
+    }
+    return std::sqrt(sum / x.size());
+}
+
+struct Registry {
+    QMutex mutex;
+    QVector<CalAlgorithm> algorithms;
+
+    Registry() {
+        algorithms.append({"sphere", "Ellipsoid to Sphere", fit_sphere});
+        algorithms.append(
+            {"rotated", "Rotated Ellipsoid (soft-iron)", fit_rotated});
+        algorithms.append(
+            {"ransac", "Ellipsoid to Sphere (RANSAC)", fit_ransac});
+    }
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+} // namespace
+
+QVector<CalAlgorithm> CalAlgorithms::all() {
+    Registry& r = registry();
+    QMutexLocker lock(&r.mutex);
+    return r.algorithms;
+}
+
+bool CalAlgorithms::find(const QString& id, CalAlgorithm& algorithm) {
+    Registry& r = registry();
+    QMutexLocker lock(&r.mutex);
+    for (const CalAlgorithm& entry : r.algorithms) {
+        if (entry.id == id) {
+            algorithm = entry;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CalAlgorithms::add(const CalAlgorithm& algorithm) {
+    Registry& r = registry();
+    QMutexLocker lock(&r.mutex);
+    for (CalAlgorithm& entry : r.algorithms) {
+        if (entry.id == algorithm.id) {
+            entry = algorithm;
+            return;
+        }
+    }
+    r.algorithms.append(algorithm);
+}
+
+AutoResult CalAlgorithms::choose(const QVector<double>& x,
+                                 const QVector<double>& y,
+                                 const QVector<double>& z,
+                                 const AutoOptions& options) {
+    if (options.holdout < 2)
+        throw std::invalid_argument("The holdout must keep samples to fit");
+    const int n = x.size();
+    if (n / options.holdout < EllipsoidMoments::unknowns)
+        throw std::runtime_error("Not enough samples to compare the fits");
+
+    // both parts are built once, the candidates only read them
+    QVector<double> train_x, train_y, train_z, test_x, test_y, test_z;
+    for (int i = 0; i < n; ++i) {
+        if (i % options.holdout == options.holdout - 1) {
+            test_x.append(x[i]);
+            test_y.append(y[i]);
+            test_z.append(z[i]);
+        } else {
+            train_x.append(x[i]);
+            train_y.append(y[i]);
+            train_z.append(z[i]);
+        }
+    }
+
+    // the candidates run on the global thread pool rather than in the
+    // chunks of a parallel loop, so the parallel loops inside each fit
+    // still get the workers of parallel::forChunks
+    const QVector<CalAlgorithm> algorithms = all();
+    AutoResult result;
+    result.candidates.resize(algorithms.size());
+    QVector<AlgorithmFit> fits(algorithms.size());
+    QVector<int> order(algorithms.size());
+    std::iota(order.begin(), order.end(), 0);
+    QtConcurrent::blockingMap(order, [&](int a) {
+        CandidateScore& score = result.candidates[a];
+        score.id = algorithms[a].id;
+        score.name = algorithms[a].name;
+        score.score = std::numeric_limits<double>::infinity();
+        score.milliseconds = 0;
+        if (options.fit.cancel && options.fit.cancel->load()) return;
+        const auto start = std::chrono::steady_clock::now();
+        try {
+            fits[a] = algorithms[a].fit(train_x, train_y, train_z,
+                                        options.fit);
+            // what is stored and shipped: the offset/scale formats drop
+            // the cross terms of the rotated fit
+            score.score = held_out_score(
+                test_x, test_y, test_z,
+                CalLib::to_rotated(fits[a].offsets, fits[a].scale),
+                options.threshold);
+        } catch (const std::exception& e) {
+            score.error = e.what();
+        }
+        score.milliseconds = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+    });
+    if (options.fit.cancel && options.fit.cancel->load())
+        throw std::runtime_error("Calibration cancelled");
+
+    int best = -1;
+    for (int a = 0; a < result.candidates.size(); ++a) {
+        const CandidateScore& score = result.candidates[a];
+        if (score.error.isEmpty() && std::isfinite(score.score) &&
+            (best < 0 || score.score < result.candidates[best].score))
+            best = a;
+    }
+    if (best < 0) {
+        // the first failure that says why, a fit without a finite score
+        // has no message of its own
+        QString reason = result.candidates.isEmpty()
+                             ? "none is registered"
+                             : "no fit has a finite held-out score";
+        for (const CandidateScore& score : result.candidates) {
+            if (!score.error.isEmpty()) {
+                reason = score.error;
+                break;
+            }
+        }
+        throw std::runtime_error("No algorithm could fit the samples: " +
+                                 reason.toStdString());
+    }
+
+    // not refitted on every sample, the score has to describe the result
+    result.id = algorithms[best].id;
+    result.fit = fits[best];
+    return result;
+}
+
+void CalAlgorithms::append_status(QString& status, const QString& text) {
+    if (text.isEmpty()) return;
+    if (!status.isEmpty()) status += ", ";
+    status += text;
+}
+
+QString CalAlgorithms::summary(const AutoResult& result) {
+    QString text;
+    for (const CandidateScore& score : result.candidates) {
+        if (!text.isEmpty()) text += "\n";
+        text += score.id == result.id ? "* " : "  ";
+        if (score.error.isEmpty()) {
+            text += QString("%1: held-out %2, %3 ms")
+                        .arg(score.name)
+                        .arg(score.score, 0, 'g', 3)
+                        .arg(score.milliseconds, 0, 'f', 1);
+        } else {
+            text += QString("%1: %2").arg(score.name, score.error);
+        }
+    }
+    return text;
+}
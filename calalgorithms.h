@@ -0,0 +1,92 @@
+#ifndef CALALGORITHMS_H
+#define CALALGORITHMS_H
+
+#include "callib.h"
+#include <QString>
+#include <QVector>
+#include <atomic>
+#include <functional>
+
+// Options every registered algorithm is given
+struct AlgorithmOptions {
+    bool refine = false; // Levenberg-Marquardt on the axis-aligned fits
+    // polled by the iterative fits, which throw once it is set
+    const std::atomic<bool>* cancel = nullptr;
+};
+
+// Result of one algorithm. calibration always holds the fit, offsets and
+// scale its per-axis form for the offset/scale storage formats.
+struct AlgorithmFit {
+    QVector<long> offsets;
+    QVector<double> scale;
+    EllipsoidCalibration calibration;
+    QString status;
+};
+
+// An entry of the registry. fit only reads the samples, the auto mode runs
+// every algorithm on the same buffers at once.
+struct CalAlgorithm {
+    QString id;   // stable, for the settings, the cache keys and calcli
+    QString name; // shown in the UI
+    std::function<AlgorithmFit(const QVector<double>& x,
+                               const QVector<double>& y,
+                               const QVector<double>& z,
+                               const AlgorithmOptions& options)>
+        fit;
+};
+
+// Options of the automatic choice between the registered algorithms
+struct AutoOptions {
+    // every holdout-th sample is left out of the fits to score them, the
+    // captures are time ordered so this keeps the coverage of both parts
+    int holdout = 5;
+    // held-out radial residuals, relative to the radius, are capped here
+    // so that the outliers don't decide which fit wins
+    double threshold = 0.05;
+    AlgorithmOptions fit;
+};
+
+// One candidate of the automatic choice
+struct CandidateScore {
+    QString id;
+    QString name;
+    // truncated RMS of the held-out radial residual, of the offsets and
+    // scales the fit stores
+    double score;
+    double milliseconds; // wall time of the fit
+    QString error;       // set instead of the score when the fit failed
+};
+
+struct AutoResult {
+    QString id;       // of the best candidate
+    AlgorithmFit fit; // of the best candidate, on the training samples
+    QVector<CandidateScore> candidates; // in registry order
+};
+
+class CalAlgorithms {
+public:
+    // the registered algorithms in registration order, the built-in sphere,
+    // rotated and ransac first
+    static QVector<CalAlgorithm> all();
+
+    // returns false if no algorithm has this id
+    static bool find(const QString& id, CalAlgorithm& algorithm);
+
+    // registers an algorithm, or replaces the one with the same id
+    static void add(const CalAlgorithm& algorithm);
+
+    // fits every registered algorithm concurrently on the same training
+    // samples and picks the lowest score on the held-out ones
+    static AutoResult choose(const QVector<double>& x,
+                             const QVector<double>& y,
+                             const QVector<double>& z,
+                             const AutoOptions& options = AutoOptions());
+
+    // one line per candidate: name, held-out score and time, best marked
+    static QString summary(const AutoResult& result);
+
+    // adds a part to a fit status, the parts are separated by commas
+    static void append_status(QString& status, const QString& text);
+};
+
+#endif // CALALGORITHMS_H
@@ -0,0 +1,251 @@
+#include "calalgorithms.h"
+#include "callib.h"
+#include "parallel.h"
+#include "simd.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <cstdio>
+
+// Headless batch calibration: fits every capture file given on the command
+// line, or found in the given directories, on a QtConcurrent work queue.
+
+namespace {
+
+struct Job {
+    QString file_name;
+    QString algorithm; // a registered id, or auto
+    bool refine;
+    int per_bin;    // 0 disables the subsampling
+    int replicates; // of the bootstrap, 0 disables it
+};
+
+struct JobResult {
+    QString file_name;
+    QVector<long> offsets;
+    QVector<double> scale;
+    QString algorithm; // the one auto chose
+    long samples;
+    BootstrapResult bootstrap;
+    QString error;
+};
+
+JobResult run_job(const Job& job) {
+    JobResult result;
+    result.file_name = job.file_name;
+    result.samples = 0;
+    try {
+        QVector<double> x, y, z;
+        CalLib::load_samples(job.file_name, x, y, z);
+        result.samples = x.size();
+        if (job.per_bin > 0) {
+            SubsampleOptions options;
+            options.per_bin = job.per_bin;
+            CalLib::subsample(x, y, z, options);
+        }
+
+        AlgorithmFit fit;
+        if (job.algorithm == "auto") {
+            AutoOptions options;
+            options.fit.refine = job.refine;
+            auto chosen = CalAlgorithms::choose(x, y, z, options);
+            fit = chosen.fit;
+            result.algorithm = chosen.id;
+        } else {
+            AlgorithmOptions options;
+            options.refine = job.refine;
+            CalAlgorithm algorithm;
+            CalAlgorithms::find(job.algorithm, algorithm);
+            fit = algorithm.fit(x, y, z, options);
+        }
+        result.offsets = fit.offsets;
+        result.scale = fit.scale;
+
+        if (job.replicates > 0) {
+            BootstrapOptions options;
+            options.replicates = job.replicates;
+            result.bootstrap = CalLib::bootstrap(x, y, z, options);
+        }
+    } catch (const std::exception& e) {
+        result.error = e.what();
+    }
+    return result;
+}
+
+// capture files of a directory: acc*.txt and magn*.txt, recursively
+void collect(const QString& path, QStringList& files) {
+    QFileInfo info(path);
+    if (!info.isDir()) {
+        files.append(path);
+        return;
+    }
+    QDir dir(path);
+    for (const QFileInfo& entry : dir.entryInfoList(
+             QStringList() << "acc*.txt"
+                           << "magn*.txt",
+             QDir::Files, QDir::Name))
+        files.append(entry.filePath());
+    for (const QFileInfo& entry :
+         dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name))
+        collect(entry.filePath(), files);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("calcli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Fits the offsets and scales of FreeIMU captures in parallel");
+    parser.addHelpOption();
+    parser.addPositionalArgument("paths",
+                                 "Capture files, or directories to search "
+                                 "for acc*.txt and magn*.txt",
+                                 "paths...");
+    QCommandLineOption algorithmOption(
+        QStringList() << "a"
+                      << "algorithm",
+        "Fit to use: sphere, rotated, ransac, or auto to keep the one with "
+        "the lowest held-out residual.",
+        "algorithm", "sphere");
+    QCommandLineOption refineOption(
+        QStringList() << "r"
+                      << "refine",
+        "Refine the axis-aligned fits by Levenberg-Marquardt.");
+    QCommandLineOption subsampleOption(
+        QStringList() << "s"
+                      << "subsample",
+        "Samples kept per direction bin, 0 keeps them all.", "count", "0");
+    QCommandLineOption bootstrapOption(
+        QStringList() << "b"
+                      << "bootstrap",
+        "Adds standard errors and 95% intervals of the moment fit from this "
+        "many bootstrap replicates. Only with -a sphere and without "
+        "--refine, the fit the replicates redo.",
+        "replicates", "0");
+    QCommandLineOption threadsOption(
+        QStringList() << "j"
+                      << "threads",
+        "Files fitted concurrently, defaults to the core count.", "count");
+    QCommandLineOption outputOption(
+        QStringList() << "o"
+                      << "output",
+        "Per-file results, as CSV. Defaults to the standard output.", "file");
+    parser.addOption(algorithmOption);
+    parser.addOption(refineOption);
+    parser.addOption(subsampleOption);
+    parser.addOption(bootstrapOption);
+    parser.addOption(threadsOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    const QString algorithm = parser.value(algorithmOption);
+    CalAlgorithm registered;
+    if (algorithm != "auto" && !CalAlgorithms::find(algorithm, registered)) {
+        fprintf(stderr, "Unknown algorithm: %s\n", qPrintable(algorithm));
+        return 2;
+    }
+    // the replicates refit the axis-aligned moments, their intervals don't
+    // describe any other fit
+    if (parser.value(bootstrapOption).toInt() > 0 &&
+        (algorithm != "sphere" || parser.isSet(refineOption))) {
+        fprintf(stderr, "--bootstrap needs -a sphere without --refine\n");
+        return 2;
+    }
+
+    QStringList files;
+    for (const QString& path : parser.positionalArguments())
+        collect(path, files);
+    if (files.isEmpty()) {
+        parser.showHelp(2);
+    }
+
+    fprintf(stderr, "Numeric kernels: %s\n", simd::name(simd::active()));
+
+    // parallelism is across files, the fits themselves stay sequential
+    parallel::setMaxThreads(1);
+    if (parser.isSet(threadsOption))
+        QThreadPool::globalInstance()->setMaxThreadCount(
+            parser.value(threadsOption).toInt());
+
+    QVector<Job> jobs;
+    for (const QString& file : files)
+        jobs.append({file, algorithm, parser.isSet(refineOption),
+                     parser.value(subsampleOption).toInt(),
+                     parser.value(bootstrapOption).toInt()});
+
+    QElapsedTimer timer;
+    timer.start();
+    const QVector<JobResult> results =
+        QtConcurrent::blockingMapped<QVector<JobResult>>(jobs, run_job);
+    const double seconds = timer.nsecsElapsed() / 1e9;
+
+    QFile output;
+    if (parser.isSet(outputOption)) {
+        output.setFileName(parser.value(outputOption));
+        if (!output.open(QFile::WriteOnly | QFile::Text)) {
+            fprintf(stderr, "Cannot write %s\n",
+                    qPrintable(output.fileName()));
+            return 1;
+        }
+    } else {
+        output.open(stdout, QFile::WriteOnly | QFile::Text);
+    }
+    QTextStream out(&output);
+    const bool bootstrap = parser.value(bootstrapOption).toInt() > 0;
+    const char* parameters[] = {"offset_x", "offset_y", "offset_z",
+                                "scale_x",  "scale_y",  "scale_z"};
+    out << "file,samples,offset_x,offset_y,offset_z,scale_x,scale_y,scale_z,";
+    if (algorithm == "auto") out << "algorithm,";
+    if (bootstrap) {
+        for (const char* parameter : parameters)
+            out << parameter << "_se," << parameter << "_low," << parameter
+                << "_high,";
+    }
+    out << "error\n";
+
+    long samples = 0;
+    int failed = 0;
+    for (const JobResult& result : results) {
+        samples += result.samples;
+        out << result.file_name << "," << result.samples;
+        if (result.error.isEmpty()) {
+            for (int i = 0; i < 3; i++)
+                out << "," << result.offsets[i];
+            for (int i = 0; i < 3; i++)
+                out << "," << QString::number(result.scale[i], 'g', 10);
+            if (algorithm == "auto") out << "," << result.algorithm;
+            if (bootstrap) {
+                const BootstrapResult& b = result.bootstrap;
+                for (int i = 0; i < 6; i++)
+                    out << "," << QString::number(b.standard_error[i], 'g', 6)
+                        << "," << QString::number(b.lower[i], 'g', 10) << ","
+                        << QString::number(b.upper[i], 'g', 10);
+            }
+            out << ",\n";
+        } else {
+            failed++;
+            out << ",,,,,,,";
+            if (algorithm == "auto") out << ",";
+            if (bootstrap) out << QString(18, ',');
+            out << result.error << "\n";
+        }
+    }
+    out.flush();
+
+    fprintf(stderr,
+            "%d files (%d failed), %ld samples in %.3f s on %d threads: "
+            "%.1f files/s, %.0f samples/s\n",
+            results.size(), failed, samples, seconds,
+            QThreadPool::globalInstance()->maxThreadCount(),
+            results.size() / seconds, samples / seconds);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+QT       -= gui
+QT       += core concurrent
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# freeimu.pro builds the other projects of this directory alongside
+OBJECTS_DIR = .obj/calcli
+
+TARGET = calcli
+
+SOURCES += \
+    bootstrap.cpp \
+    calalgorithms.cpp \
+    calcli.cpp \
+    callib.cpp \
+    calkernels.cpp \
+    captureparser.cpp \
+    histogram.cpp \
+    matrixkernels.cpp \
+    parallel.cpp \
+    quality.cpp \
+    ransac.cpp \
+    refine.cpp \
+    simd.cpp \
+    subsample.cpp
+
+HEADERS += \
+    calalgorithms.h \
+    callib.h \
+    calkernels.h \
+    factorization.h \
+    fixedmatrix.h \
+    histogram.h \
+    matrix.h \
+    matrixexpr.h \
+    matrixkernels.h \
+    parallel.h \
+    poissontable.h \
+    simd.h \
+    symmetriceigen.h
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,306 @@
+#include "calibrationcache.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace {
+
+const quint32 cache_magic = 0x46494343; // "FICC"
+// 2 adds the auto mode candidates, 3 the quality
+const quint32 cache_version = 3;
+// larger binnings are taken for a damaged file
+const qint32 max_bins = 1 << 16;
+
+inline quint64 mix(quint64 h, quint64 word) {
+    h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+// histograms are stored as their binning and counts, and rebuilt by
+// filling every bin at its center
+void write_histogram(QDataStream& out, const Histogram1D& h) {
+    out << qint32(h.bins()) << h.low() << h.high();
+    for (int i = 0; i < h.bins(); i++)
+        out << h.count(i);
+    out << h.underflow() << h.overflow();
+}
+
+void read_histogram(QDataStream& in, Histogram1D& h) {
+    qint32 bins;
+    double low, high;
+    in >> bins >> low >> high;
+    if (in.status() != QDataStream::Ok || bins < 1 || bins > max_bins ||
+        !(high > low)) {
+        in.setStatus(QDataStream::ReadCorruptData);
+        return;
+    }
+    h = Histogram1D(bins, low, high);
+    for (int i = 0; i < bins; i++) {
+        double count;
+        in >> count;
+        h.fill(h.bin_center(i), count);
+    }
+    double under, over;
+    in >> under >> over;
+    h.fill(-std::numeric_limits<double>::infinity(), under);
+    h.fill(std::numeric_limits<double>::quiet_NaN(), over);
+}
+
+void write_histogram(QDataStream& out, const Histogram2D& h) {
+    out << qint32(h.xbins()) << h.xlow() << h.xhigh() << qint32(h.ybins())
+        << h.ylow() << h.yhigh();
+    for (int y = 0; y < h.ybins(); y++)
+        for (int x = 0; x < h.xbins(); x++)
+            out << h.count(x, y);
+    out << h.outside();
+}
+
+void read_histogram(QDataStream& in, Histogram2D& h) {
+    qint32 xbins, ybins;
+    double xlow, xhigh, ylow, yhigh;
+    in >> xbins >> xlow >> xhigh >> ybins >> ylow >> yhigh;
+    if (in.status() != QDataStream::Ok || xbins < 1 || ybins < 1 ||
+        qint64(xbins) * ybins > max_bins || !(xhigh > xlow) ||
+        !(yhigh > ylow)) {
+        in.setStatus(QDataStream::ReadCorruptData);
+        return;
+    }
+    h = Histogram2D(xbins, xlow, xhigh, ybins, ylow, yhigh);
+    const double width = (xhigh - xlow) / xbins;
+    const double height = (yhigh - ylow) / ybins;
+    for (int y = 0; y < ybins; y++) {
+        for (int x = 0; x < xbins; x++) {
+            double count;
+            in >> count;
+            h.fill(xlow + (x + 0.5) * width, ylow + (y + 0.5) * height,
+                   count);
+        }
+    }
+    double outside;
+    in >> outside;
+    h.fill(std::numeric_limits<double>::quiet_NaN(), 0, outside);
+}
+
+void write_quality(QDataStream& out, const CalibrationQuality& q) {
+    out << qint64(q.samples) << q.rms << q.axis_rms[0] << q.axis_rms[1]
+        << q.axis_rms[2] << q.max_deviation << q.condition << q.coverage;
+    write_histogram(out, q.residuals);
+    write_histogram(out, q.directions);
+}
+
+void read_quality(QDataStream& in, CalibrationQuality& q) {
+    qint64 samples;
+    in >> samples >> q.rms >> q.axis_rms[0] >> q.axis_rms[1] >>
+        q.axis_rms[2] >> q.max_deviation >> q.condition >> q.coverage;
+    q.samples = samples;
+    read_histogram(in, q.residuals);
+    read_histogram(in, q.directions);
+}
+
+} // namespace
+
+CalibrationCache::CalibrationCache(QString file_name, int capacity)
+    : file_name(file_name),
+      capacity(capacity),
+      dirty(false),
+      hit_count(0),
+      miss_count(0) {
+    load();
+}
+
+CalibrationCache::~CalibrationCache() {
+    flush();
+}
+
+bool CalibrationCache::hash_file(QString file_name, quint64& hash) {
+    QFile file(file_name);
+    if (!file.open(QFile::ReadOnly)) return false;
+    return hash_device(file, hash);
+}
+
+bool CalibrationCache::hash_device(QIODevice& device, quint64& hash) {
+    std::vector<char> buffer(1 << 20);
+    quint64 h = 0xCBF29CE484222325ULL;
+    quint64 length = 0;
+    // the bytes of a word split between two reads
+    char partial[8];
+    int pending = 0;
+    qint64 read;
+    while ((read = device.read(buffer.data(), buffer.size())) > 0) {
+        length += read;
+        const char* data = buffer.data();
+        qint64 left = read;
+        if (pending > 0) {
+            const int taken = static_cast<int>(std::min<qint64>(8 - pending,
+                                                                left));
+            std::memcpy(partial + pending, data, taken);
+            pending += taken;
+            data += taken;
+            left -= taken;
+            if (pending < 8) continue;
+            quint64 word;
+            std::memcpy(&word, partial, sizeof(word));
+            h = mix(h, word);
+            pending = 0;
+        }
+        for (; left >= 8; data += 8, left -= 8) {
+            quint64 word;
+            std::memcpy(&word, data, sizeof(word));
+            h = mix(h, word);
+        }
+        std::memcpy(partial, data, left);
+        pending = static_cast<int>(left);
+    }
+    if (read < 0) return false;
+    if (pending > 0) {
+        quint64 word = 0;
+        std::memcpy(&word, partial, pending);
+        h = mix(h, word);
+    }
+    hash = mix(h, length);
+    return true;
+}
+
+bool CalibrationCache::content_hash(QString file_name, quint64& hash) {
+    // only a rewrite keeping the size within the resolution of the
+    // modification time goes unnoticed
+    const QFileInfo info(file_name);
+    if (!info.exists()) return false;
+    const QString path = info.absoluteFilePath();
+    const qint64 size = info.size();
+    const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+    {
+        QMutexLocker locker(&mutex);
+        auto it = stamps.constFind(path);
+        if (it != stamps.constEnd() && it.value().size == size &&
+            it.value().modified == modified) {
+            hash = it.value().hash;
+            return true;
+        }
+    }
+    // stamped as it was before the read, a file changed meanwhile is
+    // hashed again next time
+    if (!hash_file(file_name, hash)) return false;
+    QMutexLocker locker(&mutex);
+    stamps.insert(path, {size, modified, hash});
+    return true;
+}
+
+QString CalibrationCache::key(quint64 content_hash, QString options) {
+    return QString("%1/%2").arg(content_hash, 16, 16, QChar('0')).arg(options);
+}
+
+bool CalibrationCache::find(const QString& key, Entry& entry) {
+    QMutexLocker locker(&mutex);
+    auto it = entries.constFind(key);
+    if (it == entries.constEnd()) {
+        miss_count++;
+        return false;
+    }
+    hit_count++;
+    entry = it.value();
+    return true;
+}
+
+void CalibrationCache::insert(const QString& key, const Entry& entry) {
+    QMutexLocker locker(&mutex);
+    if (!entries.contains(key)) order.append(key);
+    entries.insert(key, entry);
+    while (order.size() > capacity)
+        entries.remove(order.takeFirst());
+    dirty = true;
+}
+
+void CalibrationCache::clear() {
+    QMutexLocker locker(&mutex);
+    entries.clear();
+    order.clear();
+    hit_count = 0;
+    miss_count = 0;
+    dirty = true;
+}
+
+long CalibrationCache::hits() const {
+    QMutexLocker locker(&mutex);
+    return hit_count;
+}
+
+long CalibrationCache::misses() const {
+    QMutexLocker locker(&mutex);
+    return miss_count;
+}
+
+void CalibrationCache::load() {
+    if (file_name.isEmpty()) return;
+    QFile file(file_name);
+    if (!file.open(QFile::ReadOnly)) return;
+    QDataStream in(&file);
+    quint32 magic, version, count;
+    in >> magic >> version >> count;
+    // an unknown or damaged file only means an empty cache
+    if (in.status() != QDataStream::Ok || magic != cache_magic ||
+        version != cache_version)
+        return;
+    for (quint32 n = 0; n < count; n++) {
+        QString key;
+        Entry entry;
+        in >> key;
+        for (int i = 0; i < 3; i++) {
+            qint64 offset;
+            double scale;
+            in >> offset >> scale;
+            entry.offsets.append(offset);
+            entry.scale.append(scale);
+        }
+        for (int i = 0; i < 3; i++)
+            in >> entry.calibration.offset[i];
+        for (int i = 0; i < 9; i++)
+            in >> entry.calibration.correction[i];
+        in >> entry.status >> entry.candidates;
+        read_quality(in, entry.quality);
+        if (in.status() != QDataStream::Ok) break;
+        order.append(key);
+        entries.insert(key, entry);
+    }
+}
+
+void CalibrationCache::flush() {
+    // a later flush waits for this one, so the newest copy is written last
+    QMutexLocker file_locker(&file_mutex);
+    QStringList keys;
+    QVector<Entry> values;
+    {
+        QMutexLocker locker(&mutex);
+        if (!dirty || file_name.isEmpty()) return;
+        dirty = false;
+        keys = order;
+        for (const QString& key : order)
+            values.append(entries[key]);
+    }
+
+    QSaveFile file(file_name);
+    if (!file.open(QFile::WriteOnly)) return;
+    QDataStream out(&file);
+    out << cache_magic << cache_version << quint32(keys.size());
+    for (int n = 0; n < keys.size(); n++) {
+        const Entry& entry = values[n];
+        out << keys[n];
+        for (int i = 0; i < 3; i++)
+            out << qint64(entry.offsets[i]) << entry.scale[i];
+        for (int i = 0; i < 3; i++)
+            out << entry.calibration.offset[i];
+        for (int i = 0; i < 9; i++)
+            out << entry.calibration.correction[i];
+        out << entry.status << entry.candidates;
+        write_quality(out, entry.quality);
+    }
+    file.commit();
+}
@@ -0,0 +1,77 @@
+#ifndef CALIBRATIONCACHE_H
+#define CALIBRATIONCACHE_H
+
+#include "callib.h"
+#include <QHash>
+#include <QIODevice>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+// Calibration results cached by the content of the capture they were fitted
+// on, plus the algorithm and options, so an unchanged capture is never fitted
+// or even read twice. Kept in memory and written to a file by flush(), safe
+// to use from the fitting threads.
+class CalibrationCache {
+public:
+    struct Entry {
+        QVector<long> offsets;
+        QVector<double> scale;
+        EllipsoidCalibration calibration;
+        QString status;
+        QString candidates; // scores of the auto mode, see CalAlgorithms
+        CalibrationQuality quality; // over the whole capture
+    };
+
+    // entries are persisted in file_name, an empty name keeps them in memory
+    explicit CalibrationCache(QString file_name = QString(),
+                              int capacity = 256);
+    ~CalibrationCache(); // flushes
+
+    // 64-bit hash of a file content, word at a time. Not cryptographic,
+    // only meant to tell captures apart. Returns false if it can't be read.
+    static bool hash_file(QString file_name, quint64& hash);
+    // the same hash of what is left to read on an open device, whatever
+    // lengths its reads return
+    static bool hash_device(QIODevice& device, quint64& hash);
+
+    // hash_file(), remembered per file with its size and modification time
+    // so an unchanged file is only read once
+    bool content_hash(QString file_name, quint64& hash);
+
+    // key of a capture fitted with the given algorithm and options, which
+    // must describe everything the result depends on
+    static QString key(quint64 content_hash, QString options);
+
+    bool find(const QString& key, Entry& entry);
+    // only in memory until the next flush()
+    void insert(const QString& key, const Entry& entry);
+    void clear();
+    // writes the entries to the file if they changed since the last flush.
+    // Lookups and inserts are not blocked while the file is written.
+    void flush();
+
+    long hits() const;
+    long misses() const;
+
+private:
+    void load();
+
+    mutable QMutex mutex;
+    QMutex file_mutex; // serializes flush(), taken before mutex
+    QString file_name;
+    int capacity;
+    QHash<QString, Entry> entries;
+    QStringList order; // insertion order, the oldest entry is evicted first
+    struct Stamp {
+        qint64 size;
+        qint64 modified; // ms since the epoch
+        quint64 hash;
+    };
+    QHash<QString, Stamp> stamps; // by absolute file path, not persisted
+    bool dirty;
+    long hit_count;
+    long miss_count;
+};
+
+#endif // CALIBRATIONCACHE_H
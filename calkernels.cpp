@@ -0,0 +1,767 @@
+#include "calkernels.h"
+
+#include "simd.h"
+
+#include <cstring>
+
+namespace calkernels {
+
+namespace {
+
+/// scalar path, also used for the tails of the vector loops
+template <class In, class Out>
+void applyScalar(const Transform& t, const In* x, const In* y, const In* z,
+                 Out* outX, Out* outY, Out* outZ, int begin, int n) {
+    const double* m = t.matrix;
+    for (int i = begin; i < n; i++) {
+        const double dx = x[i] - t.offset[0];
+        const double dy = y[i] - t.offset[1];
+        const double dz = z[i] - t.offset[2];
+        outX[i] = static_cast<Out>(m[0] * dx + m[1] * dy + m[2] * dz);
+        outY[i] = static_cast<Out>(m[3] * dx + m[4] * dy + m[5] * dz);
+        outZ[i] = static_cast<Out>(m[6] * dx + m[7] * dy + m[8] * dz);
+    }
+}
+
+/// scalar quadric moments, also used for the tails of the vector loops
+void momentsScalar(const double* x, const double* y, const double* z,
+                   int begin, int n, double sums[quadricSums]) {
+    for (int s = begin; s < n; s++) {
+        const double d[quadricTerms] = {
+            x[s] * x[s],     y[s] * y[s],     z[s] * z[s], 2 * y[s] * z[s],
+            2 * x[s] * z[s], 2 * x[s] * y[s], 2 * x[s],    2 * y[s],
+            2 * z[s],        1};
+        double* sum = sums;
+        for (int i = 0; i < quadricTerms; i++)
+            for (int j = i; j < quadricTerms; j++)
+                *sum++ += d[i] * d[j];
+    }
+}
+
+/// scalar weighted ellipsoid moments, also used for the vector tails
+void ellipsoidScalar(const double* x, const double* y, const double* z,
+                     const unsigned char* copies, int begin, int n,
+                     double sums[ellipsoidSums]) {
+    for (int s = begin; s < n; s++) {
+        if (!copies[s]) continue;
+        const double h[ellipsoidTerms] = {x[s],         y[s], z[s],
+                                          -y[s] * y[s], -z[s] * z[s], 1};
+        const double w = x[s] * x[s];
+        double* sum = sums;
+        for (int i = 0; i < ellipsoidTerms; i++) {
+            const double weighted = copies[s] * h[i];
+            for (int j = i; j < ellipsoidTerms; j++)
+                *sum++ += weighted * h[j];
+            sums[ellipsoidSums - ellipsoidTerms + i] += weighted * w;
+        }
+    }
+}
+
+namespace scalar {
+
+void applyDoubles(const Transform& t, const double* x, const double* y,
+                  const double* z, double* outX, double* outY, double* outZ,
+                  int n) {
+    applyScalar(t, x, y, z, outX, outY, outZ, 0, n);
+}
+
+void applyShorts(const Transform& t, const short* x, const short* y,
+                 const short* z, double* outX, double* outY, double* outZ,
+                 int n) {
+    applyScalar(t, x, y, z, outX, outY, outZ, 0, n);
+}
+
+void applyFloats(const Transform& t, const short* x, const short* y,
+                 const short* z, float* outX, float* outY, float* outZ,
+                 int n) {
+    applyScalar(t, x, y, z, outX, outY, outZ, 0, n);
+}
+
+void moments(const double* x, const double* y, const double* z, int n,
+             double sums[quadricSums]) {
+    momentsScalar(x, y, z, 0, n, sums);
+}
+
+void ellipsoid(const double* x, const double* y, const double* z,
+               const unsigned char* copies, int n,
+               double sums[ellipsoidSums]) {
+    ellipsoidScalar(x, y, z, copies, 0, n, sums);
+}
+
+} // namespace scalar
+
+#ifdef SIMD_HAVE_SSE42
+SIMD_TARGET_BEGIN("sse4.2")
+namespace sse42 {
+
+/// the transform broadcast to every lane. Plain structs, the vector types
+/// lose their alignment attribute as template arguments.
+struct DoubleLanes {
+    __m128d o[3];
+    __m128d m[9];
+};
+
+struct FloatLanes {
+    __m128 o[3];
+    __m128 m[9];
+};
+
+DoubleLanes broadcast(const Transform& t, __m128d) {
+    DoubleLanes l;
+    for (int i = 0; i < 3; i++)
+        l.o[i] = _mm_set1_pd(t.offset[i]);
+    for (int i = 0; i < 9; i++)
+        l.m[i] = _mm_set1_pd(t.matrix[i]);
+    return l;
+}
+
+FloatLanes broadcast(const Transform& t, __m128) {
+    FloatLanes l;
+    for (int i = 0; i < 3; i++)
+        l.o[i] = _mm_set1_ps(static_cast<float>(t.offset[i]));
+    for (int i = 0; i < 9; i++)
+        l.m[i] = _mm_set1_ps(static_cast<float>(t.matrix[i]));
+    return l;
+}
+
+inline void transform(const DoubleLanes& l, __m128d x, __m128d y,
+                      __m128d z, __m128d& ox, __m128d& oy, __m128d& oz) {
+    const __m128d dx = _mm_sub_pd(x, l.o[0]);
+    const __m128d dy = _mm_sub_pd(y, l.o[1]);
+    const __m128d dz = _mm_sub_pd(z, l.o[2]);
+    ox = _mm_add_pd(_mm_add_pd(_mm_mul_pd(l.m[0], dx), _mm_mul_pd(l.m[1], dy)),
+                    _mm_mul_pd(l.m[2], dz));
+    oy = _mm_add_pd(_mm_add_pd(_mm_mul_pd(l.m[3], dx), _mm_mul_pd(l.m[4], dy)),
+                    _mm_mul_pd(l.m[5], dz));
+    oz = _mm_add_pd(_mm_add_pd(_mm_mul_pd(l.m[6], dx), _mm_mul_pd(l.m[7], dy)),
+                    _mm_mul_pd(l.m[8], dz));
+}
+
+inline void transform(const FloatLanes& l, __m128 x, __m128 y, __m128 z,
+                      __m128& ox, __m128& oy, __m128& oz) {
+    const __m128 dx = _mm_sub_ps(x, l.o[0]);
+    const __m128 dy = _mm_sub_ps(y, l.o[1]);
+    const __m128 dz = _mm_sub_ps(z, l.o[2]);
+    ox = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l.m[0], dx), _mm_mul_ps(l.m[1], dy)),
+                    _mm_mul_ps(l.m[2], dz));
+    oy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l.m[3], dx), _mm_mul_ps(l.m[4], dy)),
+                    _mm_mul_ps(l.m[5], dz));
+    oz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l.m[6], dx), _mm_mul_ps(l.m[7], dy)),
+                    _mm_mul_ps(l.m[8], dz));
+}
+
+/// 2 int16 to 2 doubles
+inline __m128d loadShorts(const short* p) {
+    int pair;
+    std::memcpy(&pair, p, sizeof(pair));
+    return _mm_cvtepi32_pd(_mm_cvtepi16_epi32(_mm_cvtsi32_si128(pair)));
+}
+
+/// 4 int16 to 4 floats
+inline __m128 loadShorts4(const short* p) {
+    const __m128i s = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+    return _mm_cvtepi32_ps(_mm_cvtepi16_epi32(s));
+}
+
+void applyDoubles(const Transform& t, const double* x, const double* y,
+                  const double* z, double* outX, double* outY, double* outZ,
+                  int n) {
+    const DoubleLanes l = broadcast(t, __m128d());
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d ox, oy, oz;
+        transform(l, _mm_loadu_pd(x + i), _mm_loadu_pd(y + i),
+                  _mm_loadu_pd(z + i), ox, oy, oz);
+        _mm_storeu_pd(outX + i, ox);
+        _mm_storeu_pd(outY + i, oy);
+        _mm_storeu_pd(outZ + i, oz);
+    }
+    applyScalar(t, x, y, z, outX, outY, outZ, i, n);
+}
+
+void applyShorts(const Transform& t, const short* x, const short* y,
+                 const short* z, double* outX, double* outY, double* outZ,
+                 int n) {
+    const DoubleLanes l = broadcast(t, __m128d());
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d ox, oy, oz;
+        transform(l, loadShorts(x + i), loadShorts(y + i), loadShorts(z + i),
+                  ox, oy, oz);
+        _mm_storeu_pd(outX + i, ox);
+        _mm_storeu_pd(outY + i, oy);
+        _mm_storeu_pd(outZ + i, oz);
+    }
+    applyScalar(t, x, y, z, outX, outY, outZ, i, n);
+}
+
+void applyFloats(const Transform& t, const short* x, const short* y,
+                 const short* z, float* outX, float* outY, float* outZ,
+                 int n) {
+    const FloatLanes l = broadcast(t, __m128());
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 ox, oy, oz;
+        transform(l, loadShorts4(x + i), loadShorts4(y + i),
+                  loadShorts4(z + i), ox, oy, oz);
+        _mm_storeu_ps(outX + i, ox);
+        _mm_storeu_ps(outY + i, oy);
+        _mm_storeu_ps(outZ + i, oz);
+    }
+    applyScalar(t, x, y, z, outX, outY, outZ, i, n);
+}
+
+void moments(const double* x, const double* y, const double* z, int n,
+             double sums[quadricSums]) {
+    __m128d acc[quadricSums];
+    for (int k = 0; k < quadricSums; k++)
+        acc[k] = _mm_setzero_pd();
+    const __m128d two = _mm_set1_pd(2);
+    int s = 0;
+    for (; s + 2 <= n; s += 2) {
+        const __m128d vx = _mm_loadu_pd(x + s);
+        const __m128d vy = _mm_loadu_pd(y + s);
+        const __m128d vz = _mm_loadu_pd(z + s);
+        const __m128d d[quadricTerms] = {
+            _mm_mul_pd(vx, vx),
+            _mm_mul_pd(vy, vy),
+            _mm_mul_pd(vz, vz),
+            _mm_mul_pd(two, _mm_mul_pd(vy, vz)),
+            _mm_mul_pd(two, _mm_mul_pd(vx, vz)),
+            _mm_mul_pd(two, _mm_mul_pd(vx, vy)),
+            _mm_mul_pd(two, vx),
+            _mm_mul_pd(two, vy),
+            _mm_mul_pd(two, vz),
+            _mm_set1_pd(1)};
+        __m128d* sum = acc;
+        for (int i = 0; i < quadricTerms; i++)
+            for (int j = i; j < quadricTerms; j++, sum++)
+                *sum = _mm_add_pd(*sum, _mm_mul_pd(d[i], d[j]));
+    }
+    double lanes[2];
+    for (int k = 0; k < quadricSums; k++) {
+        _mm_storeu_pd(lanes, acc[k]);
+        sums[k] += lanes[0] + lanes[1];
+    }
+    momentsScalar(x, y, z, s, n, sums);
+}
+
+void ellipsoid(const double* x, const double* y, const double* z,
+               const unsigned char* copies, int n,
+               double sums[ellipsoidSums]) {
+    __m128d acc[ellipsoidSums];
+    for (int k = 0; k < ellipsoidSums; k++)
+        acc[k] = _mm_setzero_pd();
+    int s = 0;
+    for (; s + 2 <= n; s += 2) {
+        unsigned short pair;
+        std::memcpy(&pair, copies + s, sizeof(pair));
+        const __m128d count =
+            _mm_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(pair)));
+        const __m128d vx = _mm_loadu_pd(x + s);
+        const __m128d vy = _mm_loadu_pd(y + s);
+        const __m128d vz = _mm_loadu_pd(z + s);
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d h[ellipsoidTerms] = {
+            vx, vy, vz, _mm_sub_pd(zero, _mm_mul_pd(vy, vy)),
+            _mm_sub_pd(zero, _mm_mul_pd(vz, vz)), _mm_set1_pd(1)};
+        const __m128d w = _mm_mul_pd(vx, vx);
+        __m128d* sum = acc;
+        for (int i = 0; i < ellipsoidTerms; i++) {
+            const __m128d weighted = _mm_mul_pd(count, h[i]);
+            for (int j = i; j < ellipsoidTerms; j++, sum++)
+                *sum = _mm_add_pd(*sum, _mm_mul_pd(weighted, h[j]));
+            __m128d& target = acc[ellipsoidSums - ellipsoidTerms + i];
+            target = _mm_add_pd(target, _mm_mul_pd(weighted, w));
+        }
+    }
+    double lanes[2];
+    for (int k = 0; k < ellipsoidSums; k++) {
+        _mm_storeu_pd(lanes, acc[k]);
+        sums[k] += lanes[0] + lanes[1];
+    }
+    ellipsoidScalar(x, y, z, copies, s, n, sums);
+}
+
+} // namespace sse42
+SIMD_TARGET_END
+#endif
+
+#ifdef SIMD_HAVE_AVX2
+SIMD_TARGET_BEGIN("avx2,fma")
+namespace avx2 {
+
+/// the transform broadcast to every lane
+struct DoubleLanes {
+    __m256d o[3];
+    __m256d m[9];
+};
+
+struct FloatLanes {
+    __m256 o[3];
+    __m256 m[9];
+};
+
+DoubleLanes broadcast(const Transform& t, __m256d) {
+    DoubleLanes l;
+    for (int i = 0; i < 3; i++)
+        l.o[i] = _mm256_set1_pd(t.offset[i]);
+    for (int i = 0; i < 9; i++)
+        l.m[i] = _mm256_set1_pd(t.matrix[i]);
+    return l;
+}
+
+FloatLanes broadcast(const Transform& t, __m256) {
+    FloatLanes l;
+    for (int i = 0; i < 3; i++)
+        l.o[i] = _mm256_set1_ps(static_cast<float>(t.offset[i]));
+    for (int i = 0; i < 9; i++)
+        l.m[i] = _mm256_set1_ps(static_cast<float>(t.matrix[i]));
+    return l;
+}
+
+inline void transform(const DoubleLanes& l, __m256d x, __m256d y,
+                      __m256d z, __m256d& ox, __m256d& oy, __m256d& oz) {
+    const __m256d dx = _mm256_sub_pd(x, l.o[0]);
+    const __m256d dy = _mm256_sub_pd(y, l.o[1]);
+    const __m256d dz = _mm256_sub_pd(z, l.o[2]);
+    ox = _mm256_fmadd_pd(l.m[2], dz,
+                         _mm256_fmadd_pd(l.m[1], dy, _mm256_mul_pd(l.m[0], dx)));
+    oy = _mm256_fmadd_pd(l.m[5], dz,
+                         _mm256_fmadd_pd(l.m[4], dy, _mm256_mul_pd(l.m[3], dx)));
+    oz = _mm256_fmadd_pd(l.m[8], dz,
+                         _mm256_fmadd_pd(l.m[7], dy, _mm256_mul_pd(l.m[6], dx)));
+}
+
+inline void transform(const FloatLanes& l, __m256 x, __m256 y, __m256 z,
+                      __m256& ox, __m256& oy, __m256& oz) {
+    const __m256 dx = _mm256_sub_ps(x, l.o[0]);
+    const __m256 dy = _mm256_sub_ps(y, l.o[1]);
+    const __m256 dz = _mm256_sub_ps(z, l.o[2]);
+    ox = _mm256_fmadd_ps(l.m[2], dz,
+                         _mm256_fmadd_ps(l.m[1], dy, _mm256_mul_ps(l.m[0], dx)));
+    oy = _mm256_fmadd_ps(l.m[5], dz,
+                         _mm256_fmadd_ps(l.m[4], dy, _mm256_mul_ps(l.m[3], dx)));
+    oz = _mm256_fmadd_ps(l.m[8], dz,
+                         _mm256_fmadd_ps(l.m[7], dy, _mm256_mul_ps(l.m[6], dx)));
+}
+
+/// 4 int16 to 4 doubles
+inline __m256d loadShorts(const short* p) {
+    const __m128i s = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+    return _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(s));
+}
+
+/// 8 int16 to 8 floats
+inline __m256 loadShorts8(const short* p) {
+    const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(s));
+}
+
+void applyDoubles(const Transform& t, const double* x, const double* y,
+                  const double* z, double* outX, double* outY, double* outZ,
+                  int n) {
+    const DoubleLanes l = broadcast(t, __m256d());
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d ox, oy, oz;
+        transform(l, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i),
+                  _mm256_loadu_pd(z + i), ox, oy, oz);
+        _mm256_storeu_pd(outX + i, ox);
+        _mm256_storeu_pd(outY + i, oy);
+        _mm256_storeu_pd(outZ + i, oz);
+    }
+    applyScalar(t, x, y, z, outX, outY, outZ, i, n);
+}
+
+void applyShorts(const Transform& t, const short* x, const short* y,
+                 const short* z, double* outX, double* outY, double* outZ,
+                 int n) {
+    const DoubleLanes l = broadcast(t, __m256d());
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d ox, oy, oz;
+        transform(l, loadShorts(x + i), loadShorts(y + i), loadShorts(z + i),
+                  ox, oy, oz);
+        _mm256_storeu_pd(outX + i, ox);
+        _mm256_storeu_pd(outY + i, oy);
+        _mm256_storeu_pd(outZ + i, oz);
+    }
+    applyScalar(t, x, y, z, outX, outY, outZ, i, n);
+}
+
+void applyFloats(const Transform& t, const short* x, const short* y,
+                 const short* z, float* outX, float* outY, float* outZ,
+                 int n) {
+    const FloatLanes l = broadcast(t, __m256());
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 ox, oy, oz;
+        transform(l, loadShorts8(x + i), loadShorts8(y + i),
+                  loadShorts8(z + i), ox, oy, oz);
+        _mm256_storeu_ps(outX + i, ox);
+        _mm256_storeu_ps(outY + i, oy);
+        _mm256_storeu_ps(outZ + i, oz);
+    }
+    applyScalar(t, x, y, z, outX, outY, outZ, i, n);
+}
+
+void moments(const double* x, const double* y, const double* z, int n,
+             double sums[quadricSums]) {
+    __m256d acc[quadricSums];
+    for (int k = 0; k < quadricSums; k++)
+        acc[k] = _mm256_setzero_pd();
+    const __m256d two = _mm256_set1_pd(2);
+    int s = 0;
+    for (; s + 4 <= n; s += 4) {
+        const __m256d vx = _mm256_loadu_pd(x + s);
+        const __m256d vy = _mm256_loadu_pd(y + s);
+        const __m256d vz = _mm256_loadu_pd(z + s);
+        const __m256d d[quadricTerms] = {
+            _mm256_mul_pd(vx, vx),
+            _mm256_mul_pd(vy, vy),
+            _mm256_mul_pd(vz, vz),
+            _mm256_mul_pd(two, _mm256_mul_pd(vy, vz)),
+            _mm256_mul_pd(two, _mm256_mul_pd(vx, vz)),
+            _mm256_mul_pd(two, _mm256_mul_pd(vx, vy)),
+            _mm256_mul_pd(two, vx),
+            _mm256_mul_pd(two, vy),
+            _mm256_mul_pd(two, vz),
+            _mm256_set1_pd(1)};
+        __m256d* sum = acc;
+        for (int i = 0; i < quadricTerms; i++)
+            for (int j = i; j < quadricTerms; j++, sum++)
+                *sum = _mm256_fmadd_pd(d[i], d[j], *sum);
+    }
+    double lanes[4];
+    for (int k = 0; k < quadricSums; k++) {
+        _mm256_storeu_pd(lanes, acc[k]);
+        sums[k] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+    momentsScalar(x, y, z, s, n, sums);
+}
+
+void ellipsoid(const double* x, const double* y, const double* z,
+               const unsigned char* copies, int n,
+               double sums[ellipsoidSums]) {
+    __m256d acc[ellipsoidSums];
+    for (int k = 0; k < ellipsoidSums; k++)
+        acc[k] = _mm256_setzero_pd();
+    int s = 0;
+    for (; s + 4 <= n; s += 4) {
+        int quad;
+        std::memcpy(&quad, copies + s, sizeof(quad));
+        const __m256d count =
+            _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(quad)));
+        const __m256d vx = _mm256_loadu_pd(x + s);
+        const __m256d vy = _mm256_loadu_pd(y + s);
+        const __m256d vz = _mm256_loadu_pd(z + s);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d h[ellipsoidTerms] = {
+            vx, vy, vz, _mm256_fnmadd_pd(vy, vy, zero),
+            _mm256_fnmadd_pd(vz, vz, zero), _mm256_set1_pd(1)};
+        const __m256d w = _mm256_mul_pd(vx, vx);
+        __m256d* sum = acc;
+        for (int i = 0; i < ellipsoidTerms; i++) {
+            const __m256d weighted = _mm256_mul_pd(count, h[i]);
+            for (int j = i; j < ellipsoidTerms; j++, sum++)
+                *sum = _mm256_fmadd_pd(weighted, h[j], *sum);
+            __m256d& target = acc[ellipsoidSums - ellipsoidTerms + i];
+            target = _mm256_fmadd_pd(weighted, w, target);
+        }
+    }
+    double lanes[4];
+    for (int k = 0; k < ellipsoidSums; k++) {
+        _mm256_storeu_pd(lanes, acc[k]);
+        sums[k] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+    ellipsoidScalar(x, y, z, copies, s, n, sums);
+}
+
+} // namespace avx2
+SIMD_TARGET_END
+#endif
+
+#ifdef SIMD_HAVE_AVX512
+// GCC 12 takes the deliberately undefined registers of its own avx512f
+// intrinsics for uninitialized variables
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+SIMD_TARGET_BEGIN("avx512f")
+namespace avx512 {
+
+/// the transform broadcast to every lane
+struct DoubleLanes {
+    __m512d o[3];
+    __m512d m[9];
+};
+
+struct FloatLanes {
+    __m512 o[3];
+    __m512 m[9];
+};
+
+DoubleLanes broadcast(const Transform& t, __m512d) {
+    DoubleLanes l;
+    for (int i = 0; i < 3; i++)
+        l.o[i] = _mm512_set1_pd(t.offset[i]);
+    for (int i = 0; i < 9; i++)
+        l.m[i] = _mm512_set1_pd(t.matrix[i]);
+    return l;
+}
+
+FloatLanes broadcast(const Transform& t, __m512) {
+    FloatLanes l;
+    for (int i = 0; i < 3; i++)
+        l.o[i] = _mm512_set1_ps(static_cast<float>(t.offset[i]));
+    for (int i = 0; i < 9; i++)
+        l.m[i] = _mm512_set1_ps(static_cast<float>(t.matrix[i]));
+    return l;
+}
+
+inline void transform(const DoubleLanes& l, __m512d x, __m512d y,
+                      __m512d z, __m512d& ox, __m512d& oy, __m512d& oz) {
+    const __m512d dx = _mm512_sub_pd(x, l.o[0]);
+    const __m512d dy = _mm512_sub_pd(y, l.o[1]);
+    const __m512d dz = _mm512_sub_pd(z, l.o[2]);
+    ox = _mm512_fmadd_pd(l.m[2], dz,
+                         _mm512_fmadd_pd(l.m[1], dy, _mm512_mul_pd(l.m[0], dx)));
+    oy = _mm512_fmadd_pd(l.m[5], dz,
+                         _mm512_fmadd_pd(l.m[4], dy, _mm512_mul_pd(l.m[3], dx)));
+    oz = _mm512_fmadd_pd(l.m[8], dz,
+                         _mm512_fmadd_pd(l.m[7], dy, _mm512_mul_pd(l.m[6], dx)));
+}
+
+inline void transform(const FloatLanes& l, __m512 x, __m512 y, __m512 z,
+                      __m512& ox, __m512& oy, __m512& oz) {
+    const __m512 dx = _mm512_sub_ps(x, l.o[0]);
+    const __m512 dy = _mm512_sub_ps(y, l.o[1]);
+    const __m512 dz = _mm512_sub_ps(z, l.o[2]);
+    ox = _mm512_fmadd_ps(l.m[2], dz,
+                         _mm512_fmadd_ps(l.m[1], dy, _mm512_mul_ps(l.m[0], dx)));
+    oy = _mm512_fmadd_ps(l.m[5], dz,
+                         _mm512_fmadd_ps(l.m[4], dy, _mm512_mul_ps(l.m[3], dx)));
+    oz = _mm512_fmadd_ps(l.m[8], dz,
+                         _mm512_fmadd_ps(l.m[7], dy, _mm512_mul_ps(l.m[6], dx)));
+}
+
+/// 8 int16 to 8 doubles
+inline __m512d loadShorts(const short* p) {
+    const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return _mm512_cvtepi32_pd(_mm256_cvtepi16_epi32(s));
+}
+
+/// 16 int16 to 16 floats
+inline __m512 loadShorts16(const short* p) {
+    const __m256i s =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    return _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(s));
+}
+
+void applyDoubles(const Transform& t, const double* x, const double* y,
+                  const double* z, double* outX, double* outY, double* outZ,
+                  int n) {
+    const DoubleLanes l = broadcast(t, __m512d());
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d ox, oy, oz;
+        transform(l, _mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i),
+                  _mm512_loadu_pd(z + i), ox, oy, oz);
+        _mm512_storeu_pd(outX + i, ox);
+        _mm512_storeu_pd(outY + i, oy);
+        _mm512_storeu_pd(outZ + i, oz);
+    }
+    applyScalar(t, x, y, z, outX, outY, outZ, i, n);
+}
+
+void applyShorts(const Transform& t, const short* x, const short* y,
+                 const short* z, double* outX, double* outY, double* outZ,
+                 int n) {
+    const DoubleLanes l = broadcast(t, __m512d());
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d ox, oy, oz;
+        transform(l, loadShorts(x + i), loadShorts(y + i), loadShorts(z + i),
+                  ox, oy, oz);
+        _mm512_storeu_pd(outX + i, ox);
+        _mm512_storeu_pd(outY + i, oy);
+        _mm512_storeu_pd(outZ + i, oz);
+    }
+    applyScalar(t, x, y, z, outX, outY, outZ, i, n);
+}
+
+void applyFloats(const Transform& t, const short* x, const short* y,
+                 const short* z, float* outX, float* outY, float* outZ,
+                 int n) {
+    const FloatLanes l = broadcast(t, __m512());
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 ox, oy, oz;
+        transform(l, loadShorts16(x + i), loadShorts16(y + i),
+                  loadShorts16(z + i), ox, oy, oz);
+        _mm512_storeu_ps(outX + i, ox);
+        _mm512_storeu_ps(outY + i, oy);
+        _mm512_storeu_ps(outZ + i, oz);
+    }
+    applyScalar(t, x, y, z, outX, outY, outZ, i, n);
+}
+
+void moments(const double* x, const double* y, const double* z, int n,
+             double sums[quadricSums]) {
+    __m512d acc[quadricSums];
+    for (int k = 0; k < quadricSums; k++)
+        acc[k] = _mm512_setzero_pd();
+    const __m512d two = _mm512_set1_pd(2);
+    int s = 0;
+    for (; s + 8 <= n; s += 8) {
+        const __m512d vx = _mm512_loadu_pd(x + s);
+        const __m512d vy = _mm512_loadu_pd(y + s);
+        const __m512d vz = _mm512_loadu_pd(z + s);
+        const __m512d d[quadricTerms] = {
+            _mm512_mul_pd(vx, vx),
+            _mm512_mul_pd(vy, vy),
+            _mm512_mul_pd(vz, vz),
+            _mm512_mul_pd(two, _mm512_mul_pd(vy, vz)),
+            _mm512_mul_pd(two, _mm512_mul_pd(vx, vz)),
+            _mm512_mul_pd(two, _mm512_mul_pd(vx, vy)),
+            _mm512_mul_pd(two, vx),
+            _mm512_mul_pd(two, vy),
+            _mm512_mul_pd(two, vz),
+            _mm512_set1_pd(1)};
+        __m512d* sum = acc;
+        for (int i = 0; i < quadricTerms; i++)
+            for (int j = i; j < quadricTerms; j++, sum++)
+                *sum = _mm512_fmadd_pd(d[i], d[j], *sum);
+    }
+    double lanes[8];
+    for (int k = 0; k < quadricSums; k++) {
+        _mm512_storeu_pd(lanes, acc[k]);
+        sums[k] += ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+            ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+    momentsScalar(x, y, z, s, n, sums);
+}
+
+void ellipsoid(const double* x, const double* y, const double* z,
+               const unsigned char* copies, int n,
+               double sums[ellipsoidSums]) {
+    __m512d acc[ellipsoidSums];
+    for (int k = 0; k < ellipsoidSums; k++)
+        acc[k] = _mm512_setzero_pd();
+    int s = 0;
+    for (; s + 8 <= n; s += 8) {
+        const __m128i eight =
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(copies + s));
+        const __m512d count = _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(eight));
+        const __m512d vx = _mm512_loadu_pd(x + s);
+        const __m512d vy = _mm512_loadu_pd(y + s);
+        const __m512d vz = _mm512_loadu_pd(z + s);
+        const __m512d zero = _mm512_setzero_pd();
+        const __m512d h[ellipsoidTerms] = {
+            vx, vy, vz, _mm512_fnmadd_pd(vy, vy, zero),
+            _mm512_fnmadd_pd(vz, vz, zero), _mm512_set1_pd(1)};
+        const __m512d w = _mm512_mul_pd(vx, vx);
+        __m512d* sum = acc;
+        for (int i = 0; i < ellipsoidTerms; i++) {
+            const __m512d weighted = _mm512_mul_pd(count, h[i]);
+            for (int j = i; j < ellipsoidTerms; j++, sum++)
+                *sum = _mm512_fmadd_pd(weighted, h[j], *sum);
+            __m512d& target = acc[ellipsoidSums - ellipsoidTerms + i];
+            target = _mm512_fmadd_pd(weighted, w, target);
+        }
+    }
+    double lanes[8];
+    for (int k = 0; k < ellipsoidSums; k++) {
+        _mm512_storeu_pd(lanes, acc[k]);
+        sums[k] += ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+            ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+    ellipsoidScalar(x, y, z, copies, s, n, sums);
+}
+
+} // namespace avx512
+SIMD_TARGET_END
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+/// one instruction set's kernels
+struct Kernels {
+    void (*applyDoubles)(const Transform&, const double*, const double*,
+                         const double*, double*, double*, double*, int);
+    void (*applyShorts)(const Transform&, const short*, const short*,
+                        const short*, double*, double*, double*, int);
+    void (*applyFloats)(const Transform&, const short*, const short*,
+                        const short*, float*, float*, float*, int);
+    void (*moments)(const double*, const double*, const double*, int,
+                    double*);
+    void (*ellipsoid)(const double*, const double*, const double*,
+                      const unsigned char*, int, double*);
+};
+
+Kernels select(simd::Level level) {
+    switch (level) {
+#ifdef SIMD_HAVE_AVX512
+    case simd::AVX512:
+        return {avx512::applyDoubles, avx512::applyShorts,
+                avx512::applyFloats, avx512::moments, avx512::ellipsoid};
+#endif
+#ifdef SIMD_HAVE_AVX2
+    case simd::AVX2:
+        return {avx2::applyDoubles, avx2::applyShorts, avx2::applyFloats,
+                avx2::moments, avx2::ellipsoid};
+#endif
+#ifdef SIMD_HAVE_SSE42
+    case simd::SSE42:
+        return {sse42::applyDoubles, sse42::applyShorts, sse42::applyFloats,
+                sse42::moments, sse42::ellipsoid};
+#endif
+    default:
+        return {scalar::applyDoubles, scalar::applyShorts,
+                scalar::applyFloats, scalar::moments, scalar::ellipsoid};
+    }
+}
+
+/// chosen on the first call, see simd::active()
+const Kernels& kernels() {
+    static const Kernels chosen = select(simd::active());
+    return chosen;
+}
+
+} // namespace
+
+void apply(const Transform& t, const double* x, const double* y,
+           const double* z, double* outX, double* outY, double* outZ, int n) {
+    kernels().applyDoubles(t, x, y, z, outX, outY, outZ, n);
+}
+
+void apply(const Transform& t, double* x, double* y, double* z, int n) {
+    // every lane is loaded before it is stored, so in place is safe
+    apply(t, x, y, z, x, y, z, n);
+}
+
+void apply(const Transform& t, const short* x, const short* y,
+           const short* z, double* outX, double* outY, double* outZ, int n) {
+    kernels().applyShorts(t, x, y, z, outX, outY, outZ, n);
+}
+
+void apply(const Transform& t, const short* x, const short* y,
+           const short* z, float* outX, float* outY, float* outZ, int n) {
+    kernels().applyFloats(t, x, y, z, outX, outY, outZ, n);
+}
+
+void quadricMoments(const double* x, const double* y, const double* z, int n,
+                    double sums[quadricSums]) {
+    kernels().moments(x, y, z, n, sums);
+}
+
+void ellipsoidMoments(const double* x, const double* y, const double* z,
+                      const unsigned char* copies, int n,
+                      double sums[ellipsoidSums]) {
+    kernels().ellipsoid(x, y, z, copies, n, sums);
+}
+
+} // namespace calkernels
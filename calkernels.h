@@ -0,0 +1,70 @@
+#pragma once
+
+namespace calkernels {
+
+/// <summary>
+/// Affine calibration of a 3-axis sensor: out = matrix * (raw - offset),
+/// matrix is row-major 3x3
+/// </summary>
+struct Transform {
+    double offset[3];
+    double matrix[9];
+};
+
+/// <summary>
+/// Applies the transform to n samples stored as separate x, y and z
+/// buffers (structure of arrays). Vectorized for the instruction set of
+/// the CPU, see simd.h.
+/// </summary>
+/// <remarks>The outputs may be the inputs themselves (in place), but must
+/// not partially overlap them</remarks>
+void apply(const Transform& t, const double* x, const double* y,
+           const double* z, double* outX, double* outY, double* outZ, int n);
+
+/// <summary>
+/// In place variant, the buffers receive the calibrated samples
+/// </summary>
+void apply(const Transform& t, double* x, double* y, double* z, int n);
+
+/// <summary>
+/// Raw int16 readings straight to calibrated doubles
+/// </summary>
+void apply(const Transform& t, const short* x, const short* y,
+           const short* z, double* outX, double* outY, double* outZ, int n);
+
+/// <summary>
+/// Raw int16 readings straight to calibrated floats, the fastest path:
+/// twice the lanes of the double variants
+/// </summary>
+void apply(const Transform& t, const short* x, const short* y,
+           const short* z, float* outX, float* outY, float* outZ, int n);
+
+// monomials of a quadric row: x^2, y^2, z^2, 2yz, 2xz, 2xy, 2x, 2y, 2z, 1
+const int quadricTerms = 10;
+// distinct entries of their scatter matrix
+const int quadricSums = quadricTerms * (quadricTerms + 1) / 2;
+
+/// <summary>
+/// Adds the upper triangle of D^T D over n samples to sums, row by row,
+/// the rows of D being the quadric monomials of the samples. Vectorized
+/// across samples, every lane keeps its own sums until the end.
+/// </summary>
+void quadricMoments(const double* x, const double* y, const double* z, int n,
+                    double sums[quadricSums]);
+
+// design row of the axis-aligned fit: x, y, z, -y^2, -z^2, 1, target x^2
+const int ellipsoidTerms = 6;
+// upper triangle of H^T H, row by row, then H^T W
+const int ellipsoidSums = ellipsoidTerms * (ellipsoidTerms + 1) / 2 +
+    ellipsoidTerms;
+
+/// <summary>
+/// Adds the normal equations of n samples to sums, sample i counted
+/// copies[i] times, as in a bootstrap resample. The rows are those of
+/// EllipsoidMoments::design. Vectorized across samples.
+/// </summary>
+void ellipsoidMoments(const double* x, const double* y, const double* z,
+                      const unsigned char* copies, int n,
+                      double sums[ellipsoidSums]);
+
+} // namespace calkernels
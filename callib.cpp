@@ -1,83 +1,476 @@
 #include "callib.h"
+#include "parallel.h"
+#include "symmetriceigen.h"
+
+#include <limits>
+#include <stdexcept>
 
 CalLib::CalLib() {
 }
 
-QPair<QVector<long>, QVector<double>>&&
-CalLib::calibrate(QVector<double>& x, QVector<double>& y, QVector<double>& z) {
-    matrices::Matrix<double> X(x.toStdVector());
-    matrices::Matrix<double> Y(y.toStdVector());
-    matrices::Matrix<double> Z(z.toStdVector());
-    QVector<double> data;
-    data.append(x);
-    data.append(y);
-    data.append(z);
-    data.append(
-        QVector<double>::fromStdVector((Y.simpleMul(Y) * -1).toVector()));
-    data.append(
-        QVector<double>::fromStdVector((Z.simpleMul(Z) * -1).toVector()));
-    data.append(QVector<double>(x.size(), 1));
-    for (int i = 0; i < x.size() - 6; ++i) {
-        data.append(QVector<double>(x.size(), 0));
+EllipsoidMoments::EllipsoidMoments() {
+    clear();
+}
+
+void EllipsoidMoments::clear() {
+    for (int i = 0; i < unknowns; ++i) {
+        for (int j = 0; j < unknowns; ++j) {
+            hth[i][j] = 0;
+        }
+        htw[i] = 0;
     }
+    samples = 0;
+}
 
-    const int N = x.size();
-    matrices::Matrix<double> H(data.toStdVector());
-    H.reshape(N, N);
+double EllipsoidMoments::design(double x, double y, double z,
+                                double h[unknowns]) {
+    h[0] = x;
+    h[1] = y;
+    h[2] = z;
+    h[3] = -y * y;
+    h[4] = -z * z;
+    h[5] = 1;
+    return x * x;
+}
 
-    auto W = X.simpleMul(X).transpose();
-    auto solutions = (H.transpose() * H).invert() * H.transpose() * W;
+void EllipsoidMoments::add(double x, double y, double z) {
+    // one row of the design matrix H and of the target vector W
+    double h[unknowns];
+    const double w = design(x, y, z, h);
+    for (int i = 0; i < unknowns; ++i) {
+        for (int j = i; j < unknowns; ++j) {
+            hth[i][j] += h[i] * h[j];
+        }
+        htw[i] += h[i] * w;
+    }
+    ++samples;
+}
 
-    double OSx = solutions.getAt(0, 0) / 2;
-    double OSy = solutions.getAt(0, 1) / (2 * solutions.getAt(0, 3));
-    double OSz = solutions.getAt(0, 2) / (2 * solutions.getAt(0, 4));
+void EllipsoidMoments::add(const double* x, const double* y,
+                           const double* z, const unsigned char* copies,
+                           int n) {
+    static_assert(calkernels::ellipsoidTerms == unknowns, "design width");
+    double sums[calkernels::ellipsoidSums] = {};
+    calkernels::ellipsoidMoments(x, y, z, copies, n, sums);
+    const double* sum = sums;
+    for (int i = 0; i < unknowns; ++i) {
+        for (int j = i; j < unknowns; ++j) {
+            hth[i][j] += *sum++;
+        }
+    }
+    for (int i = 0; i < unknowns; ++i) {
+        htw[i] += *sum++;
+    }
+    for (int i = 0; i < n; ++i) {
+        samples += copies[i];
+    }
+}
 
-    double A = solutions.getAt(0, 5) + std::pow(OSx, 2) +
-        solutions.getAt(0, 3) * std::pow(OSy, 2) +
-        solutions.getAt(0, 4) * std::pow(OSz, 2);
-    double B = A / solutions.getAt(0, 3);
-    double C = A / solutions.getAt(0, 4);
+void EllipsoidMoments::merge(const EllipsoidMoments& other) {
+    for (int i = 0; i < unknowns; ++i) {
+        for (int j = i; j < unknowns; ++j) {
+            hth[i][j] += other.hth[i][j];
+        }
+        htw[i] += other.htw[i];
+    }
+    samples += other.samples;
+}
+
+long EllipsoidMoments::count() const {
+    return samples;
+}
 
-    double SCx = std::sqrt(A);
-    double SCy = std::sqrt(B);
-    double SCz = std::sqrt(C);
+bool EllipsoidMoments::solve(double solution[unknowns]) const {
+    if (samples < unknowns) return false;
+
+    // the columns of H span many orders of magnitude (1 .. y^2), so the
+    // system is equilibrated before factorizing: (D A D) u = D b, x = D u
+    double d[unknowns];
+    for (int i = 0; i < unknowns; ++i) {
+        if (hth[i][i] <= 0) return false;
+        d[i] = 1 / std::sqrt(hth[i][i]);
+    }
+    matrices::FixedMatrix<double, unknowns, unknowns> a;
+    matrices::FixedMatrix<double, unknowns, 1> b;
+    for (int i = 0; i < unknowns; ++i) {
+        for (int j = 0; j < unknowns; ++j) {
+            const double v = i <= j ? hth[i][j] : hth[j][i];
+            a(i, j) = d[i] * v * d[j];
+        }
+        b[i] = d[i] * htw[i];
+    }
 
-    // type conversion from numpy.float64 to standard python floats
-    QVector<long> offsets = {(long) std::round(OSx), (long) std::round(OSy),
-                             (long) std::round(OSz)};
-    QVector<double> scale = {SCx, SCy, SCz};
+    // H^T H is symmetric positive definite unless the samples are degenerate
+    if (!matrices::solveSpd(a, b)) return false;
+    for (int i = 0; i < unknowns; ++i) {
+        solution[i] = b[i] * d[i];
+    }
+    return true;
+}
 
-    return std::move(qMakePair(offsets, scale));
+double EllipsoidMoments::condition() const {
+    if (samples < unknowns) return std::numeric_limits<double>::infinity();
+    double a[unknowns][unknowns];
+    double d[unknowns];
+    for (int i = 0; i < unknowns; ++i) {
+        if (hth[i][i] <= 0) return std::numeric_limits<double>::infinity();
+        d[i] = 1 / std::sqrt(hth[i][i]);
+    }
+    for (int i = 0; i < unknowns; ++i) {
+        for (int j = 0; j < unknowns; ++j) {
+            a[i][j] = d[i] * (i <= j ? hth[i][j] : hth[j][i]) * d[j];
+        }
+    }
+    double values[unknowns];
+    double vectors[unknowns][unknowns];
+    matrices::symmetricEigen(a, values, vectors);
+    if (values[0] <= 0) return std::numeric_limits<double>::infinity();
+    return values[unknowns - 1] / values[0];
 }
 
-QPair<QVector<long>, QVector<double>>&&
+bool EllipsoidMoments::solve_ellipsoid(double offset[3],
+                                       double scale[3]) const {
+    double solutions[unknowns];
+    if (!solve(solutions)) return false;
+    return to_ellipsoid(solutions, offset, scale);
+}
+
+bool EllipsoidMoments::to_ellipsoid(const double solutions[unknowns],
+                                    double offset[3], double scale[3]) {
+    double OSx = solutions[0] / 2;
+    double OSy = solutions[1] / (2 * solutions[3]);
+    double OSz = solutions[2] / (2 * solutions[4]);
+
+    double A = solutions[5] + std::pow(OSx, 2) +
+        solutions[3] * std::pow(OSy, 2) + solutions[4] * std::pow(OSz, 2);
+    double B = A / solutions[3];
+    double C = A / solutions[4];
+
+    // negative squared radii mean the samples do not describe an ellipsoid
+    if (!(A > 0 && B > 0 && C > 0)) return false;
+
+    offset[0] = OSx;
+    offset[1] = OSy;
+    offset[2] = OSz;
+    scale[0] = std::sqrt(A);
+    scale[1] = std::sqrt(B);
+    scale[2] = std::sqrt(C);
+    return true;
+}
+
+QuadricMoments::QuadricMoments() {
+    clear();
+}
+
+void QuadricMoments::clear() {
+    for (int i = 0; i < unknowns; ++i) {
+        for (int j = 0; j < unknowns; ++j) {
+            dtd[i][j] = 0;
+        }
+    }
+    samples = 0;
+}
+
+void QuadricMoments::add(double x, double y, double z) {
+    const double d[unknowns] = {x * x,     y * y, z * z, 2 * y * z,
+                                2 * x * z, 2 * x * y, 2 * x, 2 * y,
+                                2 * z,     1};
+    for (int i = 0; i < unknowns; ++i) {
+        for (int j = i; j < unknowns; ++j) {
+            dtd[i][j] += d[i] * d[j];
+        }
+    }
+    ++samples;
+}
+
+void QuadricMoments::add(const double* x, const double* y, const double* z,
+                         int n) {
+    static_assert(calkernels::quadricTerms == unknowns, "monomial count");
+    double sums[calkernels::quadricSums] = {};
+    calkernels::quadricMoments(x, y, z, n, sums);
+    const double* sum = sums;
+    for (int i = 0; i < unknowns; ++i) {
+        for (int j = i; j < unknowns; ++j) {
+            dtd[i][j] += *sum++;
+        }
+    }
+    samples += n;
+}
+
+void QuadricMoments::merge(const QuadricMoments& other) {
+    for (int i = 0; i < unknowns; ++i) {
+        for (int j = i; j < unknowns; ++j) {
+            dtd[i][j] += other.dtd[i][j];
+        }
+    }
+    samples += other.samples;
+}
+
+long QuadricMoments::count() const {
+    return samples;
+}
+
+void QuadricMoments::scatter(double out[unknowns][unknowns]) const {
+    for (int i = 0; i < unknowns; ++i) {
+        for (int j = i; j < unknowns; ++j) {
+            out[i][j] = dtd[i][j];
+            out[j][i] = dtd[i][j];
+        }
+    }
+}
+
+QVector<double> EllipsoidCalibration::scale() const {
+    // the raw ellipsoid is offset + correction^-1 u for unit u, its half
+    // extent along axis i is the norm of row i of correction^-1. That is
+    // the axis-aligned radius, 1 / correction(i, i) is not once the axes
+    // are mixed.
+    const double* m = correction.data_;
+    const double det = m[0] * (m[4] * m[8] - m[5] * m[7]) -
+        m[1] * (m[3] * m[8] - m[5] * m[6]) +
+        m[2] * (m[3] * m[7] - m[4] * m[6]);
+    QVector<double> scale(3);
+    for (int i = 0; i < 3; ++i) {
+        const int i1 = (i + 1) % 3;
+        const int i2 = (i + 2) % 3;
+        double sum = 0;
+        for (int j = 0; j < 3; ++j) {
+            const int j1 = (j + 1) % 3;
+            const int j2 = (j + 2) % 3;
+            // entry (i, j) of the inverse, from the cofactor of (j, i)
+            const double inverse =
+                (m[j1 * 3 + i1] * m[j2 * 3 + i2] -
+                 m[j1 * 3 + i2] * m[j2 * 3 + i1]) /
+                det;
+            sum += inverse * inverse;
+        }
+        scale[i] = std::sqrt(sum);
+    }
+    return scale;
+}
+
+calkernels::Transform EllipsoidCalibration::transform() const {
+    calkernels::Transform t;
+    for (int i = 0; i < 3; ++i) {
+        t.offset[i] = offset[i];
+    }
+    for (int i = 0; i < 9; ++i) {
+        t.matrix[i] = correction[i];
+    }
+    return t;
+}
+
+QPair<QVector<long>, QVector<double>>
+CalLib::calibrate(const EllipsoidMoments& moments) {
+    double offset[3];
+    double scale[3];
+    if (!moments.solve_ellipsoid(offset, scale))
+        throw std::runtime_error("Cannot fit an ellipsoid to the samples");
+
+    QVector<long> offsets = {(long) std::round(offset[0]),
+                             (long) std::round(offset[1]),
+                             (long) std::round(offset[2])};
+    QVector<double> scales = {scale[0], scale[1], scale[2]};
+
+    return qMakePair(offsets, scales);
+}
+
+namespace {
+
+typedef matrices::LeastSquaresQR<double> EllipsoidQR;
+
+// the triangles are merged in chunk order so the result does not depend on
+// the timing
+QPair<QVector<long>, QVector<double>>
+solve_ellipsoid_qr(const std::vector<EllipsoidQR>& parts) {
+    EllipsoidQR total(EllipsoidMoments::unknowns);
+    for (const EllipsoidQR& part : parts) {
+        total.merge(part);
+    }
+
+    std::vector<double> solution;
+    double offset[3];
+    double scale[3];
+    if (!total.solve(solution) ||
+        !EllipsoidMoments::to_ellipsoid(solution.data(), offset, scale))
+        throw std::runtime_error("Cannot fit an ellipsoid to the samples");
+
+    QVector<long> offsets = {(long) std::round(offset[0]),
+                             (long) std::round(offset[1]),
+                             (long) std::round(offset[2])};
+    QVector<double> scales = {scale[0], scale[1], scale[2]};
+
+    return qMakePair(offsets, scales);
+}
+
+} // namespace
+
+QPair<QVector<long>, QVector<double>>
+CalLib::calibrate(const QVector<double>& x, const QVector<double>& y,
+                  const QVector<double>& z) {
+    const int unknowns = EllipsoidMoments::unknowns;
+
+    // every chunk factorizes its own rows
+    const int chunks = parallel::chunkCount(x.size());
+    std::vector<EllipsoidQR> parts(chunks, EllipsoidQR(unknowns));
+    parallel::forChunks(x.size(), chunks, [&](int begin, int end, int chunk) {
+        double h[unknowns];
+        for (int i = begin; i < end; ++i) {
+            const double w = EllipsoidMoments::design(x[i], y[i], z[i], h);
+            parts[chunk].addRow(h, w);
+        }
+    });
+    return solve_ellipsoid_qr(parts);
+}
+
+QPair<QVector<long>, QVector<double>>
 CalLib::calibrate_from_file(QString file_name) {
-    QFile file(file_name);
-    file.open(QFile::ReadOnly);
-    QVector<double> samples_x;
-    QVector<double> samples_y;
-    QVector<double> samples_z;
-    QTextStream in(&file);
-    while (!in.atEnd()) {
-        QString line = in.readLine();
-        auto reading = line.split(" ");
-        if (reading.size() == 3) {
-            samples_x.append(reading[0].toDouble());
-            samples_y.append(reading[1].toDouble());
-            samples_z.append(reading[2].toDouble());
+    const int unknowns = EllipsoidMoments::unknowns;
+
+    // the rows are factorized as the blocks are parsed, so the capture is
+    // never held in memory
+    std::vector<EllipsoidQR> parts(parallel::threadCount(),
+                                   EllipsoidQR(unknowns));
+    stream_samples(file_name, parts.size(),
+                   [&](const double* x, const double* y, const double* z,
+                       int count, int chunk) {
+                       double h[unknowns];
+                       for (int i = 0; i < count; ++i) {
+                           const double w =
+                               EllipsoidMoments::design(x[i], y[i], z[i], h);
+                           parts[chunk].addRow(h, w);
+                       }
+                   });
+    return solve_ellipsoid_qr(parts);
+}
+
+EllipsoidCalibration
+CalLib::calibrate_rotated(const QuadricMoments& moments) {
+    const int n = QuadricMoments::unknowns;
+    if (moments.count() < n - 1)
+        throw std::runtime_error("Not enough samples to fit an ellipsoid");
+
+    // the algebraic fit is the eigenvector of the smallest eigenvalue of the
+    // scatter matrix. The monomials span many orders of magnitude, so it is
+    // equilibrated first, which only changes the normalisation constraint.
+    double scatter[n][n];
+    moments.scatter(scatter);
+    double d[n];
+    for (int i = 0; i < n; ++i) {
+        if (scatter[i][i] <= 0)
+            throw std::runtime_error("Degenerate samples, cannot fit");
+        d[i] = 1 / std::sqrt(scatter[i][i]);
+    }
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            scatter[i][j] *= d[i] * d[j];
+        }
+    }
+    double values[n];
+    double vectors[n][n];
+    matrices::symmetricEigen(scatter, values, vectors);
+    double v[n];
+    for (int i = 0; i < n; ++i) {
+        v[i] = vectors[i][0] * d[i];
+    }
+
+    // p^T A p + 2 b^T p + v9 = 0
+    const double A[3][3] = {
+        {v[0], v[5], v[4]}, {v[5], v[1], v[3]}, {v[4], v[3], v[2]}};
+    const double b[3] = {v[6], v[7], v[8]};
+
+    double a_values[3];
+    double a_vectors[3][3];
+    matrices::symmetricEigen(A, a_values, a_vectors);
+    if (a_values[0] * a_values[2] <= 0)
+        throw std::runtime_error("Samples do not describe an ellipsoid");
+
+    // center = -A^-1 b, with A^-1 = V diag(1/lambda) V^T
+    double center[3] = {0, 0, 0};
+    for (int i = 0; i < 3; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            double proj = 0;
+            for (int j = 0; j < 3; ++j) {
+                proj += a_vectors[j][k] * b[j];
+            }
+            center[i] -= a_vectors[i][k] * proj / a_values[k];
+        }
+    }
+
+    // (p - c)^T A (p - c) = c^T A c - v9
+    double k = -v[9];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            k += center[i] * A[i][j] * center[j];
+        }
+    }
+    if (k == 0 || a_values[0] / k <= 0)
+        throw std::runtime_error("Samples do not describe an ellipsoid");
+
+    // correction = (A / k)^(1/2), which maps the ellipsoid onto the unit
+    // sphere without an extra rotation
+    EllipsoidCalibration result;
+    result.offset = {center[0], center[1], center[2]};
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            double sum = 0;
+            for (int m = 0; m < 3; ++m) {
+                sum += a_vectors[i][m] * std::sqrt(a_values[m] / k) *
+                    a_vectors[j][m];
+            }
+            result.correction(i, j) = sum;
         }
     }
-    return calibrate(samples_x, samples_y, samples_z);
+    return result;
+}
+
+EllipsoidCalibration CalLib::calibrate_rotated_from_file(QString file_name) {
+    // summed per chunk as the blocks are parsed, then in chunk order
+    std::vector<QuadricMoments> parts(parallel::threadCount());
+    stream_samples(file_name, parts.size(),
+                   [&](const double* x, const double* y, const double* z,
+                       int count, int chunk) {
+                       parts[chunk].add(x, y, z, count);
+                   });
+    QuadricMoments moments;
+    for (const QuadricMoments& part : parts) {
+        moments.merge(part);
+    }
+    return calibrate_rotated(moments);
+}
+
+EllipsoidCalibration CalLib::to_rotated(const QVector<long>& offsets,
+                                        const QVector<double>& scale) {
+    EllipsoidCalibration result;
+    result.offset = {(double) offsets[0], (double) offsets[1],
+                     (double) offsets[2]};
+    for (int i = 0; i < 3; ++i) {
+        result.correction(i, i) = 1 / scale[i];
+    }
+    return result;
 }
 
 QVector<QVector<double>>
 CalLib::compute_calibrate_data(QVector<QVector<double>>& data,
                                QVector<long>& offsets, QVector<double>& scale) {
+    return compute_calibrate_data(data, to_rotated(offsets, scale));
+}
+
+QVector<QVector<double>>
+CalLib::compute_calibrate_data(QVector<QVector<double>>& data,
+                               const EllipsoidCalibration& calibration) {
     QVector<QVector<double>> output(3);
-    for (int i = 0; i < data[0].size(); ++i) {
-        output[0].append((data[0][i] - offsets[0]) / scale[0]);
-        output[1].append((data[1][i] - offsets[1]) / scale[1]);
-        output[2].append((data[2][i] - offsets[2]) / scale[2]);
+    const int n = data[0].size();
+    for (int axis = 0; axis < 3; ++axis) {
+        output[axis].resize(n);
     }
+    calkernels::apply(calibration.transform(), data[0].constData(),
+                      data[1].constData(), data[2].constData(),
+                      output[0].data(), output[1].data(), output[2].data(), n);
     return output;
 }
+
+void CalLib::apply_calibration(QVector<QVector<double>>& data,
+                               const EllipsoidCalibration& calibration) {
+    calkernels::apply(calibration.transform(), data[0].data(), data[1].data(),
+                      data[2].data(), data[0].size());
+}
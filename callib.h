@@ -1,24 +1,261 @@
 #ifndef CALLIB_H
 #define CALLIB_H
 
+#include "calkernels.h"
+#include "fixedmatrix.h"
+#include "histogram.h"
 #include "matrix.h"
 #include <QFile>
 #include <QTextStream>
 #include <QVector>
+#include <atomic>
+#include <functional>
 #include <vector>
 
+// Sufficient statistics for the axis-aligned ellipsoid fit
+//     x^2 = a*x + b*y + c*z - d*y^2 - e*z^2 + f
+// Every sample is folded into the 6x6 H^T H and 6x1 H^T W sums, so the fit
+// costs O(1) memory and O(N) time regardless of the capture length.
+class EllipsoidMoments {
+public:
+    static const int unknowns = 6;
+
+    EllipsoidMoments();
+    void clear();
+    void add(double x, double y, double z);
+    // sample i counted copies[i] times, as a resample with replacement
+    // would, with the vectorized kernel
+    void add(const double* x, const double* y, const double* z,
+             const unsigned char* copies, int n);
+    void merge(const EllipsoidMoments& other);
+    long count() const;
+
+    // solves the normal equations, returns false if they are singular
+    bool solve(double solution[unknowns]) const;
+
+    // solves and converts the solution to unrounded offsets and scales,
+    // returns false if it does not describe an ellipsoid
+    bool solve_ellipsoid(double offset[3], double scale[3]) const;
+
+    // one row h of the design matrix, returns its target w
+    static double design(double x, double y, double z, double h[unknowns]);
+    // offsets and scales of a solution of H u = W, false if it does not
+    // describe an ellipsoid
+    static bool to_ellipsoid(const double solution[unknowns],
+                             double offset[3], double scale[3]);
+
+    // condition number of the equilibrated normal equations, large when
+    // the samples cover too few directions to pin the fit down
+    double condition() const;
+
+private:
+    double hth[unknowns][unknowns]; // only the upper triangle is accumulated
+    double htw[unknowns];
+    long samples;
+};
+
+// Sufficient statistics for the general quadric fit
+//     a*x^2 + b*y^2 + c*z^2 + 2f*yz + 2g*xz + 2h*xy
+//         + 2p*x + 2q*y + 2r*z + d = 0
+// i.e. the 10x10 scatter matrix D^T D of the monomial rows D. Cross terms
+// model the soft-iron distortion the axis-aligned fit ignores.
+class QuadricMoments {
+public:
+    static const int unknowns = 10;
+
+    QuadricMoments();
+    void clear();
+    void add(double x, double y, double z);
+    // a whole capture at once, with the vectorized kernel
+    void add(const double* x, const double* y, const double* z, int n);
+    void merge(const QuadricMoments& other);
+    long count() const;
+
+    // returns the full symmetric scatter matrix
+    void scatter(double out[unknowns][unknowns]) const;
+
+private:
+    double dtd[unknowns][unknowns]; // only the upper triangle is accumulated
+    long samples;
+};
+
+// Result of the rotated ellipsoid fit, the calibrated reading is
+// correction * (raw - offset) and lies on the unit sphere
+struct EllipsoidCalibration {
+    matrices::FixedMatrix<double, 3, 1> offset;
+    // symmetric, except for the six-position fit which also corrects the
+    // misalignment of the axes
+    matrices::FixedMatrix<double, 3, 3> correction;
+
+    // equivalent per-axis scales, for the offset/scale storage formats: the
+    // half extents of the raw ellipsoid along the axes
+    QVector<double> scale() const;
+
+    // the same calibration, for the SoA apply kernels
+    calkernels::Transform transform() const;
+};
+
+// Goodness of a calibration over a set of samples, c = correction * (p - o)
+struct CalibrationQuality {
+    long samples;
+    double rms;           // of the radial residual |c| - 1
+    double axis_rms[3];   // of the components of c - c / |c|
+    double max_deviation; // largest ||c| - 1|
+    double condition;     // see EllipsoidMoments::condition
+    double coverage;      // fraction of the sphere the samples fall on
+    Histogram1D residuals;  // radial residuals
+    Histogram2D directions; // azimuth x sin(elevation), equal-area bins
+};
+
+// Options of the RANSAC / MSAC outlier rejection around the ellipsoid fit
+struct RansacOptions {
+    int iterations = 512;    // minimal-subset hypotheses to score
+    double threshold = 0.05; // inlier radial residual, relative to the radius
+    bool msac = true;        // score by truncated squared residuals
+    unsigned seed = 1;       // hypotheses are reproducible for a given seed
+    // polled between hypotheses, the fit throws once it is set
+    const std::atomic<bool>* cancel = nullptr;
+};
+
+struct RansacResult {
+    QVector<long> offsets;
+    QVector<double> scale;
+    QVector<bool> inliers; // one entry per input sample
+    int inlier_count;
+};
+
+// Options of the Levenberg-Marquardt refinement of the axis-aligned fit
+struct RefineOptions {
+    int max_iterations = 50;
+    double tolerance = 1e-10; // relative decrease of the cost to stop at
+    double lambda = 1e-3;     // initial damping
+    // polled between iterations, the refinement throws once it is set
+    const std::atomic<bool>* cancel = nullptr;
+};
+
+struct RefineResult {
+    QVector<long> offsets;
+    QVector<double> scale;
+    int iterations;
+    double rms;          // radial residual, relative to the radius
+    double milliseconds; // wall time of the refinement
+    bool converged;
+};
+
+// Options of the bootstrap of the axis-aligned fit
+struct BootstrapOptions {
+    int replicates = 1000;    // resampled datasets to refit
+    double confidence = 0.95; // coverage of the percentile intervals
+    unsigned seed = 1;        // replicates are reproducible for a given seed
+    // polled between replicates, the bootstrap throws once it is set
+    const std::atomic<bool>* cancel = nullptr;
+};
+
+// Spread of the axis-aligned fit over the bootstrap replicates. Every
+// vector holds offset x, y, z then scale x, y, z.
+struct BootstrapResult {
+    QVector<double> estimate;       // fit of the samples themselves
+    QVector<double> standard_error; // of the replicates
+    QVector<double> lower;          // percentile interval
+    QVector<double> upper;
+    int replicates;      // the ones that fitted an ellipsoid
+    double milliseconds; // wall time of the bootstrap
+};
+
+// Options of the stratified reduction of a capture before the fit
+struct SubsampleOptions {
+    int resolution = 8; // cube-sphere cells per face edge, 6 * r^2 bins
+    int per_bin = 64;   // samples kept per direction bin
+    unsigned seed = 1;  // reservoir replacement is reproducible
+};
+
 class CalLib {
 public:
     CalLib();
-    static QPair<QVector<long>, QVector<double>>&&
-    calibrate(QVector<double>& x, QVector<double>& y, QVector<double>& z);
+    static QPair<QVector<long>, QVector<double>>
+    calibrate(const EllipsoidMoments& moments);
 
-    static QPair<QVector<long>, QVector<double>>&&
+    // least squares on the samples themselves by a parallel streaming QR,
+    // which is better conditioned than the normal equations of the moments
+    static QPair<QVector<long>, QVector<double>>
+    calibrate(const QVector<double>& x, const QVector<double>& y,
+              const QVector<double>& z);
+
+    // the same fit, streamed from a log file without loading it
+    static QPair<QVector<long>, QVector<double>>
     calibrate_from_file(QString file_name);
 
+    // fits the ellipsoid on the consensus set of a parallel RANSAC search
+    static RansacResult
+    calibrate_ransac(const QVector<double>& x, const QVector<double>& y,
+                     const QVector<double>& z,
+                     const RansacOptions& options = RansacOptions());
+
+    // minimizes the radial residual |(p - offset) / scale| - 1 starting
+    // from an algebraic fit, samples with a false mask entry are skipped
+    static RefineResult
+    refine(const QVector<double>& x, const QVector<double>& y,
+           const QVector<double>& z, const QVector<long>& offsets,
+           const QVector<double>& scale,
+           const QVector<bool>& mask = QVector<bool>(),
+           const RefineOptions& options = RefineOptions());
+
+    // standard errors and percentile intervals of the moment fit, from
+    // refits on Poisson-resampled datasets run in parallel
+    static BootstrapResult
+    bootstrap(const QVector<double>& x, const QVector<double>& y,
+              const QVector<double>& z,
+              const BootstrapOptions& options = BootstrapOptions());
+
+    // metrics of a calibration over the raw samples, in one parallel pass
+    static CalibrationQuality quality(const QVector<double>& x,
+                                      const QVector<double>& y,
+                                      const QVector<double>& z,
+                                      const EllipsoidCalibration& calibration);
+
+    // keeps at most options.per_bin samples per direction bin, evenly spread
+    // over the sphere, returns the number of occupied bins
+    static int subsample(QVector<double>& x, QVector<double>& y,
+                         QVector<double>& z,
+                         const SubsampleOptions& options = SubsampleOptions());
+
+    // reads the samples of a log file, replacing the content of x, y and z.
+    // The file is memory mapped and parsed on all threads, see
+    // captureparser.cpp
+    static void load_samples(QString file_name, QVector<double>& x,
+                             QVector<double>& y, QVector<double>& z);
+
+    // calls visit(x, y, z, count, chunk) with consecutive blocks of the
+    // samples of a log file. The file is split in the given number of
+    // newline-aligned chunks parsed in parallel, the blocks of one chunk
+    // come in file order from a single thread. Only a block per chunk is
+    // held in memory.
+    typedef std::function<void(const double* x, const double* y,
+                               const double* z, int count, int chunk)>
+        SampleBlockVisitor;
+    static void stream_samples(QString file_name, int chunks,
+                               const SampleBlockVisitor& visit);
+
+    static EllipsoidCalibration calibrate_rotated(const QuadricMoments& moments);
+
+    // streamed from a log file without loading it
+    static EllipsoidCalibration calibrate_rotated_from_file(QString file_name);
+
+    // expresses an axis-aligned result in the rotated form
+    static EllipsoidCalibration to_rotated(const QVector<long>& offsets,
+                                           const QVector<double>& scale);
+
     static QVector<QVector<double>>
     compute_calibrate_data(QVector<QVector<double>>& data,
                            QVector<long>& offsets, QVector<double>& scale);
+
+    static QVector<QVector<double>>
+    compute_calibrate_data(QVector<QVector<double>>& data,
+                           const EllipsoidCalibration& calibration);
+
+    // calibrates the x, y and z rows of data in place
+    static void apply_calibration(QVector<QVector<double>>& data,
+                                  const EllipsoidCalibration& calibration);
 };
 
 #endif // CALLIB_H
@@ -0,0 +1,280 @@
+#include "callib.h"
+#include "parallel.h"
+
+#include <QFile>
+#include <cstring>
+#include <vector>
+
+// Capture files hold one "x y z" line per sample, as written by the
+// SerialWorker. They are memory mapped and parsed in newline-aligned chunks,
+// one per thread, either straight into the x, y and z arrays or block by
+// block into a small buffer per chunk.
+
+namespace {
+
+const double powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                1e12, 1e13, 1e14, 1e15, 1e16, 1e17};
+const int max_digits = 17; // exact in a 64-bit integer and a double
+
+inline bool is_digit(char c) {
+    return static_cast<unsigned char>(c - '0') < 10;
+}
+
+inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// parses [-+]digits[.digits][e[-+]digits] from p, not past end. The
+// readings are integers, the fraction and exponent are only there so the
+// files stay readable if they ever hold floats.
+inline bool parse_number(const char*& p, const char* end, double& value) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    // fast path for the usual short integer
+    if (p + 6 <= end) {
+        int integer = 0;
+        const char* q = p;
+        for (; q < p + 6 && is_digit(*q); q++)
+            integer = integer * 10 + (*q - '0');
+        // six digits may end the file
+        if (q > p &&
+            (q == end ||
+             (!is_digit(*q) && *q != '.' && *q != 'e' && *q != 'E'))) {
+            p = q;
+            value = negative ? -integer : integer;
+            return true;
+        }
+    }
+
+    long long mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    const char* start = p;
+    for (; p < end && is_digit(*p); p++) {
+        if (digits < max_digits) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) digits++;
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && is_digit(*p); p++) {
+            if (digits < max_digits) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) digits++;
+                exponent--;
+            }
+        }
+    }
+    if (p == start || (p == start + 1 && *start == '.')) return false;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative_exponent = *p++ == '-';
+        if (p == end || !is_digit(*p)) return false;
+        int e = 0;
+        for (; p < end && is_digit(*p); p++)
+            e = e < 10000 ? e * 10 + (*p - '0') : e;
+        exponent += negative_exponent ? -e : e;
+    }
+
+    value = static_cast<double>(mantissa);
+    while (exponent > 0) {
+        const int step = exponent > max_digits ? max_digits : exponent;
+        value *= powers_of_ten[step];
+        exponent -= step;
+    }
+    while (exponent < 0) {
+        const int step = -exponent > max_digits ? max_digits : -exponent;
+        value /= powers_of_ten[step];
+        exponent += step;
+    }
+    if (negative) value = -value;
+    return true;
+}
+
+// parses the lines of [begin, end) that hold exactly three numbers,
+// returns how many were written to x, y and z. Valid lines are parsed in a
+// single pass, only the invalid ones are searched for their end.
+int parse_chunk(const char* begin, const char* end, double* x, double* y,
+                double* z) {
+    int count = 0;
+    const char* p = begin;
+    while (p < end) {
+        double values[3];
+        int fields = 0;
+        bool valid = true;
+        for (;;) {
+            while (p < end && is_blank(*p))
+                p++;
+            if (p == end || *p == '\n') break;
+            if (fields == 3 || !parse_number(p, end, values[fields])) {
+                valid = false;
+                break;
+            }
+            fields++;
+            if (p < end && !is_blank(*p) && *p != '\n') {
+                valid = false;
+                break;
+            }
+        }
+        if (!valid) {
+            p = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (!p) p = end;
+        } else if (fields == 3) {
+            x[count] = values[0];
+            y[count] = values[1];
+            z[count] = values[2];
+            count++;
+        }
+        p++;
+    }
+    return count;
+}
+
+// the shortest line that holds a sample, "0 0 0\n", so n bytes hold at
+// most n / min_line + 1 samples
+const int min_line = 6;
+// bytes parsed at a time by stream_samples, rounded up to whole lines
+const int block_bytes = 1 << 16;
+
+// the whole capture, memory mapped, or read when it can't be mapped
+class Capture {
+public:
+    explicit Capture(QString file_name)
+        : file(file_name),
+          data(nullptr),
+          end(nullptr) {
+        if (!file.open(QFile::ReadOnly) || file.size() == 0) return;
+        data = reinterpret_cast<const char*>(file.map(0, file.size()));
+        if (!data) {
+            contents = file.readAll();
+            data = contents.constData();
+        }
+        end = data + file.size();
+    }
+
+    bool empty() const {
+        return data == end;
+    }
+
+    // count newline-aligned chunks of about the same size, some may be
+    // empty
+    std::vector<const char*> split(int count) const {
+        std::vector<const char*> bounds(count + 1, end);
+        bounds[0] = data;
+        for (int c = 1; c < count; c++) {
+            const char* p = data + (end - data) * c / count;
+            if (p < bounds[c - 1]) p = bounds[c - 1];
+            bounds[c] = line_end(p, end);
+        }
+        return bounds;
+    }
+
+    // the position after the newline at or after p
+    static const char* line_end(const char* p, const char* end) {
+        const char* eol =
+            static_cast<const char*>(std::memchr(p, '\n', end - p));
+        return eol ? eol + 1 : end;
+    }
+
+private:
+    QFile file;
+    QByteArray contents;
+    const char* data;
+    const char* end;
+};
+
+} // namespace
+
+void CalLib::load_samples(QString file_name, QVector<double>& x,
+                          QVector<double>& y, QVector<double>& z) {
+    x.clear();
+    y.clear();
+    z.clear();
+    const Capture capture(file_name);
+    if (capture.empty()) return;
+
+    // newline-aligned chunks, one per thread
+    const int threads = parallel::threadCount();
+    const std::vector<const char*> bounds = capture.split(threads);
+
+    // a chunk holds at most one sample per line, so each one can parse into
+    // its own slice of the arrays before they are compacted
+    std::vector<int> first(threads + 1, 0);
+    std::vector<int> counts(threads, 0);
+    parallel::forChunks(threads, [&](int begin, int last, int) {
+        for (int c = begin; c < last; c++) {
+            const char* p = bounds[c];
+            int lines = 0;
+            while (p < bounds[c + 1] &&
+                   (p = static_cast<const char*>(
+                        std::memchr(p, '\n', bounds[c + 1] - p)))) {
+                lines++;
+                p++;
+            }
+            counts[c] = lines + 1;
+        }
+    });
+    for (int c = 0; c < threads; c++)
+        first[c + 1] = first[c] + counts[c];
+    x.resize(first[threads]);
+    y.resize(first[threads]);
+    z.resize(first[threads]);
+    double* px = x.data();
+    double* py = y.data();
+    double* pz = z.data();
+
+    parallel::forChunks(threads, [&](int begin, int last, int) {
+        for (int c = begin; c < last; c++)
+            counts[c] = parse_chunk(bounds[c], bounds[c + 1], px + first[c],
+                                    py + first[c], pz + first[c]);
+    });
+
+    int size = 0;
+    for (int c = 0; c < threads; c++) {
+        if (size != first[c]) {
+            std::memmove(px + size, px + first[c], counts[c] * sizeof(double));
+            std::memmove(py + size, py + first[c], counts[c] * sizeof(double));
+            std::memmove(pz + size, pz + first[c], counts[c] * sizeof(double));
+        }
+        size += counts[c];
+    }
+    x.resize(size);
+    y.resize(size);
+    z.resize(size);
+}
+
+void CalLib::stream_samples(QString file_name, int chunks,
+                            const SampleBlockVisitor& visit) {
+    const Capture capture(file_name);
+    if (capture.empty() || chunks < 1) return;
+
+    const std::vector<const char*> bounds = capture.split(chunks);
+    parallel::forChunks(chunks, [&](int begin, int last, int) {
+        std::vector<double> x, y, z;
+        for (int c = begin; c < last; c++) {
+            const char* p = bounds[c];
+            while (p < bounds[c + 1]) {
+                // whole lines, a long invalid one may exceed block_bytes
+                const char* block_end = bounds[c + 1] - p > block_bytes
+                    ? Capture::line_end(p + block_bytes, bounds[c + 1])
+                    : bounds[c + 1];
+                const size_t capacity = (block_end - p) / min_line + 1;
+                if (x.size() < capacity) {
+                    x.resize(capacity);
+                    y.resize(capacity);
+                    z.resize(capacity);
+                }
+                const int count =
+                    parse_chunk(p, block_end, x.data(), y.data(), z.data());
+                if (count > 0) visit(x.data(), y.data(), z.data(), count, c);
+                p = block_end;
+            }
+        }
+    });
+}
@@ -1,26 +1,61 @@
-QT       += core gui charts datavisualization serialport
+QT       += core gui charts concurrent datavisualization serialport
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 CONFIG += c++11
 
+# freeimu.pro builds the other projects of this directory alongside
+OBJECTS_DIR = .obj/gui
+MOC_DIR = .obj/gui
+
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    bootstrap.cpp \
+    calalgorithms.cpp \
+    calibrationcache.cpp \
     callib.cpp \
+    calkernels.cpp \
+    captureparser.cpp \
     glviewwidget.cpp \
+    gyrocalibrator.cpp \
     main.cpp \
     freeimucal.cpp \
-    plotwidget.cpp
+    histogram.cpp \
+    matrixkernels.cpp \
+    onlinecalibrator.cpp \
+    parallel.cpp \
+    plotwidget.cpp \
+    quality.cpp \
+    ransac.cpp \
+    refine.cpp \
+    simd.cpp \
+    sixposition.cpp \
+    subsample.cpp
 
 HEADERS += \
+    calalgorithms.h \
+    calibrationcache.h \
     callib.h \
+    calkernels.h \
+    factorization.h \
+    fixedmatrix.h \
     freeimucal.h \
     glviewwidget.h \
+    gyrocalibrator.h \
+    histogram.h \
     matrix.h \
-    plotwidget.h
+    matrixexpr.h \
+    matrixkernels.h \
+    onlinecalibrator.h \
+    parallel.h \
+    poissontable.h \
+    plotwidget.h \
+    simd.h \
+    sixposition.h \
+    symmetriceigen.h
 
 FORMS += \
     freeimu_cal.ui
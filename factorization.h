@@ -0,0 +1,526 @@
+#pragma once
+#include "matrix.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace matrices {
+
+/// <summary>
+/// LU factorization with partial pivoting, P A = L U.
+/// The factorization is computed once and can be reused to solve any number
+/// of right hand sides, invert the matrix or get its determinant.
+/// </summary>
+template <class T>
+class LU {
+public:
+    /// <summary>
+    /// Factorizes a square matrix
+    /// </summary>
+    /// <param name="matrix">The matrix to factorize</param>
+    explicit LU(const Matrix<T>& matrix)
+        : n_(matrix.dimy_),
+          lu_(matrix.inner_),
+          pivots_(matrix.dimy_),
+          sign_(1),
+          singular_(false) {
+        if (matrix.dimx_ != matrix.dimy_)
+            throw std::invalid_argument("Matrix is not n by n");
+        factorize();
+    }
+
+    /// <summary>
+    /// Whether a zero pivot was met during the elimination
+    /// </summary>
+    bool isSingular() const {
+        return singular_;
+    }
+
+    /// <summary>
+    /// Returns the determinant from the product of the pivots
+    /// </summary>
+    T determinant() const {
+        T det = static_cast<T>(sign_);
+        for (int i = 0; i < n_; i++)
+            det *= lu_[i * n_ + i];
+        return det;
+    }
+
+    /// <summary>
+    /// Solves A x = b in place for a single right hand side
+    /// </summary>
+    /// <param name="b">n values, overwritten with x</param>
+    void solveInPlace(T* b) const {
+        if (singular_) throw std::domain_error("Matrix is singular");
+        std::vector<T> x(n_);
+        for (int i = 0; i < n_; i++)
+            x[i] = b[pivots_[i]];
+        // forward substitution with the unit lower triangle
+        for (int i = 0; i < n_; i++) {
+            const T* row = &lu_[i * n_];
+            T sum = x[i];
+            for (int j = 0; j < i; j++)
+                sum -= row[j] * x[j];
+            x[i] = sum;
+        }
+        // back substitution with the upper triangle
+        for (int i = n_ - 1; i >= 0; i--) {
+            const T* row = &lu_[i * n_];
+            T sum = x[i];
+            for (int j = i + 1; j < n_; j++)
+                sum -= row[j] * x[j];
+            x[i] = sum / row[i];
+        }
+        for (int i = 0; i < n_; i++)
+            b[i] = x[i];
+    }
+
+    /// <summary>
+    /// Solves A x = b for a single right hand side
+    /// </summary>
+    std::vector<T> solve(const std::vector<T>& b) const {
+        if (static_cast<int>(b.size()) != n_)
+            throw std::invalid_argument("Right hand side has wrong size");
+        std::vector<T> x(b);
+        solveInPlace(x.data());
+        return x;
+    }
+
+    /// <summary>
+    /// Solves A X = B, every column of B being a right hand side
+    /// </summary>
+    Matrix<T> solve(const Matrix<T>& b) const {
+        if (b.dimy_ != n_)
+            throw std::invalid_argument("Right hand side has wrong size");
+        Matrix<T> x(b.dimx_, n_);
+        // columns are independent, large systems solve them in parallel
+        const auto solveColumns = [&](int begin, int end, int) {
+            std::vector<T> column(n_);
+            for (int c = begin; c < end; c++) {
+                for (int r = 0; r < n_; r++)
+                    column[r] = b.inner_[r * b.dimx_ + c];
+                solveInPlace(column.data());
+                for (int r = 0; r < n_; r++)
+                    x.inner_[r * b.dimx_ + c] = column[r];
+            }
+        };
+        if (static_cast<double>(n_) * n_ * b.dimx_ <
+            kernels::parallelMultiplies)
+            solveColumns(0, b.dimx_, 0);
+        else
+            parallel::forChunks(b.dimx_, solveColumns);
+        return x;
+    }
+
+    /// <summary>
+    /// Returns the inverse by solving against the identity
+    /// </summary>
+    Matrix<T> inverse() const {
+        Matrix<T> identity(n_, n_);
+        for (int i = 0; i < n_; i++)
+            identity.inner_[i * n_ + i] = 1;
+        return solve(identity);
+    }
+
+private:
+    int n_;
+    std::vector<T> lu_;
+    std::vector<int> pivots_;
+    int sign_;
+    bool singular_;
+
+    void factorize() {
+        for (int i = 0; i < n_; i++)
+            pivots_[i] = i;
+        for (int k = 0; k < n_; k++) {
+            int pivot = k;
+            T best = std::abs(lu_[k * n_ + k]);
+            for (int i = k + 1; i < n_; i++) {
+                T value = std::abs(lu_[i * n_ + k]);
+                if (value > best) {
+                    best = value;
+                    pivot = i;
+                }
+            }
+            if (best == T(0)) {
+                singular_ = true;
+                continue;
+            }
+            if (pivot != k) {
+                for (int j = 0; j < n_; j++)
+                    std::swap(lu_[k * n_ + j], lu_[pivot * n_ + j]);
+                std::swap(pivots_[k], pivots_[pivot]);
+                sign_ = -sign_;
+            }
+            // rows of the trailing update are independent, large ones are
+            // eliminated in parallel
+            const T* rowK = &lu_[k * n_];
+            const auto eliminate = [&](int begin, int end, int) {
+                for (int i = k + 1 + begin; i < k + 1 + end; i++) {
+                    T* rowI = &lu_[i * n_];
+                    T factor = rowI[k] / rowK[k];
+                    rowI[k] = factor;
+                    for (int j = k + 1; j < n_; j++)
+                        rowI[j] -= factor * rowK[j];
+                }
+            };
+            const int trailing = n_ - k - 1;
+            if (trailing * trailing < kernels::parallelElements)
+                eliminate(0, trailing, 0);
+            else
+                parallel::forChunks(trailing, eliminate);
+        }
+    }
+};
+
+/// <summary>
+/// Cholesky factorization A = L L^T of a symmetric positive definite
+/// matrix, such as the normal matrix H^T H of a least squares problem.
+/// Only the lower triangle of the input is read.
+/// </summary>
+template <class T>
+class Cholesky {
+public:
+    /// <summary>
+    /// Factorizes a symmetric positive definite matrix
+    /// </summary>
+    /// <param name="matrix">The matrix to factorize</param>
+    explicit Cholesky(const Matrix<T>& matrix)
+        : n_(matrix.dimy_),
+          l_(matrix.inner_),
+          positiveDefinite_(true) {
+        if (matrix.dimx_ != matrix.dimy_)
+            throw std::invalid_argument("Matrix is not n by n");
+        factorize();
+    }
+
+    /// <summary>
+    /// Whether the factorization succeeded
+    /// </summary>
+    bool isPositiveDefinite() const {
+        return positiveDefinite_;
+    }
+
+    /// <summary>
+    /// Returns the determinant, the squared product of the diagonal of L
+    /// </summary>
+    T determinant() const {
+        if (!positiveDefinite_) throw std::domain_error("Matrix is not SPD");
+        T det = 1;
+        for (int i = 0; i < n_; i++)
+            det *= l_[i * n_ + i];
+        return det * det;
+    }
+
+    /// <summary>
+    /// Solves A x = b in place for a single right hand side
+    /// </summary>
+    /// <param name="b">n values, overwritten with x</param>
+    void solveInPlace(T* b) const {
+        if (!positiveDefinite_) throw std::domain_error("Matrix is not SPD");
+        for (int i = 0; i < n_; i++) {
+            const T* row = &l_[i * n_];
+            T sum = b[i];
+            for (int j = 0; j < i; j++)
+                sum -= row[j] * b[j];
+            b[i] = sum / row[i];
+        }
+        for (int i = n_ - 1; i >= 0; i--) {
+            T sum = b[i];
+            for (int j = i + 1; j < n_; j++)
+                sum -= l_[j * n_ + i] * b[j];
+            b[i] = sum / l_[i * n_ + i];
+        }
+    }
+
+    /// <summary>
+    /// Solves A x = b for a single right hand side
+    /// </summary>
+    std::vector<T> solve(const std::vector<T>& b) const {
+        if (static_cast<int>(b.size()) != n_)
+            throw std::invalid_argument("Right hand side has wrong size");
+        std::vector<T> x(b);
+        solveInPlace(x.data());
+        return x;
+    }
+
+    /// <summary>
+    /// Solves A X = B, every column of B being a right hand side
+    /// </summary>
+    Matrix<T> solve(const Matrix<T>& b) const {
+        if (b.dimy_ != n_)
+            throw std::invalid_argument("Right hand side has wrong size");
+        Matrix<T> x(b.dimx_, n_);
+        // columns are independent, large systems solve them in parallel
+        const auto solveColumns = [&](int begin, int end, int) {
+            std::vector<T> column(n_);
+            for (int c = begin; c < end; c++) {
+                for (int r = 0; r < n_; r++)
+                    column[r] = b.inner_[r * b.dimx_ + c];
+                solveInPlace(column.data());
+                for (int r = 0; r < n_; r++)
+                    x.inner_[r * b.dimx_ + c] = column[r];
+            }
+        };
+        if (static_cast<double>(n_) * n_ * b.dimx_ <
+            kernels::parallelMultiplies)
+            solveColumns(0, b.dimx_, 0);
+        else
+            parallel::forChunks(b.dimx_, solveColumns);
+        return x;
+    }
+
+    /// <summary>
+    /// Returns the inverse by solving against the identity
+    /// </summary>
+    Matrix<T> inverse() const {
+        Matrix<T> identity(n_, n_);
+        for (int i = 0; i < n_; i++)
+            identity.inner_[i * n_ + i] = 1;
+        return solve(identity);
+    }
+
+private:
+    int n_;
+    std::vector<T> l_;
+    bool positiveDefinite_;
+
+    void factorize() {
+        for (int j = 0; j < n_; j++) {
+            T* rowJ = &l_[j * n_];
+            T diag = rowJ[j];
+            for (int k = 0; k < j; k++)
+                diag -= rowJ[k] * rowJ[k];
+            if (!(diag > T(0))) {
+                positiveDefinite_ = false;
+                return;
+            }
+            diag = std::sqrt(diag);
+            rowJ[j] = diag;
+            for (int i = j + 1; i < n_; i++) {
+                T* rowI = &l_[i * n_];
+                T sum = rowI[j];
+                for (int k = 0; k < j; k++)
+                    sum -= rowI[k] * rowJ[k];
+                rowI[j] = sum / diag;
+            }
+            // keep the strict upper triangle clean
+            for (int k = j + 1; k < n_; k++)
+                rowJ[k] = 0;
+        }
+    }
+};
+
+/// <summary>
+/// Streaming least squares min |A x - b| for a tall N by k design matrix,
+/// by Householder QR. Rows are buffered into blocks and every full block is
+/// folded into the k by k triangle R, so only O(k * block) values are ever
+/// stored however many rows are added. Solving R x = Q^T b avoids squaring
+/// the condition number like the normal equations A^T A do.
+/// </summary>
+/// <remarks>Independent instances can be filled on different threads and
+/// merged, the result does not depend on how the rows were split
+/// beyond rounding.</remarks>
+template <class T>
+class LeastSquaresQR {
+public:
+    /// <summary>
+    /// Starts an empty problem
+    /// </summary>
+    /// <param name="unknowns">Number of columns k of the design matrix</param>
+    /// <param name="blockRows">Rows buffered before they are folded</param>
+    explicit LeastSquaresQR(int unknowns, int blockRows = 64)
+        : k_(unknowns),
+          blockRows_(blockRows),
+          r_(unknowns * unknowns),
+          qtb_(unknowns),
+          block_(unknowns * blockRows),
+          targets_(blockRows),
+          buffered_(0),
+          rows_(0),
+          residual_(0) {
+        if (unknowns < 1 || blockRows < 1)
+            throw std::invalid_argument("Invalid least squares dimensions");
+    }
+
+    /// <summary>
+    /// Adds one row of the design matrix and its target
+    /// </summary>
+    /// <param name="row">k values</param>
+    /// <param name="target">The matching entry of b</param>
+    void addRow(const T* row, T target) {
+        // the block is column major, the reflections run down its columns
+        for (int j = 0; j < k_; j++)
+            block_[j * blockRows_ + buffered_] = row[j];
+        targets_[buffered_] = target;
+        rows_++;
+        if (++buffered_ == blockRows_) flush();
+    }
+
+    /// <summary>
+    /// Adds the rows of another problem with the same unknowns
+    /// </summary>
+    void merge(LeastSquaresQR other) {
+        if (other.k_ != k_)
+            throw std::invalid_argument("Least squares sizes do not match");
+        other.flush();
+        flush();
+        // the other triangle is just k more rows of the same problem
+        std::vector<T> columns(k_ * k_);
+        for (int i = 0; i < k_; i++)
+            for (int j = 0; j < k_; j++)
+                columns[j * k_ + i] = other.r_[i * k_ + j];
+        fold(columns.data(), k_, other.qtb_.data(), k_);
+        residual_ += other.residual_;
+        rows_ += other.rows_;
+    }
+
+    /// <summary>
+    /// Number of rows added so far
+    /// </summary>
+    long rows() const {
+        return rows_;
+    }
+
+    /// <summary>
+    /// Solves R x = Q^T b
+    /// </summary>
+    /// <param name="solution">Receives the k unknowns</param>
+    /// <returns>False when there are fewer rows than unknowns or the design
+    /// matrix is rank deficient</returns>
+    bool solve(std::vector<T>& solution) {
+        flush();
+        if (rows_ < k_ || !fullRank()) return false;
+        solution = qtb_;
+        for (int i = k_ - 1; i >= 0; i--) {
+            const T* row = &r_[i * k_];
+            T sum = solution[i];
+            for (int j = i + 1; j < k_; j++)
+                sum -= row[j] * solution[j];
+            solution[i] = sum / row[i];
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Returns |A x - b| at the least squares solution
+    /// </summary>
+    T residualNorm() {
+        flush();
+        return std::sqrt(residual_);
+    }
+
+    /// <summary>
+    /// Returns the covariance of the solution, s^2 (A^T A)^-1 with the
+    /// residual variance s^2 = |A x - b|^2 / (N - k)
+    /// </summary>
+    /// <returns>A k by k matrix</returns>
+    Matrix<T> covariance() {
+        flush();
+        if (rows_ <= k_ || !fullRank())
+            throw std::domain_error("Covariance is undefined");
+        // (A^T A)^-1 = R^-1 R^-T, R^-1 is upper triangular too
+        std::vector<T> inverse(k_ * k_, T(0));
+        for (int c = 0; c < k_; c++) {
+            inverse[c * k_ + c] = 1 / r_[c * k_ + c];
+            for (int i = c - 1; i >= 0; i--) {
+                T sum = 0;
+                for (int j = i + 1; j <= c; j++)
+                    sum += r_[i * k_ + j] * inverse[j * k_ + c];
+                inverse[i * k_ + c] = -sum / r_[i * k_ + i];
+            }
+        }
+        const T variance = residual_ / (rows_ - k_);
+        Matrix<T> result(k_, k_);
+        for (int i = 0; i < k_; i++)
+            for (int j = i; j < k_; j++) {
+                T sum = 0;
+                for (int l = j; l < k_; l++)
+                    sum += inverse[i * k_ + l] * inverse[j * k_ + l];
+                result.inner_[i * k_ + j] = variance * sum;
+                result.inner_[j * k_ + i] = variance * sum;
+            }
+        return result;
+    }
+
+private:
+    int k_;
+    int blockRows_;
+    std::vector<T> r_;   // k by k upper triangle, row major
+    std::vector<T> qtb_; // first k entries of Q^T b
+    std::vector<T> block_;
+    std::vector<T> targets_;
+    int buffered_;
+    long rows_;
+    T residual_; // squared norm of the rest of Q^T b
+
+    void flush() {
+        if (buffered_ == 0) return;
+        fold(block_.data(), blockRows_, targets_.data(), buffered_);
+        buffered_ = 0;
+    }
+
+    /// <summary>
+    /// Annihilates m rows stacked under R with one reflection per column.
+    /// Each reflection only touches row j of R and the m new rows, so a
+    /// block costs O(k^2 m).
+    /// </summary>
+    /// <param name="rows">Column major, column j at rows + j * stride</param>
+    void fold(const T* rows, int stride, const T* targets, int m) {
+        std::vector<T> a(rows, rows + k_ * stride);
+        std::vector<T> b(targets, targets + m);
+        for (int j = 0; j < k_; j++) {
+            T* v = &a[j * stride];
+            T norm = 0;
+            for (int i = 0; i < m; i++)
+                norm += v[i] * v[i];
+            if (norm == T(0)) continue;
+            T& diag = r_[j * k_ + j];
+            norm = std::sqrt(norm + diag * diag);
+            // reflect onto -sign(diag) |x| so v0 = diag - alpha never cancels
+            const T alpha = diag > 0 ? -norm : norm;
+            const T v0 = diag - alpha;
+            const T tau = -v0 / alpha; // 2 / |v|^2, scaled so v0 = 1
+            const T scale = 1 / v0;
+            for (int i = 0; i < m; i++)
+                v[i] *= scale;
+            diag = alpha;
+            for (int c = j + 1; c < k_; c++) {
+                T* column = &a[c * stride];
+                T& top = r_[j * k_ + c];
+                T dot = top;
+                for (int i = 0; i < m; i++)
+                    dot += v[i] * column[i];
+                dot *= tau;
+                top -= dot;
+                for (int i = 0; i < m; i++)
+                    column[i] -= dot * v[i];
+            }
+            T dot = qtb_[j];
+            for (int i = 0; i < m; i++)
+                dot += v[i] * b[i];
+            dot *= tau;
+            qtb_[j] -= dot;
+            for (int i = 0; i < m; i++)
+                b[i] -= dot * v[i];
+        }
+        // what is left of b is orthogonal to the range of A
+        for (int i = 0; i < m; i++)
+            residual_ += b[i] * b[i];
+    }
+
+    bool fullRank() const {
+        T largest = 0;
+        for (int i = 0; i < k_; i++)
+            largest = std::max(largest, std::abs(r_[i * k_ + i]));
+        const T tolerance =
+            largest * k_ * std::numeric_limits<T>::epsilon();
+        for (int i = 0; i < k_; i++)
+            if (!(std::abs(r_[i * k_ + i]) > tolerance)) return false;
+        return true;
+    }
+};
+
+} // namespace matrices
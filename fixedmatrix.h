@@ -0,0 +1,272 @@
+#pragma once
+#include "matrix.h"
+#include <cmath>
+#include <initializer_list>
+#include <stdexcept>
+
+namespace matrices {
+
+/// <summary>
+/// Calls f(0) .. f(N - 1), unrolled at compile time
+/// </summary>
+template <int N>
+struct Unroll {
+    template <class F>
+    static void run(F& f) {
+        Unroll<N - 1>::run(f);
+        f(N - 1);
+    }
+};
+
+template <>
+struct Unroll<0> {
+    template <class F>
+    static void run(F&) {
+    }
+};
+
+/// <summary>
+/// Matrix with compile-time dimensions and stack storage, for the small
+/// 3x3 / 6x6 / 9x9 systems of the calibration. Shapes of products and
+/// transposes are checked by the compiler and nothing is heap allocated.
+/// Row-major like Matrix, and usable in its lazy expressions.
+/// </summary>
+template <class T, int Rows, int Cols>
+class FixedMatrix : public MatrixExpr<FixedMatrix<T, Rows, Cols>> {
+public:
+    typedef T value_type;
+    static const int rowCount = Rows;
+    static const int colCount = Cols;
+    static const int elementCount = Rows * Cols;
+
+    T data_[Rows * Cols];
+
+    /// <summary>
+    /// Zero initialised matrix
+    /// </summary>
+    FixedMatrix() {
+        fill(T(0));
+    }
+
+    /// <summary>
+    /// Row-major list of values, missing ones are zero
+    /// </summary>
+    FixedMatrix(std::initializer_list<T> values) {
+        fill(T(0));
+        int i = 0;
+        for (const T& value : values) {
+            if (i == elementCount) break;
+            data_[i++] = value;
+        }
+    }
+
+    /// <summary>
+    /// Copies a dynamic matrix, its shape is checked at runtime
+    /// </summary>
+    explicit FixedMatrix(const Matrix<T>& matrix) {
+        if (matrix.rows() != Rows || matrix.cols() != Cols)
+            throw std::invalid_argument("Matrix dimensions do not match");
+        for (int i = 0; i < elementCount; i++)
+            data_[i] = matrix.inner_[i];
+    }
+
+    static FixedMatrix identity() {
+        static_assert(Rows == Cols, "Identity needs a square matrix");
+        FixedMatrix result;
+        for (int i = 0; i < Rows; i++)
+            result.data_[i * Cols + i] = T(1);
+        return result;
+    }
+
+    // expression interface, see matrixexpr.h
+    int rows() const {
+        return Rows;
+    }
+
+    int cols() const {
+        return Cols;
+    }
+
+    T coeff(int row, int col) const {
+        return data_[row * Cols + col];
+    }
+
+    T& operator()(int row, int col) {
+        return data_[row * Cols + col];
+    }
+
+    const T& operator()(int row, int col) const {
+        return data_[row * Cols + col];
+    }
+
+    /// <summary>
+    /// Row-major linear access
+    /// </summary>
+    T& operator[](int index) {
+        return data_[index];
+    }
+
+    const T& operator[](int index) const {
+        return data_[index];
+    }
+
+    void fill(T value) {
+        for (int i = 0; i < elementCount; i++)
+            data_[i] = value;
+    }
+
+    /// <summary>
+    /// Materialized transpose, see MatrixExpr::transpose for the lazy one
+    /// </summary>
+    FixedMatrix<T, Cols, Rows> transposed() const {
+        FixedMatrix<T, Cols, Rows> result;
+        for (int r = 0; r < Rows; r++)
+            for (int c = 0; c < Cols; c++)
+                result.data_[c * Rows + r] = data_[r * Cols + c];
+        return result;
+    }
+
+    /// <summary>
+    /// Converts to a heap allocated Matrix
+    /// </summary>
+    Matrix<T> toMatrix() const {
+        return Matrix<T>(*this);
+    }
+
+    template <class E>
+    FixedMatrix& operator=(const MatrixExpr<E>& expr) {
+        const E& e = expr.self();
+        if (e.rows() != Rows || e.cols() != Cols)
+            throw std::invalid_argument("Matrix dimensions do not match");
+        FixedMatrix result;
+        for (int r = 0; r < Rows; r++)
+            for (int c = 0; c < Cols; c++)
+                result.data_[r * Cols + c] = e.coeff(r, c);
+        return *this = result;
+    }
+};
+
+template <class T, int R, int C>
+struct ExprStorage<FixedMatrix<T, R, C>> {
+    typedef const FixedMatrix<T, R, C>& type;
+};
+
+namespace detail {
+
+template <class T, int R, int K, int C>
+struct FixedProduct {
+    const T* a;
+    const T* b;
+    int row;
+    int col;
+    T sum;
+
+    void operator()(int k) {
+        sum += a[row * K + k] * b[k * C + col];
+    }
+};
+
+} // namespace detail
+
+/// <summary>
+/// Fixed size product, the inner dimension is checked by the compiler and
+/// the dot products are unrolled
+/// </summary>
+template <class T, int R, int K, int C>
+FixedMatrix<T, R, C> operator*(const FixedMatrix<T, R, K>& a,
+                               const FixedMatrix<T, K, C>& b) {
+    FixedMatrix<T, R, C> result;
+    detail::FixedProduct<T, R, K, C> dot = {a.data_, b.data_, 0, 0, T(0)};
+    for (int r = 0; r < R; r++) {
+        for (int c = 0; c < C; c++) {
+            dot.row = r;
+            dot.col = c;
+            dot.sum = T(0);
+            Unroll<K>::run(dot);
+            result.data_[r * C + c] = dot.sum;
+        }
+    }
+    return result;
+}
+
+template <class T, int R, int C>
+FixedMatrix<T, R, C> operator+(const FixedMatrix<T, R, C>& a,
+                               const FixedMatrix<T, R, C>& b) {
+    FixedMatrix<T, R, C> result;
+    for (int i = 0; i < R * C; i++)
+        result.data_[i] = a.data_[i] + b.data_[i];
+    return result;
+}
+
+template <class T, int R, int C>
+FixedMatrix<T, R, C> operator-(const FixedMatrix<T, R, C>& a,
+                               const FixedMatrix<T, R, C>& b) {
+    FixedMatrix<T, R, C> result;
+    for (int i = 0; i < R * C; i++)
+        result.data_[i] = a.data_[i] - b.data_[i];
+    return result;
+}
+
+template <class T, int R, int C>
+FixedMatrix<T, R, C> operator*(const FixedMatrix<T, R, C>& a, T factor) {
+    FixedMatrix<T, R, C> result;
+    for (int i = 0; i < R * C; i++)
+        result.data_[i] = a.data_[i] * factor;
+    return result;
+}
+
+/// <summary>
+/// In place Cholesky factorization of a fixed size SPD matrix, the lower
+/// triangle receives L. Stack only, see factorization.h for the dynamic one.
+/// </summary>
+/// <returns>False if the matrix is not positive definite</returns>
+template <class T, int N>
+bool choleskyFactorize(FixedMatrix<T, N, N>& a) {
+    for (int j = 0; j < N; j++) {
+        T diag = a(j, j);
+        for (int k = 0; k < j; k++)
+            diag -= a(j, k) * a(j, k);
+        if (!(diag > T(0))) return false;
+        diag = std::sqrt(diag);
+        a(j, j) = diag;
+        for (int i = j + 1; i < N; i++) {
+            T sum = a(i, j);
+            for (int k = 0; k < j; k++)
+                sum -= a(i, k) * a(j, k);
+            a(i, j) = sum / diag;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// Solves L L^T x = b in place with the factor from choleskyFactorize
+/// </summary>
+template <class T, int N>
+void choleskySolve(const FixedMatrix<T, N, N>& l, FixedMatrix<T, N, 1>& b) {
+    for (int i = 0; i < N; i++) {
+        T sum = b[i];
+        for (int k = 0; k < i; k++)
+            sum -= l(i, k) * b[k];
+        b[i] = sum / l(i, i);
+    }
+    for (int i = N - 1; i >= 0; i--) {
+        T sum = b[i];
+        for (int k = i + 1; k < N; k++)
+            sum -= l(k, i) * b[k];
+        b[i] = sum / l(i, i);
+    }
+}
+
+/// <summary>
+/// Solves the SPD system a x = b without touching the heap
+/// </summary>
+/// <returns>False if a is not positive definite</returns>
+template <class T, int N>
+bool solveSpd(FixedMatrix<T, N, N> a, FixedMatrix<T, N, 1>& b) {
+    if (!choleskyFactorize(a)) return false;
+    choleskySolve(a, b);
+    return true;
+}
+
+} // namespace matrices
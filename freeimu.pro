@@ -0,0 +1,11 @@
+# Builds the calibration GUI, the command line tool, the benchmark and the
+# tests in one go. The projects at this level share the directory, so each
+# one keeps its objects apart, see OBJECTS_DIR.
+TEMPLATE = subdirs
+
+SUBDIRS = gui calcli benchmark tests
+
+gui.file = cpp.pro
+calcli.file = calcli.pro
+benchmark.file = benchmark.pro
+tests.file = tests/tests.pro
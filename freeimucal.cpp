@@ -1,6 +1,15 @@
 #include "freeimucal.h"
+#include "parallel.h"
 #include "ui_freeimu_cal.h"
 
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QThread>
+#include <QtConcurrent>
+#include <functional>
+
 FreeIMUCal::FreeIMUCal(QWidget* parent)
     : QMainWindow(parent),
       ui(new Ui::FreeIMUCal) {
@@ -8,6 +17,7 @@ FreeIMUCal::FreeIMUCal(QWidget* parent)
     ui->setupUi(this);
 
     ser = std::make_shared<QSerialPort>();
+    online_cal = std::make_shared<OnlineCalibrator>();
 
     // load user settings
     settings =
@@ -28,9 +38,59 @@ FreeIMUCal::FreeIMUCal(QWidget* parent)
             &FreeIMUCal::sampling_start);
     set_status("Disconnected");
 
+    // fits are cached next to the settings, the registry has no folder
+    QString cache_dir = QFileInfo(settings->fileName()).absolutePath();
+    if (settings->format() == QSettings::NativeFormat &&
+        settings->fileName().startsWith("\\"))
+        cache_dir =
+            QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(cache_dir);
+    cal_cache = std::make_shared<CalibrationCache>(
+        QDir(cache_dir).filePath("calibrationcache.dat"));
+
+    // the fits share one thread pool, by default it leaves a core to the
+    // GUI and the serial reader. calgui/maxThreads overrides it, 0 uses
+    // every core.
+    parallel::setMaxThreads(settings
+                                ->value("calgui/maxThreads",
+                                        QThread::idealThreadCount() - 1)
+                                .toInt());
+
+    // one entry per registered algorithm, the item data holds its id
+    for (const CalAlgorithm& algorithm : CalAlgorithms::all())
+        ui->calAlgorithmComboBox->addItem(algorithm.name, algorithm.id);
+    ui->calAlgorithmComboBox->addItem("Auto (best held-out residual)",
+                                      auto_algorithm);
+    ui->calAlgorithmComboBox->addItem(
+        "Six Position (acc), Ellipsoid to Sphere (magn)",
+        six_position_algorithm);
+    // filled by the auto mode and the bootstrap, see calibration_finished()
+    ui->calCandidates_acc->hide();
+    ui->calCandidates_magn->hide();
+    ui->calBootstrap_acc->hide();
+    ui->calBootstrap_magn->hide();
+    // only offered for the fit the bootstrap redoes
+    connect(ui->calAlgorithmComboBox,
+            QOverload<int>::of(&QComboBox::currentIndexChanged), this,
+            &FreeIMUCal::update_bootstrap_enabled);
+    connect(ui->refineCheckBox, &QCheckBox::toggled, this,
+            &FreeIMUCal::update_bootstrap_enabled);
+
+    // calibration runs in the background, see calibrate()
+    progress_bar = new QProgressBar(this);
+    progress_bar->setMaximumWidth(150);
+    progress_bar->hide();
+    ui->statusbar->addPermanentWidget(progress_bar);
+    connect(&acc_watcher, &QFutureWatcher<SensorFit>::finished, this,
+            &FreeIMUCal::calibration_finished);
+    connect(&magn_watcher, &QFutureWatcher<SensorFit>::finished, this,
+            &FreeIMUCal::calibration_finished);
+
     // data storages
     acc_data.resize(3);
     magn_data.resize(3);
+    gyro_offset.fill(0, 3);
+    gyro_noise.fill(0, 3);
 
     // setup graphs
     ui->accXY->setXRange(-acc_range, acc_range);
@@ -93,6 +153,10 @@ FreeIMUCal::FreeIMUCal(QWidget* parent)
 }
 
 FreeIMUCal::~FreeIMUCal() {
+    // the fits reference nothing of the window, but don't leave them running
+    if (cal_cancelled) cal_cancelled->store(true);
+    acc_watcher.waitForFinished();
+    magn_watcher.waitForFinished();
     delete ui;
     delete settings;
     ser->close();
@@ -183,7 +247,10 @@ void FreeIMUCal::serial_disconnect() {
 }
 
 void FreeIMUCal::sampling_start() {
-    serWorker = new SerialWorker(ser);
+    // acc.txt and magn.txt are truncated by the new worker, so the online
+    // estimate restarts with them
+    online_cal->clear();
+    serWorker = new SerialWorker(ser, online_cal);
     connect(serWorker, &SerialWorker::new_data_signal, this,
             &FreeIMUCal::newData);
 
@@ -208,19 +275,446 @@ void FreeIMUCal::sampling_end() {
 
     ui->calibrateButton->setEnabled(true);
     ui->calAlgorithmComboBox->setEnabled(true);
+    ui->refineCheckBox->setEnabled(true);
+    update_bootstrap_enabled();
+    // sampling is stopped and restarted many times per session
     connect(ui->calibrateButton, &QPushButton::clicked, this,
-            &FreeIMUCal::calibrate);
+            &FreeIMUCal::calibrate, Qt::UniqueConnection);
+}
+
+namespace {
+
+// progress bar units per sensor, each fit spreads them over its own stages
+const int progress_units = 100;
+
+// the bootstrap redoes the axis-aligned sphere fit, its intervals describe
+// nothing else
+bool bootstrap_applies(QString algorithm, bool refine) {
+    return algorithm == "sphere" && !refine;
+}
+
+// fits one sensor, on a worker thread. The online moments are used when
+// the samples themselves aren't needed, otherwise the capture is read back
+// from its file and, when large, reduced to an even spread of directions
+// first. algorithm is the id of a registered algorithm or auto_algorithm.
+// The quality of the result is then measured on the whole capture. With
+// replicates, the sphere fit without refinement is also bootstrapped on the
+// samples it used, the replicates redo exactly that fit.
+// progress(done, total) is called after each stage of the path taken, the
+// cancel flag is polled between them and by the iterative fits. Fits of the
+// file and their quality are looked up in the cache by its content, the
+// options and whether it is reduced; the bootstrap is never cached.
+SensorFit fit_sensor(QString algorithm, bool refine,
+                     const SubsampleOptions& subsample, int replicates,
+                     QString file_name, const EllipsoidMoments& moments,
+                     const QuadricMoments& quadric, CalibrationCache* cache,
+                     QString options, const std::atomic<bool>& cancel,
+                     const std::function<void(int, int)>& progress) {
+    SensorFit fit;
+    int done = 0;
+    int total = 1;
+    auto check = [&]() {
+        if (cancel.load()) throw std::runtime_error("Calibration cancelled");
+        progress(++done, total);
+    };
+    try {
+        // captures that fit in the bins are not worth reading back
+        const long cap = 6L * subsample.resolution * subsample.resolution *
+            subsample.per_bin;
+        const bool reduce = subsample.per_bin > 0 &&
+            (moments.count() == 0 || moments.count() > cap);
+        // the moments fit costs less than hashing the capture, and the
+        // moments don't hold exactly the samples of the file, so it is
+        // never cached
+        const bool fast = !reduce && !refine && moments.count() > 0 &&
+            (algorithm == "sphere" || algorithm == "rotated");
+        const bool bootstrap =
+            replicates > 0 && bootstrap_applies(algorithm, refine);
+
+        QString key;
+        bool cached = false;
+        quint64 hash;
+        if (!fast && cache && cache->content_hash(file_name, hash)) {
+            // the reduction depends on the moments, not on the options
+            key = CalibrationCache::key(
+                hash, options + QString(";reduce=%1").arg(int(reduce)));
+            CalibrationCache::Entry entry;
+            cached = cache->find(key, entry);
+            if (cached) {
+                fit.offset = entry.offsets;
+                fit.scale = entry.scale;
+                fit.calibration = entry.calibration;
+                fit.status = entry.status;
+                fit.candidates = entry.candidates;
+                fit.quality = entry.quality;
+            }
+        }
+
+        QVector<double> x, y, z; // the whole capture
+        QVector<double> fit_x, fit_y, fit_z; // the samples fitted, shared
+        if (cached) {
+            // the quality is cached too, the capture is only read back for
+            // the bootstrap
+            total = 1 + bootstrap;
+            if (bootstrap) CalLib::load_samples(file_name, x, y, z);
+            check();
+        } else if (fast) {
+            // fit, load and quality
+            total = 2 + bootstrap;
+            if (algorithm == "rotated") {
+                fit.calibration = CalLib::calibrate_rotated(quadric);
+                // the offset/scale formats only keep the diagonal
+                fit.offset = {std::lround(fit.calibration.offset[0]),
+                              std::lround(fit.calibration.offset[1]),
+                              std::lround(fit.calibration.offset[2])};
+                fit.scale = fit.calibration.scale();
+            } else {
+                auto params = CalLib::calibrate(moments);
+                fit.offset = params.first;
+                fit.scale = params.second;
+                fit.calibration = CalLib::to_rotated(fit.offset, fit.scale);
+            }
+            check();
+            CalLib::load_samples(file_name, x, y, z);
+        } else {
+            // load, reduce when needed, fit, quality
+            total = (reduce ? 4 : 3) + bootstrap;
+            CalLib::load_samples(file_name, x, y, z);
+            check();
+            fit_x = x;
+            fit_y = y;
+            fit_z = z;
+            if (reduce) {
+                CalLib::subsample(fit_x, fit_y, fit_z, subsample);
+                fit.status =
+                    QString("%1/%2 samples").arg(fit_x.size()).arg(x.size());
+                check();
+            }
+
+            AlgorithmOptions fit_options;
+            fit_options.refine = refine;
+            fit_options.cancel = &cancel;
+            AlgorithmFit result;
+            if (algorithm == auto_algorithm) {
+                AutoOptions auto_options;
+                auto_options.fit = fit_options;
+                auto chosen =
+                    CalAlgorithms::choose(fit_x, fit_y, fit_z, auto_options);
+                CalAlgorithm best;
+                CalAlgorithms::find(chosen.id, best);
+                result = chosen.fit;
+                QString status = best.name;
+                CalAlgorithms::append_status(status, result.status);
+                result.status = status;
+                fit.candidates = CalAlgorithms::summary(chosen);
+            } else {
+                CalAlgorithm registered;
+                if (!CalAlgorithms::find(algorithm, registered))
+                    throw std::runtime_error("Unknown calibration algorithm");
+                result = registered.fit(fit_x, fit_y, fit_z, fit_options);
+            }
+            fit.offset = result.offsets;
+            fit.scale = result.scale;
+            fit.calibration = result.calibration;
+            CalAlgorithms::append_status(fit.status, result.status);
+            check();
+        }
+
+        if (!cached) {
+            // of what calibration.h and the EEPROM get, the offset/scale
+            // formats drop the cross terms of the rotated fits
+            fit.quality = CalLib::quality(
+                x, y, z, CalLib::to_rotated(fit.offset, fit.scale));
+            check();
+        }
+
+        if (bootstrap) {
+            // a cached or moments fit, reduced the same way when it was
+            if (fit_x.isEmpty()) {
+                fit_x = x;
+                fit_y = y;
+                fit_z = z;
+                if (reduce) CalLib::subsample(fit_x, fit_y, fit_z, subsample);
+            }
+            BootstrapOptions bootstrap_options;
+            bootstrap_options.replicates = replicates;
+            bootstrap_options.cancel = &cancel;
+            fit.bootstrap =
+                CalLib::bootstrap(fit_x, fit_y, fit_z, bootstrap_options);
+            check();
+        }
+
+        if (!cached && !key.isEmpty())
+            cache->insert(key, {fit.offset, fit.scale, fit.calibration,
+                                fit.status, fit.candidates, fit.quality});
+    } catch (const std::exception& e) {
+        // QtConcurrent only forwards QExceptions, report it in the result
+        fit.error = e.what();
+    }
+    return fit;
+}
+
+// solves the acc from the averaged still poses, the capture is only read
+// for the quality
+SensorFit fit_six_position(const SixPositionCalibrator& poses,
+                           QString file_name,
+                           const std::function<void(int, int)>& progress) {
+    SensorFit fit;
+    try {
+        fit.calibration = poses.solve();
+        fit.offset = {std::lround(fit.calibration.offset[0]),
+                      std::lround(fit.calibration.offset[1]),
+                      std::lround(fit.calibration.offset[2])};
+        fit.scale = fit.calibration.scale();
+        fit.status = "six positions";
+        progress(1, 2);
+        QVector<double> x, y, z;
+        CalLib::load_samples(file_name, x, y, z);
+        fit.quality = CalLib::quality(
+            x, y, z, CalLib::to_rotated(fit.offset, fit.scale));
+    } catch (const std::exception& e) {
+        fit.error = e.what();
+        if (!poses.complete())
+            fit.error += QString(", missing %1").arg(poses.missing());
+    }
+    progress(2, 2);
+    return fit;
+}
+
+// fills the residual histogram and the metrics of one sensor
+void show_quality(PlotWidget* plot, QLabel* label,
+                  const CalibrationQuality& quality) {
+    const Histogram1D& h = quality.residuals;
+    QVector<double> x, y;
+    for (int i = 0; i < h.bins(); i++) {
+        const double half = (h.high() - h.low()) / h.bins() / 2;
+        x << h.bin_center(i) - half << h.bin_center(i) + half;
+        y << h.count(i) << h.count(i);
+    }
+    plot->setXRange(h.low(), h.high());
+    plot->setYRange(0, std::max(1.0, h.max_count()));
+    plot->plot(x, y, "#000000");
+
+    label->setText(QString("RMS %1 (x %2, y %3, z %4)\n"
+                           "max deviation %5, condition %6, coverage %7%")
+                       .arg(quality.rms, 0, 'g', 3)
+                       .arg(quality.axis_rms[0], 0, 'g', 3)
+                       .arg(quality.axis_rms[1], 0, 'g', 3)
+                       .arg(quality.axis_rms[2], 0, 'g', 3)
+                       .arg(quality.max_deviation, 0, 'g', 3)
+                       .arg(quality.condition, 0, 'g', 3)
+                       .arg(qRound(quality.coverage * 100)));
+}
+
+// standard errors and intervals of the bootstrapped parameters, the label
+// is hidden when the fit wasn't bootstrapped
+void show_bootstrap(QLabel* label, const BootstrapResult& bootstrap) {
+    label->setVisible(!bootstrap.estimate.isEmpty());
+    if (bootstrap.estimate.isEmpty()) return;
+    const char* const parameters[] = {"offset x", "offset y", "offset z",
+                                      "scale x",  "scale y",  "scale z"};
+    QStringList lines;
+    lines << QString("Bootstrap, %1 replicates:").arg(bootstrap.replicates);
+    for (int i = 0; i < 6; i++)
+        lines << QString("%1 %2 +/- %3 [%4, %5]")
+                     .arg(parameters[i])
+                     .arg(bootstrap.estimate[i], 0, 'f', 1)
+                     .arg(bootstrap.standard_error[i], 0, 'g', 3)
+                     .arg(bootstrap.lower[i], 0, 'f', 1)
+                     .arg(bootstrap.upper[i], 0, 'f', 1);
+    label->setText(lines.join("\n"));
+}
+
+} // namespace
+
+void FreeIMUCal::update_bootstrap_enabled() {
+    ui->bootstrapCheckBox->setEnabled(
+        ui->calAlgorithmComboBox->isEnabled() &&
+        bootstrap_applies(ui->calAlgorithmComboBox->currentData().toString(),
+                          ui->refineCheckBox->isChecked()));
 }
 
 void FreeIMUCal::calibrate() {
-    // read file and run calibration algorithm
-    auto acc_params = CalLib::calibrate_from_file(acc_file_name);
-    acc_offset = acc_params.first;
-    acc_scale = acc_params.second;
+    const QString algorithm =
+        ui->calAlgorithmComboBox->currentData().toString();
+    const bool refine = ui->refineCheckBox->isChecked();
+    // stratified reduction of the captures, 0 samples per bin disables it
+    SubsampleOptions subsample;
+    subsample.resolution =
+        settings->value("calgui/subsampleResolution", subsample.resolution)
+            .toInt();
+    subsample.per_bin =
+        settings->value("calgui/subsamplePerBin", subsample.per_bin).toInt();
+    // bootstrap replicates of the sphere fit, 0 when not asked for
+    const int replicates = ui->bootstrapCheckBox->isEnabled() &&
+            ui->bootstrapCheckBox->isChecked()
+        ? settings
+              ->value("calgui/bootstrapReplicates",
+                      BootstrapOptions().replicates)
+              .toInt()
+        : 0;
+
+    // use the estimate kept up to date by the SerialWorker when possible,
+    // the files are only read back when the samples are needed
+    auto snapshot = online_cal->snapshot();
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    cal_cancelled = cancelled;
+    calibrating = true;
+
+    progress_bar->setRange(0, 2 * progress_units);
+    progress_bar->setValue(0);
+    progress_bar->show();
+    // each sensor reports its own stages, they are added up on the GUI
+    // thread
+    auto acc_units = std::make_shared<int>(0);
+    auto magn_units = std::make_shared<int>(0);
+    auto progress_of = [this, acc_units, magn_units](
+                           std::shared_ptr<int> units) {
+        return [=](int done, int total) {
+            QMetaObject::invokeMethod(
+                this,
+                [=]() {
+                    *units = progress_units * done / total;
+                    progress_bar->setValue(*acc_units + *magn_units);
+                },
+                Qt::QueuedConnection);
+        };
+    };
+    const std::function<void(int, int)> acc_progress = progress_of(acc_units);
+    const std::function<void(int, int)> magn_progress =
+        progress_of(magn_units);
+
+    // the six-position mode only covers the acc
+    const QString magn_algorithm =
+        algorithm == six_position_algorithm ? QString("sphere") : algorithm;
+    // everything the result depends on besides the capture itself
+    auto options_of = [&](QString algorithm) {
+        // the auto mode also depends on the candidates
+        if (algorithm == auto_algorithm) {
+            QStringList ids;
+            for (const CalAlgorithm& candidate : CalAlgorithms::all())
+                ids << candidate.id;
+            algorithm += "(" + ids.join(",") + ")";
+        }
+        return QString("algorithm=%1;refine=%2;bins=%3x%4")
+            .arg(algorithm)
+            .arg(int(refine))
+            .arg(subsample.resolution)
+            .arg(subsample.per_bin);
+    };
+    const QString acc_options = options_of(algorithm);
+    const QString magn_options = options_of(magn_algorithm);
+    CalibrationCache* cache = cal_cache.get();
+    if (algorithm == six_position_algorithm) {
+        acc_watcher.setFuture(QtConcurrent::run([=]() {
+            return fit_six_position(snapshot.six_position, acc_file_name,
+                                    acc_progress);
+        }));
+    } else {
+        acc_watcher.setFuture(QtConcurrent::run([=]() {
+            return fit_sensor(algorithm, refine, subsample, replicates,
+                              acc_file_name, snapshot.acc,
+                              snapshot.acc_quadric, cache, acc_options,
+                              *cancelled, acc_progress);
+        }));
+    }
+    magn_watcher.setFuture(QtConcurrent::run([=]() {
+        return fit_sensor(magn_algorithm, refine, subsample, replicates,
+                          magn_file_name, snapshot.magn, snapshot.magn_quadric,
+                          cache, magn_options, *cancelled, magn_progress);
+    }));
+
+    set_status("Calibrating...");
+    // a new capture would truncate the files and clear online_cal under
+    // the fits
+    ui->samplingToggleButton->setEnabled(false);
+    ui->calAlgorithmComboBox->setEnabled(false);
+    ui->refineCheckBox->setEnabled(false);
+    update_bootstrap_enabled();
+    ui->calibrateButton->setText("Cancel");
+    disconnect(ui->calibrateButton, &QPushButton::clicked, this,
+               &FreeIMUCal::calibrate);
+    connect(ui->calibrateButton, &QPushButton::clicked, this,
+            &FreeIMUCal::cancel_calibration);
+}
+
+void FreeIMUCal::cancel_calibration() {
+    if (cal_cancelled) cal_cancelled->store(true);
+    ui->calibrateButton->setEnabled(false);
+    set_status("Cancelling calibration...");
+}
 
-    auto magn_params = CalLib::calibrate_from_file(magn_file_name);
-    magn_offset = magn_params.first;
-    magn_scale = magn_params.second;
+void FreeIMUCal::calibration_finished() {
+    // both watchers signal, the results are used once both are done
+    if (!calibrating || acc_watcher.isRunning() || magn_watcher.isRunning())
+        return;
+    calibrating = false;
+
+    progress_bar->hide();
+    // the port may have been closed in the meantime
+    ui->samplingToggleButton->setEnabled(ser->isOpen());
+    ui->calAlgorithmComboBox->setEnabled(true);
+    ui->refineCheckBox->setEnabled(true);
+    update_bootstrap_enabled();
+    ui->calibrateButton->setEnabled(true);
+    ui->calibrateButton->setText("Calibrate");
+    disconnect(ui->calibrateButton, &QPushButton::clicked, this,
+               &FreeIMUCal::cancel_calibration);
+    connect(ui->calibrateButton, &QPushButton::clicked, this,
+            &FreeIMUCal::calibrate);
+
+    const SensorFit acc_fit = acc_watcher.result();
+    const SensorFit magn_fit = magn_watcher.result();
+    // one write for the new entries of both fits
+    cal_cache->flush();
+    if (cal_cancelled->load()) {
+        set_status("Calibration cancelled");
+        return;
+    }
+    if (!acc_fit.error.isEmpty() || !magn_fit.error.isEmpty()) {
+        set_status("Calibration failed: " +
+                   (acc_fit.error.isEmpty() ? magn_fit.error : acc_fit.error));
+        return;
+    }
+
+    acc_offset = acc_fit.offset;
+    acc_scale = acc_fit.scale;
+    // the Calibrated tab shows what is exported, not the full fit
+    acc_calibration = CalLib::to_rotated(acc_offset, acc_scale);
+    magn_offset = magn_fit.offset;
+    magn_scale = magn_fit.scale;
+    magn_calibration = CalLib::to_rotated(magn_offset, magn_scale);
+    QString status = "Calibration done";
+    if (!acc_fit.status.isEmpty())
+        status = "acc: " + acc_fit.status + " - magn: " + magn_fit.status;
+
+    // the gyro needs no fit, its estimate is complete at any time
+    const GyroCalibrator gyro = online_cal->snapshot().gyro;
+    double bias[3];
+    double noise[3];
+    if (gyro.bias(bias)) {
+        for (int i = 0; i < 3; ++i) {
+            gyro_offset[i] = std::lround(bias[i]);
+        }
+        status += QString(" - gyro: %1 %2 %3 from %4 still samples")
+                      .arg(gyro_offset[0])
+                      .arg(gyro_offset[1])
+                      .arg(gyro_offset[2])
+                      .arg(gyro.stationary_samples());
+    } else {
+        gyro_offset.fill(0, 3);
+        status += " - gyro: never still";
+    }
+    if (gyro.noise_density(noise)) {
+        for (int i = 0; i < 3; ++i) {
+            gyro_noise[i] = noise[i];
+        }
+    } else {
+        gyro_noise.fill(0, 3);
+    }
+    set_status(status + QString(" (cache: %1 hits, %2 misses)")
+                            .arg(cal_cache->hits())
+                            .arg(cal_cache->misses()));
 
     // show calibrated tab
     ui->tabWidget->setCurrentIndex(1);
@@ -244,10 +738,9 @@ void FreeIMUCal::calibrate() {
     ui->calRes_magn_SCz->setText(QString::number(magn_scale[2]));
 
     // compute calibrated data
-    acc_cal_data =
-        CalLib::compute_calibrate_data(acc_data, acc_offset, acc_scale);
+    acc_cal_data = CalLib::compute_calibrate_data(acc_data, acc_calibration);
     magn_cal_data =
-        CalLib::compute_calibrate_data(magn_data, magn_offset, magn_scale);
+        CalLib::compute_calibrate_data(magn_data, magn_calibration);
 
     // populate 2D graphs with calibrated data
     ui->accXY_cal->plot(acc_cal_data[0], acc_cal_data[1], "#ff0000");
@@ -263,6 +756,18 @@ void FreeIMUCal::calibrate() {
     ui->magn3D_cal->plot(magn_cal_data[0], magn_cal_data[1], magn_cal_data[2],
                          "#000000");
 
+    // quality of the fits over the whole captures, measured by the fits
+    show_quality(ui->calHist_acc, ui->calQuality_acc, acc_fit.quality);
+    show_quality(ui->calHist_magn, ui->calQuality_magn, magn_fit.quality);
+
+    // per-algorithm held-out residual and time, empty unless in auto mode
+    ui->calCandidates_acc->setText(acc_fit.candidates);
+    ui->calCandidates_acc->setVisible(!acc_fit.candidates.isEmpty());
+    ui->calCandidates_magn->setText(magn_fit.candidates);
+    ui->calCandidates_magn->setVisible(!magn_fit.candidates.isEmpty());
+    show_bootstrap(ui->calBootstrap_acc, acc_fit.bootstrap);
+    show_bootstrap(ui->calBootstrap_magn, magn_fit.bootstrap);
+
     // enable calibration buttons to activate calibration storing functions
     ui->saveCalibrationHeaderButton->setEnabled(true);
     connect(ui->saveCalibrationHeaderButton, &QPushButton::clicked, this,
@@ -276,42 +781,57 @@ void FreeIMUCal::calibrate() {
 void FreeIMUCal::save_calibration_header() {
     QString text =
         ""
-        "/**"
-        "* FreeIMU calibration header. Automatically generated by FreeIMU_GUI."
-        "* Do not edit manually unless you know what you are doing."
-        "*/"
-
-        "#define CALIBRATION_H"
-
-        "const int acc_off_x = %d;"
-        "const int acc_off_y = %d;"
-        "const int acc_off_z = %d;"
-        "const float acc_scale_x = %f;"
-        "const float acc_scale_y = %f;"
-        "const float acc_scale_z = %f;"
-
-        "const int magn_off_x = %d;"
-        "const int magn_off_y = %d;"
-        "const int magn_off_z = %d;"
-        "const float magn_scale_x = %f;"
-        "const float magn_scale_y = %f;"
-        "const float magn_scale_z = %f;"
+        "/**\n"
+        "* FreeIMU calibration header. Automatically generated by FreeIMU_GUI.\n"
+        "* Do not edit manually unless you know what you are doing.\n"
+        "*/\n"
+        "\n"
+        "#define CALIBRATION_H\n"
+        "\n"
+        "const int acc_off_x = %d;\n"
+        "const int acc_off_y = %d;\n"
+        "const int acc_off_z = %d;\n"
+        "const float acc_scale_x = %f;\n"
+        "const float acc_scale_y = %f;\n"
+        "const float acc_scale_z = %f;\n"
+        "\n"
+        "const int magn_off_x = %d;\n"
+        "const int magn_off_y = %d;\n"
+        "const int magn_off_z = %d;\n"
+        "const float magn_scale_x = %f;\n"
+        "const float magn_scale_y = %f;\n"
+        "const float magn_scale_z = %f;\n"
+        "\n"
+        "const int gyro_off_x = %d;\n"
+        "const int gyro_off_y = %d;\n"
+        "const int gyro_off_z = %d;\n"
+        "// white noise density, raw units per sqrt(Hz)\n"
+        "const float gyro_noise_x = %f;\n"
+        "const float gyro_noise_y = %f;\n"
+        "const float gyro_noise_z = %f;\n"
         "";
     QString calibration_h_text = QString::asprintf(
-        text.toUtf8(), acc_offset[0], acc_offset[1], acc_offset[2],
-        acc_scale[0], acc_scale[1], acc_scale[2], magn_offset[0],
-        magn_offset[1], magn_offset[2], magn_scale[0], magn_scale[1],
-        magn_scale[2]);
+        text.toUtf8(), int(acc_offset[0]), int(acc_offset[1]),
+        int(acc_offset[2]), acc_scale[0], acc_scale[1], acc_scale[2],
+        int(magn_offset[0]), int(magn_offset[1]), int(magn_offset[2]),
+        magn_scale[0], magn_scale[1], magn_scale[2], int(gyro_offset[0]),
+        int(gyro_offset[1]), int(gyro_offset[2]), gyro_noise[0],
+        gyro_noise[1], gyro_noise[2]);
 
     QString calibration_h_folder = QFileDialog::getExistingDirectory(
         this, "Select the Folder to which save the calibration.h file");
-    QFile calibration_h_file(calibration_h_folder + calibration_h_file_name);
-    calibration_h_file.open(QFile::ReadOnly);
+    if (calibration_h_folder.isEmpty()) return;
+    const QString calibration_h_path =
+        QDir(calibration_h_folder).filePath(calibration_h_file_name);
+    QFile calibration_h_file(calibration_h_path);
+    if (!calibration_h_file.open(QFile::WriteOnly | QFile::Text)) {
+        set_status("Cannot write " + calibration_h_path);
+        return;
+    }
     calibration_h_file.write(calibration_h_text.toUtf8());
     calibration_h_file.close();
 
-    set_status("Calibration saved to: " + calibration_h_folder +
-               calibration_h_file_name +
+    set_status("Calibration saved to: " + calibration_h_path +
                " .\nRecompile and upload the program using the "
                "FreeIMU library to your microcontroller.");
 }
@@ -319,16 +839,17 @@ void FreeIMUCal::save_calibration_header() {
 void FreeIMUCal::save_calibration_eeprom() {
     ser->write("c");
     // pack data into a string
-    QString offsets =
-        QString::asprintf("%04x%04x%04x%04x%04x%04x", (int16_t) acc_offset[0],
-                          (int16_t) acc_offset[1], (int16_t) acc_offset[2],
-                          (int16_t) magn_offset[0], (int16_t) magn_offset[1],
-                          (int16_t) magn_offset[2]);
+    QString offsets = QString::asprintf(
+        "%04hx%04hx%04hx%04hx%04hx%04hx", (int16_t) acc_offset[0],
+        (int16_t) acc_offset[1], (int16_t) acc_offset[2],
+        (int16_t) magn_offset[0], (int16_t) magn_offset[1],
+        (int16_t) magn_offset[2]);
 
     QString scales = QString::asprintf(
         "%08a%08a%08a%08a%08a%08a", acc_scale[0], acc_scale[1], acc_scale[2],
         magn_scale[0], magn_scale[1], magn_scale[2]);
-    // transmit to microcontroller
+    // transmit to microcontroller. The firmware reads a block of fixed
+    // length, the gyro calibration only goes to calibration.h
     ser->write(QByteArray::fromHex(offsets.toUtf8()));
     ser->write(QByteArray::fromHex(scales.toUtf8()));
     set_status("Calibration saved to microcontroller EEPROM.");
@@ -366,11 +887,26 @@ void FreeIMUCal::newData(QVector<short> reading) {
 
     ui->acc3D->plot(acc_data[0], acc_data[1], acc_data[2], "#000000");
     ui->magn3D->plot(magn_data[0], magn_data[1], magn_data[2], "#000000");
+
+    // guide the six-position capture, the other modes keep their status
+    if (ui->calAlgorithmComboBox->currentData().toString() !=
+        six_position_algorithm)
+        return;
+    const SixPositionCalibrator poses = online_cal->snapshot().six_position;
+    if (poses.complete())
+        set_status("Sampling - all six poses captured");
+    else
+        set_status(QString("Sampling - six poses: %1/6, hold still with %2 up")
+                       .arg(poses.captured())
+                       .arg(poses.missing()));
 }
 
-SerialWorker::SerialWorker(std::shared_ptr<QSerialPort> ser, QObject* parent)
+SerialWorker::SerialWorker(std::shared_ptr<QSerialPort> ser,
+                           std::shared_ptr<OnlineCalibrator> online_cal,
+                           QObject* parent)
     : QThread(parent),
       ser(ser),
+      online_cal(online_cal),
       exiting(false) {
 }
 
@@ -386,6 +922,12 @@ void SerialWorker::run() {
     acc_file.open(QFile::WriteOnly);
     magn_file.setFileName(magn_file_name);
     magn_file.open(QFile::WriteOnly);
+    gyro_file.setFileName(gyro_file_name);
+    gyro_file.open(QFile::WriteOnly);
+    // the gyro noise density needs the actual sample rate
+    QElapsedTimer timer;
+    timer.start();
+    long samples = 0;
     int count = 100;
     int in_values = 9;
     QVector<int16_t> reading(in_values, 0);
@@ -406,28 +948,51 @@ void SerialWorker::run() {
                 }
             }
             ser->read(2);
+            bool magn_valid = true;
             if (reading[8] == 0) {
                 reading[6] = 1;
                 reading[7] = 1;
                 reading[8] = 1;
+                magn_valid = false;
+            }
+            // keep the online estimate up to date
+            online_cal->add_acc(reading[0], reading[1], reading[2]);
+            if (magn_valid) {
+                online_cal->add_magn(reading[6], reading[7], reading[8]);
             }
+            online_cal->add_gyro(reading[3], reading[4], reading[5],
+                                 reading[0], reading[1], reading[2]);
             // prepare readings to store on file
-            QString acc_readings_line =
-                QString("%d %d %d\r\n").arg(reading[0], reading[1], reading[2]);
+            QString acc_readings_line = QString("%1 %2 %3\r\n")
+                                            .arg(reading[0])
+                                            .arg(reading[1])
+                                            .arg(reading[2]);
             acc_file.write(acc_readings_line.toUtf8());
-            QString magn_readings_line =
-                QString("%d %d %d\r\n").arg(reading[6], reading[7], reading[8]);
+            QString magn_readings_line = QString("%1 %2 %3\r\n")
+                                             .arg(reading[6])
+                                             .arg(reading[7])
+                                             .arg(reading[8]);
             magn_file.write(magn_readings_line.toUtf8());
+            QString gyro_readings_line = QString("%1 %2 %3\r\n")
+                                             .arg(reading[3])
+                                             .arg(reading[4])
+                                             .arg(reading[5]);
+            gyro_file.write(gyro_readings_line.toUtf8());
         }
+        samples += count;
+        if (timer.elapsed() > 0)
+            online_cal->set_sample_rate(samples * 1000.0 / timer.elapsed());
+        online_cal->publish();
 
         // every count times we pass some data to the GUI
         emit new_data_signal(reading);
         qDebug() << ".";
     }
 
-    // closing acc and magn files
+    // closing the sample files
     acc_file.close();
     magn_file.close();
+    gyro_file.close();
     return;
 }
 
@@ -1,19 +1,26 @@
 #ifndef FREEIMUCAL_H
 #define FREEIMUCAL_H
 
+#include "calalgorithms.h"
+#include "calibrationcache.h"
 #include "callib.h"
+#include "onlinecalibrator.h"
 #include <QFile>
 #include <QFileDialog>
+#include <QFutureWatcher>
 #include <QMainWindow>
+#include <QProgressBar>
 #include <QSerialPort>
 #include <QSerialPortInfo>
 #include <QSettings>
 #include <QThread>
 #include <QVector2D>
+#include <atomic>
 #include <memory.h>
 
 #define acc_file_name "acc.txt"
 #define magn_file_name "magn.txt"
+#define gyro_file_name "gyro.txt"
 #define calibration_h_file_name "calibration.h"
 #define word 2
 #define acc_range 25000
@@ -21,6 +28,23 @@
 
 class SerialWorker;
 
+// ids of the calAlgorithmComboBox entries besides the registered
+// algorithms, see CalAlgorithms
+const char auto_algorithm[] = "auto";
+const char six_position_algorithm[] = "six_position"; // acc, magn as sphere
+
+// result of the calibration of one sensor, computed off the GUI thread
+struct SensorFit {
+    QVector<long> offset;
+    QVector<double> scale;
+    EllipsoidCalibration calibration;
+    QString status;
+    QString candidates; // per-algorithm scores of the auto mode
+    CalibrationQuality quality; // of the fit on the whole capture
+    BootstrapResult bootstrap; // empty estimate unless bootstrapped
+    QString error; // set instead of the results when the fit failed
+};
+
 namespace Ui {
 class FreeIMUCal;
 }
@@ -38,6 +62,9 @@ public:
     void sampling_start();
     void sampling_end();
     void calibrate();
+    void cancel_calibration();
+    void calibration_finished();
+    void update_bootstrap_enabled();
     void save_calibration_header();
     void save_calibration_eeprom();
     void clear_calibration_eeprom();
@@ -50,19 +77,34 @@ private:
     QVector<QVector<double>> magn_data;
     QString serial_port;
     std::shared_ptr<QSerialPort> ser{nullptr};
+    std::shared_ptr<OnlineCalibrator> online_cal{nullptr};
+    std::shared_ptr<CalibrationCache> cal_cache{nullptr};
     SerialWorker* serWorker{nullptr};
     QVector<long> acc_offset;
     QVector<double> acc_scale;
     QVector<long> magn_offset;
     QVector<double> magn_scale;
+    EllipsoidCalibration acc_calibration;
+    EllipsoidCalibration magn_calibration;
+    // from the stationary parts of the session, raw units
+    QVector<long> gyro_offset;
+    QVector<double> gyro_noise; // density, per sqrt(Hz)
     QVector<QVector<double>> acc_cal_data;
     QVector<QVector<double>> magn_cal_data;
+    // acc and magn are fitted concurrently on the global thread pool
+    QFutureWatcher<SensorFit> acc_watcher;
+    QFutureWatcher<SensorFit> magn_watcher;
+    std::shared_ptr<std::atomic<bool>> cal_cancelled{nullptr};
+    bool calibrating{false};
+    QProgressBar* progress_bar{nullptr};
 };
 
 class SerialWorker : public QThread {
     Q_OBJECT
 public:
-    SerialWorker(std::shared_ptr<QSerialPort> ser, QObject* parent = nullptr);
+    SerialWorker(std::shared_ptr<QSerialPort> ser,
+                 std::shared_ptr<OnlineCalibrator> online_cal,
+                 QObject* parent = nullptr);
     ~SerialWorker();
     void run();
 
@@ -74,8 +116,10 @@ signals:
 
 private:
     std::shared_ptr<QSerialPort> ser{nullptr};
+    std::shared_ptr<OnlineCalibrator> online_cal{nullptr};
     bool exiting;
     QFile acc_file;
     QFile magn_file;
+    QFile gyro_file;
 };
 #endif // FREEIMUCAL_H
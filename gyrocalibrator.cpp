@@ -0,0 +1,141 @@
+#include "gyrocalibrator.h"
+
+#include <cmath>
+
+RunningStats::RunningStats() {
+    clear();
+}
+
+void RunningStats::clear() {
+    count = 0;
+    for (int i = 0; i < 3; ++i) {
+        mean[i] = 0;
+        m2[i] = 0;
+    }
+}
+
+void RunningStats::add(const double value[3]) {
+    ++count;
+    for (int i = 0; i < 3; ++i) {
+        const double delta = value[i] - mean[i];
+        mean[i] += delta / count;
+        m2[i] += delta * (value[i] - mean[i]);
+    }
+}
+
+void RunningStats::merge(const RunningStats& other) {
+    if (other.count == 0) return;
+    const long n = count + other.count;
+    for (int i = 0; i < 3; ++i) {
+        const double delta = other.mean[i] - mean[i];
+        mean[i] += delta * other.count / n;
+        m2[i] += other.m2[i] + delta * delta * count * other.count / n;
+    }
+    count = n;
+}
+
+double RunningStats::variance(int axis) const {
+    return count > 1 ? m2[axis] / (count - 1) : 0;
+}
+
+StillnessDetector::StillnessDetector(double gyro_threshold,
+                                     double acc_threshold)
+    : gyro_threshold(gyro_threshold),
+      acc_threshold(acc_threshold) {
+    clear();
+}
+
+void StillnessDetector::clear() {
+    gyro_window.clear();
+    acc_window.clear();
+    restart = false;
+}
+
+bool StillnessDetector::add(const double gyro[3], const double acc[3]) {
+    if (restart) clear();
+    gyro_window.add(gyro);
+    acc_window.add(acc);
+    if (gyro_window.count < window) return false;
+
+    restart = true;
+    for (int i = 0; i < 3; ++i) {
+        if (gyro_window.variance(i) >= gyro_threshold * gyro_threshold ||
+            acc_window.variance(i) >= acc_threshold * acc_threshold)
+            return false;
+    }
+    return true;
+}
+
+const RunningStats& StillnessDetector::gyro() const {
+    return gyro_window;
+}
+
+const RunningStats& StillnessDetector::acc() const {
+    return acc_window;
+}
+
+GyroCalibrator::GyroCalibrator(double gyro_threshold, double acc_threshold)
+    : detector(gyro_threshold, acc_threshold),
+      sample_rate(0) {
+    clear();
+}
+
+void GyroCalibrator::clear() {
+    total = 0;
+    detector.clear();
+    stationary.clear();
+    for (int i = 0; i < 3; ++i) {
+        pooled_m2[i] = 0;
+    }
+    pooled_windows = 0;
+}
+
+void GyroCalibrator::add(const double gyro[3], const double acc[3]) {
+    ++total;
+    if (!detector.add(gyro, acc)) return;
+    const RunningStats& still = detector.gyro();
+    stationary.merge(still);
+    for (int i = 0; i < 3; ++i) {
+        pooled_m2[i] += still.m2[i];
+    }
+    ++pooled_windows;
+}
+
+void GyroCalibrator::set_sample_rate(double hz) {
+    sample_rate = hz;
+}
+
+long GyroCalibrator::samples() const {
+    return total;
+}
+
+long GyroCalibrator::stationary_samples() const {
+    return stationary.count;
+}
+
+bool GyroCalibrator::bias(double out[3]) const {
+    if (stationary.count == 0) return false;
+    for (int i = 0; i < 3; ++i) {
+        out[i] = stationary.mean[i];
+    }
+    return true;
+}
+
+bool GyroCalibrator::noise(double out[3]) const {
+    // every window loses one degree of freedom to its own mean
+    const long dof = stationary.count - pooled_windows;
+    if (dof <= 0) return false;
+    for (int i = 0; i < 3; ++i) {
+        out[i] = std::sqrt(pooled_m2[i] / dof);
+    }
+    return true;
+}
+
+bool GyroCalibrator::noise_density(double out[3]) const {
+    if (sample_rate <= 0 || !noise(out)) return false;
+    // white noise spread over the band up to Nyquist
+    for (int i = 0; i < 3; ++i) {
+        out[i] /= std::sqrt(sample_rate / 2);
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef GYROCALIBRATOR_H
+#define GYROCALIBRATOR_H
+
+// Running mean and variance of a 3-axis signal (Welford), O(1) per sample
+struct RunningStats {
+    long count;
+    double mean[3];
+    double m2[3]; // sum of squared deviations from the mean
+
+    RunningStats();
+    void clear();
+    void add(const double value[3]);
+    void merge(const RunningStats& other); // Chan et al. pairwise update
+    double variance(int axis) const;
+};
+
+// Splits a stream of gyro/acc frames into consecutive windows and tells
+// which ones were taken at rest: both standard deviations stay below their
+// thresholds on every axis.
+class StillnessDetector {
+public:
+    static const int window = 64; // samples per stationarity test
+
+    // thresholds are standard deviations over a window, in raw units
+    explicit StillnessDetector(double gyro_threshold = 15,
+                               double acc_threshold = 100);
+    void clear();
+    // true when the frame completed a still window, whose statistics stay
+    // in gyro() and acc() until the next call
+    bool add(const double gyro[3], const double acc[3]);
+    const RunningStats& gyro() const;
+    const RunningStats& acc() const;
+
+private:
+    double gyro_threshold;
+    double acc_threshold;
+    RunningStats gyro_window;
+    RunningStats acc_window;
+    bool restart;
+};
+
+// Streaming gyroscope bias and noise estimator. Still windows are folded
+// into the bias estimate, their inner variance into the noise estimate, so
+// motion between them never leaks into either.
+class GyroCalibrator {
+public:
+    explicit GyroCalibrator(double gyro_threshold = 15,
+                            double acc_threshold = 100);
+    void clear();
+    void add(const double gyro[3], const double acc[3]);
+
+    // measured by the caller, needed for the noise density only
+    void set_sample_rate(double hz);
+
+    long samples() const;
+    long stationary_samples() const;
+
+    // false until a stationary window was seen
+    bool bias(double out[3]) const;
+    // per-axis standard deviation of the stationary samples, raw units
+    bool noise(double out[3]) const;
+    // white noise density, raw units / sqrt(Hz), needs the sample rate
+    bool noise_density(double out[3]) const;
+
+private:
+    StillnessDetector detector;
+    double sample_rate;
+    long total;
+    RunningStats stationary; // stationary samples, for the bias
+    double pooled_m2[3];     // within-window squared deviations
+    long pooled_windows;
+};
+
+#endif // GYROCALIBRATOR_H
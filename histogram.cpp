@@ -0,0 +1,161 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+Histogram1D::Histogram1D(int bins, double low, double high)
+    : nbins(bins),
+      lo(low),
+      hi(high),
+      counts(std::max(bins, 1), 0.0),
+      under(0),
+      over(0) {
+    if (bins < 1 || !(high > low))
+        throw std::invalid_argument("Invalid histogram binning");
+    scale = bins / (high - low);
+}
+
+void Histogram1D::merge(const Histogram1D& other) {
+    if (other.nbins != nbins || other.lo != lo || other.hi != hi)
+        throw std::invalid_argument("Histogram binnings do not match");
+    for (int i = 0; i < nbins; i++)
+        counts[i] += other.counts[i];
+    under += other.under;
+    over += other.over;
+}
+
+void Histogram1D::clear() {
+    std::fill(counts.begin(), counts.end(), 0.0);
+    under = 0;
+    over = 0;
+}
+
+int Histogram1D::bins() const {
+    return nbins;
+}
+
+double Histogram1D::low() const {
+    return lo;
+}
+
+double Histogram1D::high() const {
+    return hi;
+}
+
+double Histogram1D::bin_center(int bin) const {
+    return lo + (bin + 0.5) / scale;
+}
+
+double Histogram1D::count(int bin) const {
+    return counts[bin];
+}
+
+double Histogram1D::underflow() const {
+    return under;
+}
+
+double Histogram1D::overflow() const {
+    return over;
+}
+
+double Histogram1D::entries() const {
+    double total = under + over;
+    for (double c : counts)
+        total += c;
+    return total;
+}
+
+double Histogram1D::max_count() const {
+    return *std::max_element(counts.begin(), counts.end());
+}
+
+double Histogram1D::quantile(double q) const {
+    double total = 0;
+    for (double c : counts)
+        total += c;
+    if (total <= 0) return lo;
+    const double target = q * total;
+    double below = 0;
+    for (int i = 0; i < nbins; i++) {
+        if (below + counts[i] >= target && counts[i] > 0)
+            return lo + (i + (target - below) / counts[i]) / scale;
+        below += counts[i];
+    }
+    return hi;
+}
+
+Histogram2D::Histogram2D(int xbins, double xlow, double xhigh, int ybins,
+                         double ylow, double yhigh)
+    : nx(xbins),
+      ny(ybins),
+      xlo(xlow),
+      xhi(xhigh),
+      ylo(ylow),
+      yhi(yhigh),
+      counts(static_cast<size_t>(std::max(xbins, 1)) * std::max(ybins, 1),
+             0.0),
+      out(0) {
+    if (xbins < 1 || ybins < 1 || !(xhigh > xlow) || !(yhigh > ylow))
+        throw std::invalid_argument("Invalid histogram binning");
+    xscale = xbins / (xhigh - xlow);
+    yscale = ybins / (yhigh - ylow);
+}
+
+void Histogram2D::merge(const Histogram2D& other) {
+    if (other.nx != nx || other.ny != ny || other.xlo != xlo ||
+        other.ylo != ylo || other.xscale != xscale || other.yscale != yscale)
+        throw std::invalid_argument("Histogram binnings do not match");
+    for (size_t i = 0; i < counts.size(); i++)
+        counts[i] += other.counts[i];
+    out += other.out;
+}
+
+void Histogram2D::clear() {
+    std::fill(counts.begin(), counts.end(), 0.0);
+    out = 0;
+}
+
+int Histogram2D::xbins() const {
+    return nx;
+}
+
+int Histogram2D::ybins() const {
+    return ny;
+}
+
+double Histogram2D::xlow() const {
+    return xlo;
+}
+
+double Histogram2D::xhigh() const {
+    return xhi;
+}
+
+double Histogram2D::ylow() const {
+    return ylo;
+}
+
+double Histogram2D::yhigh() const {
+    return yhi;
+}
+
+double Histogram2D::count(int xbin, int ybin) const {
+    return counts[static_cast<size_t>(ybin) * nx + xbin];
+}
+
+double Histogram2D::outside() const {
+    return out;
+}
+
+double Histogram2D::entries() const {
+    double total = out;
+    for (double c : counts)
+        total += c;
+    return total;
+}
+
+int Histogram2D::occupied() const {
+    return static_cast<int>(
+        std::count_if(counts.begin(), counts.end(),
+                      [](double c) { return c != 0; }));
+}
@@ -0,0 +1,99 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <vector>
+
+// Fixed-width binned histograms. Meant to be filled per thread and merged
+// once at the end, so filling never locks; merge() needs the same binning.
+
+class Histogram1D {
+public:
+    Histogram1D(int bins = 1, double low = 0, double high = 1);
+
+    // values below low / from high up land in the under/overflow, NaN in
+    // the overflow
+    inline void fill(double value, double weight = 1);
+    void merge(const Histogram1D& other);
+    void clear();
+
+    int bins() const;
+    double low() const;
+    double high() const;
+    double bin_center(int bin) const;
+    double count(int bin) const;
+    double underflow() const;
+    double overflow() const;
+    double entries() const; // total weight, under/overflow included
+    double max_count() const;
+
+    // value below which a fraction q of the in-range weight lies,
+    // interpolated inside the bin
+    double quantile(double q) const;
+
+private:
+    int nbins;
+    double lo;
+    double hi;
+    double scale; // bins per unit
+    std::vector<double> counts;
+    double under;
+    double over;
+};
+
+class Histogram2D {
+public:
+    Histogram2D(int xbins = 1, double xlow = 0, double xhigh = 1,
+                int ybins = 1, double ylow = 0, double yhigh = 1);
+
+    // out of range entries are only counted in outside()
+    inline void fill(double x, double y, double weight = 1);
+    void merge(const Histogram2D& other);
+    void clear();
+
+    int xbins() const;
+    int ybins() const;
+    double xlow() const;
+    double xhigh() const;
+    double ylow() const;
+    double yhigh() const;
+    double count(int xbin, int ybin) const;
+    double outside() const;
+    double entries() const;
+    int occupied() const; // bins with a non-zero count
+
+private:
+    int nx;
+    int ny;
+    double xlo;
+    double xhi;
+    double ylo;
+    double yhi;
+    double xscale;
+    double yscale;
+    std::vector<double> counts; // row-major, y rows of x bins
+    double out;
+};
+
+inline void Histogram1D::fill(double value, double weight) {
+    const double position = (value - lo) * scale;
+    if (position < 0) {
+        under += weight;
+    } else if (position < nbins) {
+        counts[static_cast<int>(position)] += weight;
+    } else {
+        over += weight;
+    }
+}
+
+inline void Histogram2D::fill(double x, double y, double weight) {
+    const double px = (x - xlo) * xscale;
+    const double py = (y - ylo) * yscale;
+    // the negated tests also send NaN outside
+    if (!(px >= 0 && px < nx && py >= 0 && py < ny)) {
+        out += weight;
+        return;
+    }
+    counts[static_cast<int>(py) * nx + static_cast<int>(px)] += weight;
+}
+
+#endif // HISTOGRAM_H
@@ -1,10 +1,13 @@
 #include "freeimucal.h"
+#include "simd.h"
 
 #include <QApplication>
+#include <QDebug>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+    qInfo() << "Numeric kernels:" << simd::name(simd::active());
     FreeIMUCal w;
     w.show();
     return a.exec();
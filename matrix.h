@@ -1,4 +1,7 @@
 #pragma once
+#include "matrixexpr.h"
+#include "matrixkernels.h"
+#include "parallel.h"
 #include <cmath>
 #include <iostream>
 #include <iterator>
@@ -9,10 +12,15 @@
 
 namespace matrices {
 
-template <class T, class alloc = std::allocator<T>>
-class Matrix {
+template <class T>
+class LU;
+
+template <class T, class alloc>
+class Matrix : public MatrixExpr<Matrix<T, alloc>> {
 
 public:
+    typedef T value_type;
+
     // public variables
     std::vector<T> inner_; // set to private later
     int dimx_, dimy_;	   // set to private later
@@ -29,11 +37,58 @@ public:
     }
 
     Matrix(const Matrix& matrix) {
-        this->inner_.assign(matrix.inner_);
+        this->inner_ = matrix.inner_;
         this->dimx_ = matrix.dimx_;
         this->dimy_ = matrix.dimy_;
     }
 
+    /// <summary>
+    /// Move constructor, steals the storage of a temporary
+    /// </summary>
+    Matrix(Matrix&& matrix) noexcept
+        : inner_(std::move(matrix.inner_)),
+          dimx_(matrix.dimx_),
+          dimy_(matrix.dimy_) {
+        matrix.dimx_ = 0;
+        matrix.dimy_ = 0;
+    }
+
+    /// <summary>
+    /// Evaluates a lazy expression (see matrixexpr.h) in a single pass,
+    /// split by rows over the thread pool when it is large
+    /// </summary>
+    template <class E>
+    Matrix(const MatrixExpr<E>& expr)
+        : dimx_(expr.self().cols()),
+          dimy_(expr.self().rows()) {
+        const E& e = expr.self();
+        inner_.resize(dimx_ * dimy_);
+        const auto evaluate = [&](int begin, int end, int) {
+            T* out = inner_.data() + begin * dimx_;
+            for (int row = begin; row < end; row++)
+                for (int col = 0; col < dimx_; col++)
+                    *out++ = e.coeff(row, col);
+        };
+        if (dimx_ * dimy_ < kernels::parallelElements)
+            evaluate(0, dimy_, 0);
+        else
+            parallel::forChunks(dimy_, evaluate);
+    }
+
+    /// <summary>
+    /// Materializes a transposed matrix with the cache-oblivious kernel
+    /// instead of the element-wise expression loop
+    /// </summary>
+    template <class A>
+    Matrix(const MatrixTransposed<Matrix<T, A>>& expr)
+        : dimx_(expr.cols()),
+          dimy_(expr.rows()) {
+        const Matrix<T, A>& source = expr.nested();
+        inner_.resize(dimx_ * dimy_);
+        kernels::transpose(source.dimy_, source.dimx_, source.inner_.data(),
+                           source.dimx_, inner_.data(), dimx_);
+    }
+
     Matrix(const std::vector<T>& data) {
         inner_.assign(data.begin(), data.end());
         dimx_ = data.size();
@@ -50,6 +105,82 @@ public:
         return inner_;
     }
 
+    // expression interface, see matrixexpr.h
+    int rows() const {
+        return dimy_;
+    }
+
+    int cols() const {
+        return dimx_;
+    }
+
+    T coeff(int row, int col) const {
+        return inner_[dimx_ * row + col];
+    }
+
+    /// <summary>
+    /// Returns a view on a row, without copying it
+    /// </summary>
+    /// <param name="index">The row, from 0</param>
+    MatrixView<T> row(int index) {
+        return view().row(index);
+    }
+
+    MatrixView<const T> row(int index) const {
+        return view().row(index);
+    }
+
+    /// <summary>
+    /// Returns a view on a column, without copying it
+    /// </summary>
+    /// <param name="index">The column, from 0</param>
+    MatrixView<T> col(int index) {
+        return view().col(index);
+    }
+
+    MatrixView<const T> col(int index) const {
+        return view().col(index);
+    }
+
+    /// <summary>
+    /// Returns a view on the rows x cols block whose top left element is
+    /// at row, col
+    /// </summary>
+    MatrixView<T> block(int row, int col, int rows, int cols) {
+        return view().block(row, col, rows, cols);
+    }
+
+    MatrixView<const T> block(int row, int col, int rows, int cols) const {
+        return view().block(row, col, rows, cols);
+    }
+
+    /// <summary>
+    /// Returns a view on the whole matrix
+    /// </summary>
+    MatrixView<T> view() {
+        return MatrixView<T>(inner_.data(), dimy_, dimx_, dimx_, 1);
+    }
+
+    MatrixView<const T> view() const {
+        return MatrixView<const T>(inner_.data(), dimy_, dimx_, dimx_, 1);
+    }
+
+    /// <summary>
+    /// Transposes the matrix in place. Square matrices are transposed
+    /// without any extra storage, the others through one copy.
+    /// </summary>
+    void transposeInPlace() {
+        if (dimx_ == dimy_) {
+            kernels::transposeInPlace(dimx_, inner_.data(), dimx_);
+            return;
+        }
+        std::vector<T> transposed(inner_.size());
+        kernels::transpose(dimy_, dimx_, inner_.data(), dimx_,
+                           transposed.data(), dimy_);
+        inner_.swap(transposed);
+        std::swap(dimx_, dimy_);
+    }
+
     /// <summary>
     /// Returns a value at the specified position within the matrix
     /// </summary>
@@ -75,33 +206,20 @@ public:
         inner_[dimx_ * row + col] = value;
     }
 
-    Matrix<T> simpleMul(const Matrix<T>& other) {
-        Matrix<T> result(*this);
-        for (int i = 0; i < dimx_; ++i) {
-            for (int j = 0; j < dimy_; ++j) {
-                result.inner_[j * dimx_ + i] *= other.inner_[j * dimx_ + i];
-            }
-        }
-    }
-
     /// <summary>
     /// Inverts the matrix
     /// </summary>
+    /// <remarks>Uses an LU factorization, see factorization.h to reuse it
+    /// for several solves</remarks>
     Matrix<T> invert() {
         if (dimx_ != dimy_) throw std::invalid_argument("Matrix is not n by n");
-        double det = getDeterminant();
-        Matrix<double> temp(dimx_, dimy_);
-        for (int i = 0; i < dimx_; i++)
-            for (int j = 0; j < dimy_; j++)
-                temp.add(getCofactor(i, j, *this), i, j);
-        temp.scalarMultiply(1 / det);
-        return temp;
+        return LU<T>(*this).inverse();
     }
 
     /// <summary>
     /// Returns the determinant of the matrix
     /// </summary>
-    /// <returns>The deteminant as an integer</returns>
+    /// <returns>The deteminant as a double</returns>
     /// TODO : add to a specialised templated class, won't work with matrices of
     /// types other than numbers
     double getDeterminant() {
@@ -118,17 +236,6 @@ public:
         return getCofactor(row, col, *this);
     }
 
-    /// <summary>
-    /// Transposes this matrix
-    /// </summary>
-    Matrix<T> transpose() {
-        Matrix<T> result = *this;
-        Matrix<T> temp = *this;
-        for (int i = 0; i < dimy_ * dimx_; i++)
-            result.inner_[i] = temp.getAt(i / dimy_, i % dimx_);
-        return result;
-    }
-
     /// <summary>
     /// Normalises the matrix
     /// </summary>
@@ -137,10 +244,10 @@ public:
         double sum = 0.0;
         for (int i = 0; i < vecSize(); i++)
             sum += pow(inner_[i], 2);
-        if (sum == 1) return;
+        if (sum == 1) return result;
         for (int i = 0; i < vecSize(); i++)
-            inner_[i] /= sqrt(sum);
-        std::cout << sum << std::endl;
+            result.inner_[i] /= sqrt(sum);
+        return result;
     }
 
     // operators
@@ -150,11 +257,12 @@ public:
     /// </summary>
     /// <param name="arg">The matrix to compare against</param>
     /// <returns>Whether the two are the same or not as a bool</returns>
-    bool operator==(Matrix<T> arg) {
+    bool operator==(const Matrix<T>& arg) const {
         // if (isOutOfRange(arg))
         // throw std::invalid_argument("Matrix is out of range");
         if (inner_.size() == 0) return false;
         if (arg.size() == 0) return false;
+        if (dimx_ != arg.dimx_ || dimy_ != arg.dimy_) return false;
         for (int i = 0; i < inner_.size(); i++)
             if (inner_[i] != arg.inner_[i]) return false;
         return true;
@@ -165,7 +273,7 @@ public:
     /// </summary>
     /// <param name="arg">The matrix to compare</param>
     /// <returns>Bool</returns>
-    bool operator!=(Matrix<T> arg) {
+    bool operator!=(const Matrix<T>& arg) const {
         return !(*this == arg);
     }
 
@@ -174,74 +282,93 @@ public:
     /// </summary>
     /// <param name="arg">The matrix to copy</param>
     /// <returns></returns>
-    // Matrix<T>& operator=(Matrix<T> arg) {
-    //	if (this != arg)
-    //		this = arg; // change later
-    // }
+    Matrix& operator=(const Matrix& arg) = default;
 
     /// <summary>
-    /// Simple matrix addition
+    /// Moves a temporary into the current matrix without copying
     /// </summary>
-    /// <param name="arg"></param>
+    /// <param name="arg">The matrix to move from</param>
     /// <returns></returns>
-    /// TODO : Need to fix this function as it will change this object
-    /// rather than just return a new one with the two matrices added together
-    Matrix<T> operator+(Matrix<T> arg) {
-        if (isOutOfRange(arg))
-            throw std::invalid_argument("Matrix is out of range");
-        Matrix<T> temp(*this);
-        for (int i = 0; i < temp.inner_.size(); i++)
-            temp.inner_[i] = this->getAt(i % dimx_, i / dimy_) +
-                arg.getAt(i % dimx_, i / dimy_);
-        return temp;
+    Matrix& operator=(Matrix&& arg) noexcept {
+        inner_ = std::move(arg.inner_);
+        dimx_ = arg.dimx_;
+        dimy_ = arg.dimy_;
+        arg.dimx_ = 0;
+        arg.dimy_ = 0;
+        return *this;
     }
 
-    Matrix<T> operator*(double fact) {
-        Matrix<T> result(*this);
-        for (int i = 0; i < inner_.size(); ++i) {
-            result.inner_[i] *= fact;
-        }
+    /// <summary>
+    /// Evaluates an expression into the current matrix. The expression may
+    /// read this matrix, it is evaluated into fresh storage first.
+    /// </summary>
+    /// <param name="expr">The expression to evaluate</param>
+    /// <returns></returns>
+    template <class E>
+    Matrix& operator=(const MatrixExpr<E>& expr) {
+        return *this = Matrix(expr.self());
     }
 
+    // +, -, scalar * and simpleMul are lazy, see matrixexpr.h
+
     /// <summary>
-    /// Matrix subtraction
+    /// Multiplies two matrices into out, resizing it to fit
     /// </summary>
-    /// <param name="arg"></param>
-    /// <returns></returns>
-    Matrix<T> operator-(Matrix<T> arg) {
-        if (isOutOfRange(arg))
-            throw std::invalid_argument("Matrix is out of range");
-        Matrix<T> temp(*this);
-        for (int i = 0; i < temp.inner_.size(); i++)
-            temp.inner_[i] = this->getAt(i % dimx_, i / dimy_) -
-                arg.getAt(i % dimx_, i / dimy_);
-        return temp;
+    /// <param name="matrixOne">Left operand, rows x k</param>
+    /// <param name="matrixTwo">Right operand, k x cols</param>
+    /// <param name="out">Receives the rows x cols product, must not alias
+    /// an operand</param>
+    static void multiply(const Matrix<T>& matrixOne,
+                         const Matrix<T>& matrixTwo, Matrix<T>& out) {
+        if (matrixOne.dimx_ != matrixTwo.dimy_)
+            throw std::invalid_argument("Matrix dimensions do not match");
+        out.reshape(matrixTwo.dimx_, matrixOne.dimy_);
+        kernels::gemm(matrixOne.dimy_, matrixTwo.dimx_, matrixOne.dimx_,
+                      matrixOne.inner_.data(), matrixOne.dimx_,
+                      matrixTwo.inner_.data(), matrixTwo.dimx_,
+                      out.inner_.data(), out.dimx_);
     }
 
     /// <summary>
-    /// Matrix multiplication
+    /// Multiplies op(matrixOne) * op(matrixTwo) into out, op transposing
+    /// its operand when the flag is set. Transposed operands are read in
+    /// place by the kernel, never copied.
     /// </summary>
-    /// <param name="arg"></param>
-    /// <returns></returns>
-    /// TODO : make this more efficient
-    Matrix<T> operator*(Matrix<T> arg) {
-        if (isOutOfRange(arg)) throw std::out_of_range("Matrix out of range");
-        Matrix<T> temp(dimx_, dimy_);
-        multiply(*this, arg, temp);
-        return temp;
+    /// <param name="out">Receives the product, must not alias an
+    /// operand</param>
+    static void multiply(bool transOne, const Matrix<T>& matrixOne,
+                         bool transTwo, const Matrix<T>& matrixTwo,
+                         Matrix<T>& out) {
+        const int m = transOne ? matrixOne.dimx_ : matrixOne.dimy_;
+        const int k = transOne ? matrixOne.dimy_ : matrixOne.dimx_;
+        const int n = transTwo ? matrixTwo.dimy_ : matrixTwo.dimx_;
+        if (k != (transTwo ? matrixTwo.dimx_ : matrixTwo.dimy_))
+            throw std::invalid_argument("Matrix dimensions do not match");
+        out.reshape(n, m);
+        kernels::gemm(transOne, transTwo, m, n, k, matrixOne.inner_.data(),
+                      matrixOne.dimx_, matrixTwo.inner_.data(),
+                      matrixTwo.dimx_, out.inner_.data(), out.dimx_);
+    }
+
+    /// <summary>
+    /// Returns transpose() * (*this) without building the transpose
+    /// </summary>
+    /// <returns>The symmetric dimx by dimx Gram matrix</returns>
+    Matrix<T> gram() const {
+        Matrix<T> result(dimx_, dimx_);
+        kernels::syrk(dimy_, dimx_, inner_.data(), dimx_,
+                      result.inner_.data(), dimx_);
+        return result;
     }
 
     /// <summary>
-    /// Matrix division
+    /// Matrix division, this * arg^-1
     /// </summary>
     /// <param name="arg"></param>
     /// <returns></returns>
-    Matrix<T> operator/(Matrix<T> arg) {
-        Matrix<T> returnMatrix(dimy_, dimx_);
-        Matrix<T> temp(dimy_, dimx_);
-        temp = (*this);
-        invert();
-        multiply(*this, temp, returnMatrix);
+    Matrix<T> operator/(const Matrix<T>& arg) const {
+        Matrix<T> returnMatrix(arg.dimx_, dimy_);
+        multiply(*this, Matrix<T>(arg).invert(), returnMatrix);
         return returnMatrix;
     }
 
@@ -250,8 +377,9 @@ public:
     /// </summary>
     /// <param name="arg"></param>
     /// <returns></returns>
-    Matrix<T>& operator+=(Matrix<T> arg) {
-        return *this + arg;
+    template <class E>
+    Matrix<T>& operator+=(const MatrixExpr<E>& arg) {
+        return *this = *this + arg;
     }
 
     /// <summary>
@@ -259,8 +387,9 @@ public:
     /// </summary>
     /// <param name="arg"></param>
     /// <returns></returns>
-    Matrix<T>& operator-=(Matrix<T> arg) {
-        return *this - arg;
+    template <class E>
+    Matrix<T>& operator-=(const MatrixExpr<E>& arg) {
+        return *this = *this - arg;
     }
 
     /// <summary>
@@ -268,29 +397,43 @@ public:
     /// </summary>
     /// <param name="arg"></param>
     /// <returns></returns>
-    Matrix<T>& operator*=(Matrix<T> arg) {
-        return *this * arg;
+    template <class E>
+    Matrix<T>& operator*=(const MatrixExpr<E>& arg) {
+        return *this = *this * arg;
     }
 
     /// <summary>
-    /// overrides the /= operator
+    /// Overrides the *= operator for a scalar, in place
+    /// </summary>
+    /// <param name="arg"></param>
+    /// <returns></returns>
+    Matrix<T>& operator*=(T arg) {
+        scalarMultiply(arg);
+        return *this;
+    }
+
+    /// <summary>
+    /// overrides the /= operator, divides every element in place
     /// </summary>
     /// <param name="arg"></param>
     /// <returns></returns>
     Matrix<T>& operator/=(T arg) {
-        return *this / arg;
+        for (int i = 0; i < inner_.size(); i++)
+            inner_[i] /= arg;
+        return *this;
     }
 
     /// <summary>
     /// Allows users to do Matrix[col][row]
     /// </summary>
-    /// <param name="index"></param>
-    /// <returns></returns>
-    /// This is pretty inefficient but it does allow users to use the [col][row]
-    /// as if they are using a 2D array, perhaps find a better way to implement
-    /// this
-    std::vector<T> operator[](int index) {
-        return getColumn(index);
+    /// <param name="index">The column</param>
+    /// <returns>A view on the column, indexed by row</returns>
+    MatrixView<T> operator[](int index) {
+        return col(index);
+    }
+
+    MatrixView<const T> operator[](int index) const {
+        return col(index);
     }
 
     /// <summary>
@@ -804,55 +947,7 @@ private:
     /// <param name="row">Rows to check</param>
     /// <returns></returns>
     bool isOutOfRange(int col, int row) {
-        return col > dimx_ || row > dimy_ || col < 0 || row < 0;
-    }
-
-    /// <summary>
-    /// Gets a row at the specified index
-    /// </summary>
-    /// <param name="row"></param>
-    /// <returns></returns>
-    /// <remarks>returns a reference to a temp variable</remarks>
-    std::vector<T> getRow(int row) {
-        if (row > dimy_) throw std::out_of_range("Index out of range");
-        std::vector<T> temp;
-        for (int i = 0; i < dimx_; i++)
-            temp.push_back(inner_[i * dimy_]);
-        return temp;
-    }
-
-    /// <summary>
-    /// Gets a whole column at the specified index
-    /// </summary>
-    /// <param name="row"></param>
-    /// <returns></returns>
-    std::vector<T> getColumn(int column) {
-        if (column > dimx_) throw std::out_of_range("Index out of range");
-        std::vector<T> temp;
-        for (int i = 0; i < dimx_; i++)
-            temp.push_back(inner_[i] + dimx_ * i);
-        return temp;
-    }
-
-    /// <summary>
-    /// Multiplies two matricies and sends creates a new on called out
-    /// </summary>
-    /// <param name="matrixOne"></param>
-    /// <param name="matrixTwo"></param>
-    /// <param name="out"></param>
-    /// TODO : Does not work, need to refactor
-    void multiply(Matrix<T> matrixOne, Matrix<T> matrixTwo, Matrix<T>& out) {
-        for (int x = 0; x < matrixOne.dimx_; x++) {
-            for (int y = 0; y < matrixTwo.dimx_; y++) {
-                int dotProduct = 0;
-                for (int i = 0; i < matrixOne.dimx_; i++) {
-                    int matrixRow = matrixOne.getRow(x)[i];
-                    dotProduct +=
-                        matrixOne.getRow(x)[i] * matrixTwo.getRow(y)[i];
-                }
-                out.add(dotProduct, x, y);
-            }
-        }
+        return col >= dimx_ || row >= dimy_ || col < 0 || row < 0;
     }
 
     /// <summary>
@@ -867,19 +962,13 @@ private:
     /// <summary>
     /// Gets the determinant of the matrix
     /// </summary>
-    /// <param name="matrix">The matrix to inverse</param>
-    /// <param name="matrixHeight">The height of the matrix, aka how many
-    /// elements in the column</param> <returns></returns>
-    double determinant(Matrix<T> matrix) {
+    /// <param name="matrix">The matrix to get the determinant of</param>
+    /// <returns>The product of the LU pivots</returns>
+    double determinant(const Matrix<T>& matrix) {
         if (matrix.dimx_ != matrix.dimy_)
             throw std::out_of_range("Bro wot doing??");
-        double det = 0.0;
-        if (matrix.dimy_ == 2)
-            return (matrix.getAt(0, 0) * matrix.getAt(1, 1)) -
-                (matrix.getAt(1, 0) * matrix.getAt(0, 1));
-        for (int rowElem = 0; rowElem < matrix.dimx_; rowElem++)
-            det += getCofactor(0, rowElem, matrix) * matrix.getAt(rowElem, 0);
-        return det;
+        if (matrix.dimy_ == 1) return matrix.inner_[0];
+        return LU<T>(matrix).determinant();
     }
 
     /// <summary>
@@ -929,3 +1018,5 @@ private:
     }
 };
 } // namespace matrices
+
+#include "factorization.h"
@@ -0,0 +1,403 @@
+#pragma once
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+namespace matrices {
+
+template <class T, class alloc = std::allocator<T>>
+class Matrix;
+
+template <class E>
+class MatrixTransposed;
+
+template <class L, class R>
+class MatrixElementwiseProduct;
+
+/// <summary>
+/// Base of every lazy matrix expression (CRTP).
+/// Element-wise operators and transposes only build a small tree of these
+/// nodes; the whole tree is evaluated in a single loop, with a single
+/// allocation, once it is assigned to a Matrix.
+/// </summary>
+/// <remarks>Nodes keep references to the matrices they read, so an
+/// expression must not outlive its operands (don't store it in auto)</remarks>
+template <class E>
+class MatrixExpr {
+public:
+    const E& self() const {
+        return static_cast<const E&>(*this);
+    }
+
+    /// <summary>
+    /// Lazily transposes the expression
+    /// </summary>
+    MatrixTransposed<E> transpose() const {
+        return MatrixTransposed<E>(self());
+    }
+
+    /// <summary>
+    /// Lazy element-wise (Hadamard) product
+    /// </summary>
+    template <class R>
+    MatrixElementwiseProduct<E, R> simpleMul(const MatrixExpr<R>& other) const {
+        return MatrixElementwiseProduct<E, R>(self(), other.self());
+    }
+};
+
+/// <summary>
+/// How a node stores its operands: matrices by reference, the (small)
+/// intermediate nodes by value
+/// </summary>
+template <class E>
+struct ExprStorage {
+    typedef const E type;
+};
+
+template <class T, class A>
+struct ExprStorage<Matrix<T, A>> {
+    typedef const Matrix<T, A>& type;
+};
+
+template <class L, class R>
+void checkSameShape(const L& l, const R& r) {
+    if (l.rows() != r.rows() || l.cols() != r.cols())
+        throw std::invalid_argument("Matrix dimensions do not match");
+}
+
+template <class L, class R>
+class MatrixSum : public MatrixExpr<MatrixSum<L, R>> {
+public:
+    typedef typename L::value_type value_type;
+
+    MatrixSum(const L& l, const R& r)
+        : l_(l),
+          r_(r) {
+        checkSameShape(l, r);
+    }
+    int rows() const {
+        return l_.rows();
+    }
+    int cols() const {
+        return l_.cols();
+    }
+    value_type coeff(int row, int col) const {
+        return l_.coeff(row, col) + r_.coeff(row, col);
+    }
+
+private:
+    typename ExprStorage<L>::type l_;
+    typename ExprStorage<R>::type r_;
+};
+
+template <class L, class R>
+class MatrixDifference : public MatrixExpr<MatrixDifference<L, R>> {
+public:
+    typedef typename L::value_type value_type;
+
+    MatrixDifference(const L& l, const R& r)
+        : l_(l),
+          r_(r) {
+        checkSameShape(l, r);
+    }
+    int rows() const {
+        return l_.rows();
+    }
+    int cols() const {
+        return l_.cols();
+    }
+    value_type coeff(int row, int col) const {
+        return l_.coeff(row, col) - r_.coeff(row, col);
+    }
+
+private:
+    typename ExprStorage<L>::type l_;
+    typename ExprStorage<R>::type r_;
+};
+
+template <class L, class R>
+class MatrixElementwiseProduct
+    : public MatrixExpr<MatrixElementwiseProduct<L, R>> {
+public:
+    typedef typename L::value_type value_type;
+
+    MatrixElementwiseProduct(const L& l, const R& r)
+        : l_(l),
+          r_(r) {
+        checkSameShape(l, r);
+    }
+    int rows() const {
+        return l_.rows();
+    }
+    int cols() const {
+        return l_.cols();
+    }
+    value_type coeff(int row, int col) const {
+        return l_.coeff(row, col) * r_.coeff(row, col);
+    }
+
+private:
+    typename ExprStorage<L>::type l_;
+    typename ExprStorage<R>::type r_;
+};
+
+template <class E>
+class MatrixScaled : public MatrixExpr<MatrixScaled<E>> {
+public:
+    typedef typename E::value_type value_type;
+
+    MatrixScaled(const E& e, value_type factor)
+        : e_(e),
+          factor_(factor) {
+    }
+    int rows() const {
+        return e_.rows();
+    }
+    int cols() const {
+        return e_.cols();
+    }
+    value_type coeff(int row, int col) const {
+        return e_.coeff(row, col) * factor_;
+    }
+
+private:
+    typename ExprStorage<E>::type e_;
+    value_type factor_;
+};
+
+template <class E>
+class MatrixTransposed : public MatrixExpr<MatrixTransposed<E>> {
+public:
+    typedef typename E::value_type value_type;
+
+    explicit MatrixTransposed(const E& e)
+        : e_(e) {
+    }
+    int rows() const {
+        return e_.cols();
+    }
+    int cols() const {
+        return e_.rows();
+    }
+    value_type coeff(int row, int col) const {
+        return e_.coeff(col, row);
+    }
+    const E& nested() const {
+        return e_;
+    }
+
+private:
+    typename ExprStorage<E>::type e_;
+};
+
+/// <summary>
+/// Non-owning strided window on the storage of a matrix: a row, a column
+/// or a sub-block. Taking a view never copies or allocates; writes through
+/// a mutable view land in the matrix.
+/// </summary>
+/// <remarks>A view must not outlive the matrix it was taken from, nor be
+/// used after that matrix was resized</remarks>
+template <class T>
+class MatrixView : public MatrixExpr<MatrixView<T>> {
+public:
+    typedef typename std::remove_const<T>::type value_type;
+
+    /// <summary>
+    /// Views rows x cols elements starting at data
+    /// </summary>
+    /// <param name="rowStride">Distance in elements between two rows</param>
+    /// <param name="colStride">Distance in elements between two
+    /// columns</param>
+    MatrixView(T* data, int rows, int cols, int rowStride, int colStride)
+        : data_(data),
+          rows_(rows),
+          cols_(cols),
+          rowStride_(rowStride),
+          colStride_(colStride) {
+    }
+
+    int rows() const {
+        return rows_;
+    }
+    int cols() const {
+        return cols_;
+    }
+    value_type coeff(int row, int col) const {
+        return data_[row * rowStride_ + col * colStride_];
+    }
+
+    /// <summary>
+    /// Unchecked element access
+    /// </summary>
+    T& operator()(int row, int col) const {
+        return data_[row * rowStride_ + col * colStride_];
+    }
+
+    /// <summary>
+    /// Element i of a row or column view, along its length
+    /// </summary>
+    T& operator[](int index) const {
+        return rows_ == 1 ? data_[index * colStride_]
+                          : data_[index * rowStride_];
+    }
+
+    /// <summary>
+    /// Number of elements of a row or column view
+    /// </summary>
+    int size() const {
+        return rows_ * cols_;
+    }
+
+    MatrixView row(int index) const {
+        checkIndex(index, rows_);
+        return MatrixView(data_ + index * rowStride_, 1, cols_, rowStride_,
+                          colStride_);
+    }
+
+    MatrixView col(int index) const {
+        checkIndex(index, cols_);
+        return MatrixView(data_ + index * colStride_, rows_, 1, rowStride_,
+                          colStride_);
+    }
+
+    MatrixView block(int row, int col, int rows, int cols) const {
+        if (row < 0 || col < 0 || rows < 0 || cols < 0 ||
+            row + rows > rows_ || col + cols > cols_)
+            throw std::out_of_range("Block out of range");
+        return MatrixView(data_ + row * rowStride_ + col * colStride_, rows,
+                          cols, rowStride_, colStride_);
+    }
+
+    /// <summary>
+    /// The same elements, transposed, still without a copy
+    /// </summary>
+    MatrixView transposed() const {
+        return MatrixView(data_, cols_, rows_, colStride_, rowStride_);
+    }
+
+    /// <summary>
+    /// Copies an expression of the same shape into the viewed elements.
+    /// The expression is evaluated first, so it may read the same matrix.
+    /// </summary>
+    template <class E>
+    const MatrixView& operator=(const MatrixExpr<E>& expr) const {
+        checkSameShape(*this, expr.self());
+        const Matrix<value_type> values(expr);
+        for (int r = 0; r < rows_; r++)
+            for (int c = 0; c < cols_; c++)
+                (*this)(r, c) = values.coeff(r, c);
+        return *this;
+    }
+
+    const MatrixView& operator=(const MatrixView& other) const {
+        return *this = static_cast<const MatrixExpr<MatrixView>&>(other);
+    }
+
+    T* data() const {
+        return data_;
+    }
+    int rowStride() const {
+        return rowStride_;
+    }
+    int colStride() const {
+        return colStride_;
+    }
+
+private:
+    T* data_;
+    int rows_;
+    int cols_;
+    int rowStride_;
+    int colStride_;
+
+    static void checkIndex(int index, int count) {
+        if (index < 0 || index >= count)
+            throw std::out_of_range("Index out of range");
+    }
+};
+
+template <class L, class R>
+MatrixSum<L, R> operator+(const MatrixExpr<L>& l, const MatrixExpr<R>& r) {
+    return MatrixSum<L, R>(l.self(), r.self());
+}
+
+template <class L, class R>
+MatrixDifference<L, R> operator-(const MatrixExpr<L>& l,
+                                 const MatrixExpr<R>& r) {
+    return MatrixDifference<L, R>(l.self(), r.self());
+}
+
+template <class E>
+MatrixScaled<E> operator*(const MatrixExpr<E>& e,
+                          typename E::value_type factor) {
+    return MatrixScaled<E>(e.self(), factor);
+}
+
+template <class E>
+MatrixScaled<E> operator*(typename E::value_type factor,
+                          const MatrixExpr<E>& e) {
+    return MatrixScaled<E>(e.self(), factor);
+}
+
+template <class E>
+MatrixScaled<E> operator-(const MatrixExpr<E>& e) {
+    return MatrixScaled<E>(e.self(), typename E::value_type(-1));
+}
+
+/// <summary>
+/// Materializes an expression, matrices are passed through untouched
+/// </summary>
+template <class E>
+Matrix<typename E::value_type> evaluate(const MatrixExpr<E>& e) {
+    return Matrix<typename E::value_type>(e);
+}
+
+template <class T, class A>
+const Matrix<T, A>& evaluate(const MatrixExpr<Matrix<T, A>>& e) {
+    return e.self();
+}
+
+/// <summary>
+/// Matrix product. Products are not fused: both sides are materialized
+/// (once) and handed to the blocked kernel.
+/// </summary>
+template <class L, class R>
+Matrix<typename L::value_type> operator*(const MatrixExpr<L>& l,
+                                         const MatrixExpr<R>& r) {
+    const auto& left = evaluate(l);
+    const auto& right = evaluate(r);
+    Matrix<typename L::value_type> result(right.dimx_, left.dimy_);
+    result.multiply(left, right, result);
+    return result;
+}
+
+/// <summary>
+/// A^T * A goes to the symmetric kernel, other products with a transposed
+/// matrix read it in place; the transpose is never built
+/// </summary>
+template <class T, class A>
+Matrix<T, A> operator*(const MatrixTransposed<Matrix<T, A>>& l,
+                       const Matrix<T, A>& r) {
+    if (&l.nested() == &r) return r.gram();
+    Matrix<T, A> result(0, 0);
+    Matrix<T, A>::multiply(true, l.nested(), false, r, result);
+    return result;
+}
+
+template <class T, class A>
+Matrix<T, A> operator*(const Matrix<T, A>& l,
+                       const MatrixTransposed<Matrix<T, A>>& r) {
+    Matrix<T, A> result(0, 0);
+    Matrix<T, A>::multiply(false, l, true, r.nested(), result);
+    return result;
+}
+
+template <class T, class A>
+Matrix<T, A> operator*(const MatrixTransposed<Matrix<T, A>>& l,
+                       const MatrixTransposed<Matrix<T, A>>& r) {
+    Matrix<T, A> result(0, 0);
+    Matrix<T, A>::multiply(true, l.nested(), true, r.nested(), result);
+    return result;
+}
+
+} // namespace matrices
@@ -0,0 +1,384 @@
+#include "matrixkernels.h"
+
+#include "parallel.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace matrices {
+namespace kernels {
+
+namespace {
+
+// cache blocks: an MC x KC block of A stays in L2, a KC x NR sliver of B in
+// L1, a KC x NC panel of B in L3
+const int MC = 96;
+const int KC = 256;
+const int NC = 2048;
+
+// Register-blocked micro kernels, one per instruction set, selected at run
+// time. Each computes C[MR x NR] += A panel * B panel, both packed, ldc is
+// the row stride of C.
+typedef void (*MicroKernel)(int kc, const double* a, const double* b,
+                            double* c, int ldc);
+
+template <int MR, int NR>
+void scalarKernel(int kc, const double* a, const double* b, double* c,
+                  int ldc) {
+    double acc[MR][NR] = {};
+    for (int p = 0; p < kc; p++) {
+        for (int r = 0; r < MR; r++)
+            for (int j = 0; j < NR; j++)
+                acc[r][j] += a[r] * b[j];
+        a += MR;
+        b += NR;
+    }
+    for (int r = 0; r < MR; r++)
+        for (int j = 0; j < NR; j++)
+            c[r * ldc + j] += acc[r][j];
+}
+
+#ifdef SIMD_HAVE_SSE42
+SIMD_TARGET_BEGIN("sse4.2")
+
+/// 4 x 4, two xmm registers per row
+void sse42Kernel(int kc, const double* a, const double* b, double* c,
+                 int ldc) {
+    __m128d c00 = _mm_setzero_pd(), c01 = _mm_setzero_pd();
+    __m128d c10 = _mm_setzero_pd(), c11 = _mm_setzero_pd();
+    __m128d c20 = _mm_setzero_pd(), c21 = _mm_setzero_pd();
+    __m128d c30 = _mm_setzero_pd(), c31 = _mm_setzero_pd();
+    for (int p = 0; p < kc; p++) {
+        const __m128d b0 = _mm_loadu_pd(b);
+        const __m128d b1 = _mm_loadu_pd(b + 2);
+        __m128d ar = _mm_set1_pd(a[0]);
+        c00 = _mm_add_pd(c00, _mm_mul_pd(ar, b0));
+        c01 = _mm_add_pd(c01, _mm_mul_pd(ar, b1));
+        ar = _mm_set1_pd(a[1]);
+        c10 = _mm_add_pd(c10, _mm_mul_pd(ar, b0));
+        c11 = _mm_add_pd(c11, _mm_mul_pd(ar, b1));
+        ar = _mm_set1_pd(a[2]);
+        c20 = _mm_add_pd(c20, _mm_mul_pd(ar, b0));
+        c21 = _mm_add_pd(c21, _mm_mul_pd(ar, b1));
+        ar = _mm_set1_pd(a[3]);
+        c30 = _mm_add_pd(c30, _mm_mul_pd(ar, b0));
+        c31 = _mm_add_pd(c31, _mm_mul_pd(ar, b1));
+        a += 4;
+        b += 4;
+    }
+    double* c0 = c;
+    double* c1 = c + ldc;
+    double* c2 = c + 2 * ldc;
+    double* c3 = c + 3 * ldc;
+    _mm_storeu_pd(c0, _mm_add_pd(_mm_loadu_pd(c0), c00));
+    _mm_storeu_pd(c0 + 2, _mm_add_pd(_mm_loadu_pd(c0 + 2), c01));
+    _mm_storeu_pd(c1, _mm_add_pd(_mm_loadu_pd(c1), c10));
+    _mm_storeu_pd(c1 + 2, _mm_add_pd(_mm_loadu_pd(c1 + 2), c11));
+    _mm_storeu_pd(c2, _mm_add_pd(_mm_loadu_pd(c2), c20));
+    _mm_storeu_pd(c2 + 2, _mm_add_pd(_mm_loadu_pd(c2 + 2), c21));
+    _mm_storeu_pd(c3, _mm_add_pd(_mm_loadu_pd(c3), c30));
+    _mm_storeu_pd(c3 + 2, _mm_add_pd(_mm_loadu_pd(c3 + 2), c31));
+}
+
+SIMD_TARGET_END
+#endif
+
+#ifdef SIMD_HAVE_AVX2
+SIMD_TARGET_BEGIN("avx2,fma")
+
+/// 4 x 8, two ymm registers per row
+void avx2Kernel(int kc, const double* a, const double* b, double* c,
+                int ldc) {
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+    for (int p = 0; p < kc; p++) {
+        const __m256d b0 = _mm256_loadu_pd(b);
+        const __m256d b1 = _mm256_loadu_pd(b + 4);
+        __m256d ar = _mm256_broadcast_sd(a);
+        c00 = _mm256_fmadd_pd(ar, b0, c00);
+        c01 = _mm256_fmadd_pd(ar, b1, c01);
+        ar = _mm256_broadcast_sd(a + 1);
+        c10 = _mm256_fmadd_pd(ar, b0, c10);
+        c11 = _mm256_fmadd_pd(ar, b1, c11);
+        ar = _mm256_broadcast_sd(a + 2);
+        c20 = _mm256_fmadd_pd(ar, b0, c20);
+        c21 = _mm256_fmadd_pd(ar, b1, c21);
+        ar = _mm256_broadcast_sd(a + 3);
+        c30 = _mm256_fmadd_pd(ar, b0, c30);
+        c31 = _mm256_fmadd_pd(ar, b1, c31);
+        a += 4;
+        b += 8;
+    }
+    double* c0 = c;
+    double* c1 = c + ldc;
+    double* c2 = c + 2 * ldc;
+    double* c3 = c + 3 * ldc;
+    _mm256_storeu_pd(c0, _mm256_add_pd(_mm256_loadu_pd(c0), c00));
+    _mm256_storeu_pd(c0 + 4, _mm256_add_pd(_mm256_loadu_pd(c0 + 4), c01));
+    _mm256_storeu_pd(c1, _mm256_add_pd(_mm256_loadu_pd(c1), c10));
+    _mm256_storeu_pd(c1 + 4, _mm256_add_pd(_mm256_loadu_pd(c1 + 4), c11));
+    _mm256_storeu_pd(c2, _mm256_add_pd(_mm256_loadu_pd(c2), c20));
+    _mm256_storeu_pd(c2 + 4, _mm256_add_pd(_mm256_loadu_pd(c2 + 4), c21));
+    _mm256_storeu_pd(c3, _mm256_add_pd(_mm256_loadu_pd(c3), c30));
+    _mm256_storeu_pd(c3 + 4, _mm256_add_pd(_mm256_loadu_pd(c3 + 4), c31));
+}
+
+SIMD_TARGET_END
+#endif
+
+#ifdef SIMD_HAVE_AVX512
+SIMD_TARGET_BEGIN("avx512f")
+
+/// 4 x 16, two zmm registers per row
+void avx512Kernel(int kc, const double* a, const double* b, double* c,
+                  int ldc) {
+    __m512d c00 = _mm512_setzero_pd(), c01 = _mm512_setzero_pd();
+    __m512d c10 = _mm512_setzero_pd(), c11 = _mm512_setzero_pd();
+    __m512d c20 = _mm512_setzero_pd(), c21 = _mm512_setzero_pd();
+    __m512d c30 = _mm512_setzero_pd(), c31 = _mm512_setzero_pd();
+    for (int p = 0; p < kc; p++) {
+        const __m512d b0 = _mm512_loadu_pd(b);
+        const __m512d b1 = _mm512_loadu_pd(b + 8);
+        __m512d ar = _mm512_set1_pd(a[0]);
+        c00 = _mm512_fmadd_pd(ar, b0, c00);
+        c01 = _mm512_fmadd_pd(ar, b1, c01);
+        ar = _mm512_set1_pd(a[1]);
+        c10 = _mm512_fmadd_pd(ar, b0, c10);
+        c11 = _mm512_fmadd_pd(ar, b1, c11);
+        ar = _mm512_set1_pd(a[2]);
+        c20 = _mm512_fmadd_pd(ar, b0, c20);
+        c21 = _mm512_fmadd_pd(ar, b1, c21);
+        ar = _mm512_set1_pd(a[3]);
+        c30 = _mm512_fmadd_pd(ar, b0, c30);
+        c31 = _mm512_fmadd_pd(ar, b1, c31);
+        a += 4;
+        b += 16;
+    }
+    double* c0 = c;
+    double* c1 = c + ldc;
+    double* c2 = c + 2 * ldc;
+    double* c3 = c + 3 * ldc;
+    _mm512_storeu_pd(c0, _mm512_add_pd(_mm512_loadu_pd(c0), c00));
+    _mm512_storeu_pd(c0 + 8, _mm512_add_pd(_mm512_loadu_pd(c0 + 8), c01));
+    _mm512_storeu_pd(c1, _mm512_add_pd(_mm512_loadu_pd(c1), c10));
+    _mm512_storeu_pd(c1 + 8, _mm512_add_pd(_mm512_loadu_pd(c1 + 8), c11));
+    _mm512_storeu_pd(c2, _mm512_add_pd(_mm512_loadu_pd(c2), c20));
+    _mm512_storeu_pd(c2 + 8, _mm512_add_pd(_mm512_loadu_pd(c2 + 8), c21));
+    _mm512_storeu_pd(c3, _mm512_add_pd(_mm512_loadu_pd(c3), c30));
+    _mm512_storeu_pd(c3 + 8, _mm512_add_pd(_mm512_loadu_pd(c3 + 8), c31));
+}
+
+SIMD_TARGET_END
+#endif
+
+/// packs an mc x kc block of op(A) into MR-row slivers, zero padded.
+/// op(A) is A, or A^T when transA is set.
+template <int MR>
+void packA(bool transA, int mc, int kc, const double* a, int lda, int i0,
+           int p0, int m, double* buffer) {
+    for (int ir = 0; ir < mc; ir += MR) {
+        for (int p = 0; p < kc; p++) {
+            for (int r = 0; r < MR; r++) {
+                const int i = i0 + ir + r;
+                double value = 0.0;
+                if (i < m)
+                    value = transA ? a[(p0 + p) * lda + i]
+                                   : a[i * lda + p0 + p];
+                *buffer++ = value;
+            }
+        }
+    }
+}
+
+/// packs a kc x nc panel of op(B) into NR-column slivers, zero padded.
+/// op(B) is B, or B^T when transB is set.
+template <int NR>
+void packB(bool transB, int kc, int nc, const double* b, int ldb, int p0,
+           int j0, int n, double* buffer) {
+    for (int jr = 0; jr < nc; jr += NR) {
+        for (int p = 0; p < kc; p++) {
+            for (int j = 0; j < NR; j++) {
+                const int col = j0 + jr + j;
+                double value = 0.0;
+                if (col < n)
+                    value = transB ? b[col * ldb + p0 + p]
+                                   : b[(p0 + p) * ldb + col];
+                *buffer++ = value;
+            }
+        }
+    }
+}
+
+/// C = op(A) * op(B), op(A) is m x k. With upperOnly, tiles strictly below
+/// the diagonal of C are skipped.
+template <int MR, int NR, MicroKernel microKernel>
+void gemmImpl(bool transA, bool transB, bool upperOnly, int m, int n, int k,
+              const double* a, int lda, const double* b, int ldb, double* c,
+              int ldc) {
+    for (int i = 0; i < m; i++)
+        std::fill(c + i * ldc, c + i * ldc + n, 0.0);
+    if (m == 0 || n == 0 || k == 0) return;
+
+    // grown once per thread instead of allocated on every product
+    thread_local std::vector<double> packedA;
+    thread_local std::vector<double> packedB;
+    packedA.resize(std::max<size_t>(packedA.size(), MC * KC));
+    packedB.resize(
+        std::max<size_t>(packedB.size(), KC * (std::min(NC, n) + NR)));
+    double edge[MR * NR];
+
+    for (int jc = 0; jc < n; jc += NC) {
+        const int nc = std::min(NC, n - jc);
+        for (int pc = 0; pc < k; pc += KC) {
+            const int kc = std::min(KC, k - pc);
+            packB<NR>(transB, kc, nc, b, ldb, pc, jc, n, packedB.data());
+            for (int ic = 0; ic < m; ic += MC) {
+                const int mc = std::min(MC, m - ic);
+                if (upperOnly && ic >= jc + nc) break;
+                packA<MR>(transA, mc, kc, a, lda, ic, pc, m, packedA.data());
+                for (int jr = 0; jr < nc; jr += NR) {
+                    const int j0 = jc + jr;
+                    const int nr = std::min(NR, n - j0);
+                    for (int ir = 0; ir < mc; ir += MR) {
+                        const int i0 = ic + ir;
+                        if (upperOnly && j0 + NR <= i0) continue;
+                        const int mr = std::min(MR, m - i0);
+                        const double* pa = packedA.data() + ir * kc;
+                        const double* pb = packedB.data() + jr * kc;
+                        if (mr == MR && nr == NR) {
+                            microKernel(kc, pa, pb, c + i0 * ldc + j0, ldc);
+                        } else {
+                            std::fill(edge, edge + MR * NR, 0.0);
+                            microKernel(kc, pa, pb, edge, NR);
+                            for (int r = 0; r < mr; r++)
+                                for (int j = 0; j < nr; j++)
+                                    c[(i0 + r) * ldc + j0 + j] +=
+                                        edge[r * NR + j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+typedef void (*GemmImpl)(bool transA, bool transB, bool upperOnly, int m,
+                         int n, int k, const double* a, int lda,
+                         const double* b, int ldb, double* c, int ldc);
+
+/// gemmImpl for one micro kernel, with its register block
+struct Variant {
+    GemmImpl run;
+    int MR;
+    int NR;
+};
+
+Variant select(simd::Level level) {
+    switch (level) {
+#ifdef SIMD_HAVE_AVX512
+    case simd::AVX512:
+        return {gemmImpl<4, 16, avx512Kernel>, 4, 16};
+#endif
+#ifdef SIMD_HAVE_AVX2
+    case simd::AVX2:
+        return {gemmImpl<4, 8, avx2Kernel>, 4, 8};
+#endif
+#ifdef SIMD_HAVE_SSE42
+    case simd::SSE42:
+        return {gemmImpl<4, 4, sse42Kernel>, 4, 4};
+#endif
+    default:
+        return {gemmImpl<4, 4, scalarKernel<4, 4>>, 4, 4};
+    }
+}
+
+/// chosen on the first product, see simd::active()
+const Variant& variant() {
+    static const Variant chosen = select(simd::active());
+    return chosen;
+}
+
+bool worthSplitting(double multiplies) {
+    return multiplies >= parallelMultiplies && parallel::threadCount() > 1;
+}
+
+/// gemmImpl split into bands of C along its longer side, in whole register
+/// blocks. Every band packs its own operands and sums over k in the same
+/// order as the serial loop, so the result is the same bit for bit.
+void gemmParallel(bool transA, bool transB, int m, int n, int k,
+                  const double* a, int lda, const double* b, int ldb,
+                  double* c, int ldc) {
+    const Variant& v = variant();
+    if (!worthSplitting(static_cast<double>(m) * n * k)) {
+        v.run(transA, transB, false, m, n, k, a, lda, b, ldb, c, ldc);
+        return;
+    }
+    const int MR = v.MR;
+    const int NR = v.NR;
+    if (m >= n) {
+        parallel::forChunks((m + MR - 1) / MR, [&](int begin, int end, int) {
+            const int i0 = begin * MR;
+            const int rows = std::min(end * MR, m) - i0;
+            v.run(transA, transB, false, rows, n, k,
+                  transA ? a + i0 : a + i0 * lda, lda, b, ldb, c + i0 * ldc,
+                  ldc);
+        });
+    } else {
+        parallel::forChunks((n + NR - 1) / NR, [&](int begin, int end, int) {
+            const int j0 = begin * NR;
+            const int cols = std::min(end * NR, n) - j0;
+            v.run(transA, transB, false, m, cols, k, a, lda,
+                  transB ? b + j0 * ldb : b + j0, ldb, c + j0, ldc);
+        });
+    }
+}
+
+} // namespace
+
+void gemm(int m, int n, int k, const double* a, int lda, const double* b,
+          int ldb, double* c, int ldc) {
+    gemmParallel(false, false, m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+void gemm(bool transA, bool transB, int m, int n, int k, const double* a,
+          int lda, const double* b, int ldb, double* c, int ldc) {
+    gemmParallel(transA, transB, m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+void syrk(int m, int n, const double* a, int lda, double* c, int ldc) {
+    // A^T is n x m and read in place by packA
+    const Variant& v = variant();
+    if (!worthSplitting(static_cast<double>(m) * n * n / 2)) {
+        v.run(true, false, true, n, n, m, a, lda, a, lda, c, ldc);
+    } else {
+        const int MR = v.MR;
+        // band [r0, r1) computes its upper part, rows r0.. from column r0
+        // on: the same triangular job, shifted along the diagonal. Bounds
+        // give every band the same share of the triangle.
+        const int bands = parallel::threadCount();
+        const auto bound = [&](int band) {
+            const double share = static_cast<double>(band) / bands;
+            const int row = static_cast<int>(n - n * std::sqrt(1.0 - share));
+            return std::min((row + MR - 1) / MR * MR, n);
+        };
+        parallel::forChunks(bands, [&](int begin, int end, int) {
+            for (int band = begin; band < end; band++) {
+                const int r0 = bound(band);
+                const int r1 = band + 1 == bands ? n : bound(band + 1);
+                if (r1 <= r0) continue;
+                v.run(true, false, true, r1 - r0, n - r0, m, a + r0, lda,
+                      a + r0, lda, c + r0 * ldc + r0, ldc);
+            }
+        });
+    }
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < i; j++)
+            c[i * ldc + j] = c[j * ldc + i];
+}
+
+} // namespace kernels
+} // namespace matrices
@@ -0,0 +1,170 @@
+#pragma once
+#include <utility>
+
+namespace matrices {
+namespace kernels {
+
+// Smaller jobs run on the calling thread, waking the thread pool would cost
+// more than it saves. Larger ones are split over parallel::forChunks into
+// disjoint blocks of the output, each computed exactly as the serial code
+// would, so the result does not depend on the thread count.
+const int parallelElements = 1 << 16;  // element-wise loops
+const double parallelMultiplies = 1 << 18; // products, 64^3
+
+/// <summary>
+/// C = A * B for row-major double matrices. A is m x k, B is k x n and C is
+/// m x n. Cache-tiled and packed, with a register-blocked micro kernel for
+/// the instruction set of the CPU (see simd.h). Large products are split
+/// over the thread pool by row or column blocks of C.
+/// </summary>
+/// <param name="lda">Distance in elements between two rows of A</param>
+/// <param name="ldb">Distance in elements between two rows of B</param>
+/// <param name="ldc">Distance in elements between two rows of C</param>
+void gemm(int m, int n, int k, const double* a, int lda, const double* b,
+          int ldb, double* c, int ldc);
+
+/// <summary>
+/// C = op(A) * op(B), op(A) is m x k and op(B) is k x n. With transA, A is
+/// stored as its k x m transpose, with transB, B as its n x k transpose;
+/// the transposes are read in place while packing.
+/// </summary>
+void gemm(bool transA, bool transB, int m, int n, int k, const double* a,
+          int lda, const double* b, int ldb, double* c, int ldc);
+
+/// <summary>
+/// C = A^T * A for a row-major m x n double matrix A, C is n x n.
+/// The transpose is never materialized and only the upper triangle is
+/// computed before being mirrored. Large products are split over the thread
+/// pool into row bands holding the same share of the triangle.
+/// </summary>
+void syrk(int m, int n, const double* a, int lda, double* c, int ldc);
+
+/// <summary>
+/// Generic C = A * B for element types without a dedicated kernel
+/// </summary>
+template <class T>
+void gemm(int m, int n, int k, const T* a, int lda, const T* b, int ldb, T* c,
+          int ldc) {
+    for (int i = 0; i < m; i++) {
+        T* rowC = c + i * ldc;
+        for (int j = 0; j < n; j++)
+            rowC[j] = T(0);
+        for (int p = 0; p < k; p++) {
+            const T aip = a[i * lda + p];
+            const T* rowB = b + p * ldb;
+            for (int j = 0; j < n; j++)
+                rowC[j] += aip * rowB[j];
+        }
+    }
+}
+
+/// <summary>
+/// Generic C = op(A) * op(B) for element types without a dedicated kernel
+/// </summary>
+template <class T>
+void gemm(bool transA, bool transB, int m, int n, int k, const T* a, int lda,
+          const T* b, int ldb, T* c, int ldc) {
+    for (int i = 0; i < m; i++) {
+        T* rowC = c + i * ldc;
+        for (int j = 0; j < n; j++) {
+            T sum = T(0);
+            for (int p = 0; p < k; p++)
+                sum += (transA ? a[p * lda + i] : a[i * lda + p]) *
+                    (transB ? b[j * ldb + p] : b[p * ldb + j]);
+            rowC[j] = sum;
+        }
+    }
+}
+
+/// <summary>
+/// Generic C = A^T * A for element types without a dedicated kernel
+/// </summary>
+template <class T>
+void syrk(int m, int n, const T* a, int lda, T* c, int ldc) {
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+            c[i * ldc + j] = T(0);
+    for (int p = 0; p < m; p++) {
+        const T* row = a + p * lda;
+        for (int i = 0; i < n; i++) {
+            const T api = row[i];
+            for (int j = i; j < n; j++)
+                c[i * ldc + j] += api * row[j];
+        }
+    }
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < i; j++)
+            c[i * ldc + j] = c[j * ldc + i];
+}
+
+// blocks at most this wide are transposed directly, 2 x 16 x 16 doubles
+// fit in L1 with room to spare
+const int transposeLeaf = 16;
+
+/// <summary>
+/// dst = src^T for a row-major rows x cols src. Cache-oblivious: the longer
+/// side is halved until both blocks fit in L1, whatever the cache sizes.
+/// </summary>
+/// <param name="lds">Distance in elements between two rows of src</param>
+/// <param name="ldd">Distance in elements between two rows of dst</param>
+template <class T>
+void transpose(int rows, int cols, const T* src, int lds, T* dst, int ldd) {
+    if (rows <= transposeLeaf && cols <= transposeLeaf) {
+        for (int r = 0; r < rows; r++)
+            for (int c = 0; c < cols; c++)
+                dst[c * ldd + r] = src[r * lds + c];
+    } else if (rows >= cols) {
+        const int half = rows / 2;
+        transpose(half, cols, src, lds, dst, ldd);
+        transpose(rows - half, cols, src + half * lds, lds, dst + half, ldd);
+    } else {
+        const int half = cols / 2;
+        transpose(rows, half, src, lds, dst, ldd);
+        transpose(rows, cols - half, src + half, lds, dst + half * ldd, ldd);
+    }
+}
+
+/// <summary>
+/// Swaps the rows x cols block upper with the transpose of the cols x rows
+/// block lower, both in the same row-major matrix
+/// </summary>
+template <class T>
+void swapTransposed(int rows, int cols, T* upper, T* lower, int ld) {
+    if (rows <= transposeLeaf && cols <= transposeLeaf) {
+        for (int r = 0; r < rows; r++)
+            for (int c = 0; c < cols; c++)
+                std::swap(upper[r * ld + c], lower[c * ld + r]);
+    } else if (rows >= cols) {
+        const int half = rows / 2;
+        swapTransposed(half, cols, upper, lower, ld);
+        swapTransposed(rows - half, cols, upper + half * ld, lower + half,
+                       ld);
+    } else {
+        const int half = cols / 2;
+        swapTransposed(rows, half, upper, lower, ld);
+        swapTransposed(rows, cols - half, upper + half, lower + half * ld,
+                       ld);
+    }
+}
+
+/// <summary>
+/// Transposes a row-major n x n matrix in place, cache-obliviously: both
+/// diagonal quarters recurse, the off-diagonal ones are swapped.
+/// </summary>
+template <class T>
+void transposeInPlace(int n, T* a, int lda) {
+    if (n <= 1) return;
+    if (n <= transposeLeaf) {
+        for (int r = 0; r < n; r++)
+            for (int c = r + 1; c < n; c++)
+                std::swap(a[r * lda + c], a[c * lda + r]);
+        return;
+    }
+    const int half = n / 2;
+    transposeInPlace(half, a, lda);
+    transposeInPlace(n - half, a + half * lda + half, lda);
+    swapTransposed(half, n - half, a + half, a + half * lda, lda);
+}
+
+} // namespace kernels
+} // namespace matrices
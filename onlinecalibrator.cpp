@@ -0,0 +1,60 @@
+#include "onlinecalibrator.h"
+
+OnlineCalibrator::OnlineCalibrator()
+    : middle(1),
+      write_index(0),
+      read_index(2) {
+}
+
+void OnlineCalibrator::clear() {
+    working = Snapshot();
+    for (int i = 0; i < 3; ++i) {
+        buffers[i] = Snapshot();
+    }
+    middle.store(1);
+    write_index = 0;
+    read_index = 2;
+}
+
+void OnlineCalibrator::add_acc(double x, double y, double z) {
+    working.acc.add(x, y, z);
+    working.acc_quadric.add(x, y, z);
+}
+
+void OnlineCalibrator::add_magn(double x, double y, double z) {
+    working.magn.add(x, y, z);
+    working.magn_quadric.add(x, y, z);
+}
+
+void OnlineCalibrator::publish() {
+    buffers[write_index] = working;
+    write_index =
+        middle.exchange(write_index | dirty, std::memory_order_acq_rel) & 3;
+}
+
+void OnlineCalibrator::add_gyro(double x, double y, double z, double ax,
+                                double ay, double az) {
+    const double gyro[3] = {x, y, z};
+    const double acc[3] = {ax, ay, az};
+    working.gyro.add(gyro, acc);
+    working.six_position.add(gyro, acc);
+}
+
+void OnlineCalibrator::set_sample_rate(double hz) {
+    working.gyro.set_sample_rate(hz);
+}
+
+OnlineCalibrator::Snapshot OnlineCalibrator::snapshot() {
+    if (middle.load(std::memory_order_acquire) & dirty) {
+        read_index = middle.exchange(read_index, std::memory_order_acq_rel) & 3;
+    }
+    return buffers[read_index];
+}
+
+QPair<QVector<long>, QVector<double>> OnlineCalibrator::acc_params() {
+    return CalLib::calibrate(snapshot().acc);
+}
+
+QPair<QVector<long>, QVector<double>> OnlineCalibrator::magn_params() {
+    return CalLib::calibrate(snapshot().magn);
+}
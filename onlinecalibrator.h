@@ -0,0 +1,60 @@
+#ifndef ONLINECALIBRATOR_H
+#define ONLINECALIBRATOR_H
+
+#include "callib.h"
+#include "gyrocalibrator.h"
+#include "sixposition.h"
+#include <QPair>
+#include <QVector>
+#include <atomic>
+
+// Incremental acc/magn ellipsoid and gyro bias estimator fed sample by
+// sample from SerialWorker::run. The worker owns the running moments and
+// publishes a copy through a triple buffer after every burst, so the GUI
+// thread can read the latest estimate at any time without ever blocking the
+// worker.
+class OnlineCalibrator {
+public:
+    struct Snapshot {
+        EllipsoidMoments acc;
+        EllipsoidMoments magn;
+        QuadricMoments acc_quadric;
+        QuadricMoments magn_quadric;
+        GyroCalibrator gyro;
+        SixPositionCalibrator six_position;
+    };
+
+    OnlineCalibrator();
+
+    // must not be called while a worker is feeding samples
+    void clear();
+
+    // worker thread only
+    void add_acc(double x, double y, double z);
+    void add_magn(double x, double y, double z);
+    // the acc reading of the same frame tells whether the board is at rest,
+    // it also feeds the six-position poses
+    void add_gyro(double x, double y, double z, double ax, double ay,
+                  double az);
+    void set_sample_rate(double hz);
+    void publish();
+
+    // single reader (the GUI thread), O(1) in the number of samples
+    Snapshot snapshot();
+    QPair<QVector<long>, QVector<double>> acc_params();
+    QPair<QVector<long>, QVector<double>> magn_params();
+
+private:
+    static const unsigned dirty = 4;
+
+    Snapshot working;
+    Snapshot buffers[3];
+    // index of the buffer handed over between writer and reader, with the
+    // dirty bit set when the writer published something the reader hasn't
+    // picked up yet
+    std::atomic<unsigned> middle;
+    unsigned write_index;
+    unsigned read_index;
+};
+
+#endif // ONLINECALIBRATOR_H
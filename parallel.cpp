@@ -0,0 +1,171 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+
+namespace {
+
+std::atomic<int> maxThreads(0);
+
+int hardwareThreads() {
+    const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+    return hardware < 1 ? 1 : hardware;
+}
+
+// One loop in flight: its chunks are claimed in order by the thread that
+// started it and by any idle worker
+struct Loop {
+    const std::function<void(int)>* job;
+    int chunks;
+    int next;     // first unclaimed chunk
+    int finished; // chunks done
+};
+
+// Workers are started once and sleep between loops, so a parallel loop
+// costs a wake-up instead of a thread creation. Loops started at the same
+// time, from several threads or from inside a chunk, share the workers:
+// each idle worker claims a chunk of the next loop with chunks left, in
+// turn. A thread waiting for its loop runs its first chunk and then only
+// chunks of that loop, so it never waits on work queued after its own and
+// loops can't deadlock.
+class Pool {
+public:
+    static Pool& instance() {
+        static Pool pool;
+        return pool;
+    }
+
+    ~Pool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    void run(int chunks, const std::function<void(int)>& job) {
+        // chunk 0 is the caller's before the workers see the loop, so a
+        // thread that starts a loop always runs part of it
+        Loop loop = {&job, chunks, 1, 0};
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            start(chunks - 1);
+            loops.push_back(&loop);
+        }
+        // every idle worker looks, some may be on their way to another loop
+        wake.notify_all();
+
+        int chunk = 0;
+        for (;;) {
+            execute(loop, chunk);
+            std::lock_guard<std::mutex> guard(lock);
+            if (loop.next == chunks) break;
+            chunk = claim(loop);
+        }
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&]() { return loop.finished == chunks; });
+    }
+
+private:
+    std::mutex lock; // guards everything below and the loops
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::vector<std::thread> workers;
+    std::vector<Loop*> loops; // with unclaimed chunks, oldest first
+    size_t turn = 0;          // of the loop the next idle worker serves
+    bool stopping = false;
+
+    void start(int needed) {
+        needed = std::min(needed, hardwareThreads() - 1);
+        while (static_cast<int>(workers.size()) < needed)
+            workers.emplace_back(&Pool::serve, this);
+    }
+
+    // under lock, a loop leaves the list with its last chunk
+    int claim(Loop& loop) {
+        const int chunk = loop.next++;
+        if (loop.next == loop.chunks)
+            loops.erase(std::find(loops.begin(), loops.end(), &loop));
+        return chunk;
+    }
+
+    void execute(Loop& loop, int chunk) {
+        (*loop.job)(chunk);
+        std::lock_guard<std::mutex> guard(lock);
+        // the starting thread returns, and loop goes away, once it sees
+        // the last chunk done under the lock
+        if (++loop.finished == loop.chunks) done.notify_all();
+    }
+
+    void serve() {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            wake.wait(guard, [&]() { return stopping || !loops.empty(); });
+            if (stopping) return;
+            Loop& loop = *loops[turn++ % loops.size()];
+            const int chunk = claim(loop);
+            guard.unlock();
+            execute(loop, chunk);
+            guard.lock();
+        }
+    }
+};
+
+} // namespace
+
+int threadCount() {
+    const int hardware = hardwareThreads();
+    const int cap = maxThreads.load();
+    return cap > 0 ? std::min(cap, hardware) : hardware;
+}
+
+void setMaxThreads(int count) {
+    maxThreads.store(std::max(count, 0));
+}
+
+int chunkCount(int count) {
+    return count > 0 ? std::min(threadCount(), count) : 0;
+}
+
+int forChunks(int count, int chunks,
+              const std::function<void(int, int, int)>& body) {
+    if (count <= 0 || chunks <= 0) return 0;
+    chunks = std::min(chunks, count);
+    if (chunks == 1) {
+        body(0, count, 0);
+        return 1;
+    }
+
+    // the bounds only depend on count and chunks, never on which thread
+    // runs a chunk
+    std::vector<std::exception_ptr> errors(chunks);
+    const std::function<void(int)> run = [&](int chunk) {
+        const int begin = static_cast<int>((long long) count * chunk / chunks);
+        const int end =
+            static_cast<int>((long long) count * (chunk + 1) / chunks);
+        try {
+            body(begin, end, chunk);
+        } catch (...) {
+            errors[chunk] = std::current_exception();
+        }
+    };
+    Pool::instance().run(chunks, run);
+    for (auto& error : errors)
+        if (error) std::rethrow_exception(error);
+    return chunks;
+}
+
+int forChunks(int count, const std::function<void(int, int, int)>& body) {
+    return forChunks(count, chunkCount(count), body);
+}
+
+} // namespace parallel
@@ -0,0 +1,44 @@
+#pragma once
+#include <functional>
+
+namespace parallel {
+
+/// <summary>
+/// Number of threads the parallel loops run on
+/// </summary>
+int threadCount();
+
+/// <summary>
+/// Caps the number of threads, e.g. to leave headroom for the GUI.
+/// 0 restores the hardware concurrency.
+/// </summary>
+void setMaxThreads(int count);
+
+/// <summary>
+/// Number of chunks forChunks(count, body) splits [0, count) into, at most
+/// one per thread. Per-chunk partials are sized from it and the same value
+/// passed on to forChunks, as threadCount() may change in between.
+/// </summary>
+int chunkCount(int count);
+
+/// <summary>
+/// Splits [0, count) into min(chunks, count) contiguous chunks and runs
+/// body(begin, end, chunk) on each of them. The chunks run on a pool of
+/// persistent workers and the calling thread. Loops started from several
+/// threads at once or from inside a chunk share the workers. The bounds
+/// only depend on count and chunks.
+/// Returns once every chunk is done, rethrowing the first exception a
+/// chunk threw.
+/// </summary>
+/// <returns>The number of chunks used</returns>
+int forChunks(int count, int chunks,
+              const std::function<void(int, int, int)>& body);
+
+/// <summary>
+/// forChunks(count, chunkCount(count), body), for loops without per-chunk
+/// state
+/// </summary>
+/// <returns>The number of chunks used</returns>
+int forChunks(int count, const std::function<void(int, int, int)>& body);
+
+} // namespace parallel
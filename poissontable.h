@@ -0,0 +1,51 @@
+#ifndef POISSONTABLE_H
+#define POISSONTABLE_H
+
+#include <cmath>
+#include <vector>
+
+// Poisson(1) counts indexed by a 16-bit uniform draw, so a 64-bit draw
+// weighs four samples with four table lookups. The 1/65536 quantization of
+// the probabilities is far below the Monte Carlo error of the bootstrap
+// replicates that use it.
+class PoissonTable {
+public:
+    static const int size = 1 << 16;
+
+    PoissonTable() : counts(size) {
+        double p = std::exp(-1.0);
+        double cdf = p;
+        int k = 0;
+        for (int u = 0; u < size; ++u) {
+            while ((u + 0.5) / size > cdf && k < 255) {
+                p /= ++k;
+                cdf += p;
+            }
+            counts[u] = static_cast<unsigned char>(k);
+        }
+    }
+
+    // the count drawn for the 16-bit uniform value u
+    unsigned char operator[](int u) const { return counts[u]; }
+
+    // fills copies with n independent counts
+    template <class Generator>
+    void draw(Generator& rng, unsigned char* copies, int n) const {
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const unsigned long long u = rng();
+            copies[i] = counts[u & 0xffff];
+            copies[i + 1] = counts[(u >> 16) & 0xffff];
+            copies[i + 2] = counts[(u >> 32) & 0xffff];
+            copies[i + 3] = counts[u >> 48];
+        }
+        for (unsigned long long u = rng(); i < n; ++i, u >>= 16) {
+            copies[i] = counts[u & 0xffff];
+        }
+    }
+
+private:
+    std::vector<unsigned char> counts;
+};
+
+#endif // POISSONTABLE_H
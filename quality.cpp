@@ -0,0 +1,115 @@
+#include "callib.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+// largest sine of the elevation that still falls in the top bins
+const double below_one = 1 - 1e-15;
+
+// residuals are binned over +-max_residual of the radius
+const int residual_bins = 60;
+const double max_residual = 0.3;
+// 36 x 18 equal-area direction bins, about 10 degrees wide at the equator
+const int azimuth_bins = 36;
+const int elevation_bins = 18;
+
+struct Partial {
+    Histogram1D residuals;
+    Histogram2D directions;
+    EllipsoidMoments moments;
+    double squares;
+    double axis_squares[3];
+    double max_deviation;
+    long samples;
+};
+
+Partial empty_partial() {
+    Partial p = {Histogram1D(residual_bins, -max_residual, max_residual),
+                 Histogram2D(azimuth_bins, -pi, pi, elevation_bins, -1, 1),
+                 EllipsoidMoments(),
+                 0,
+                 {0, 0, 0},
+                 0,
+                 0};
+    return p;
+}
+
+} // namespace
+
+CalibrationQuality CalLib::quality(const QVector<double>& x,
+                                   const QVector<double>& y,
+                                   const QVector<double>& z,
+                                   const EllipsoidCalibration& calibration) {
+    const int n = x.size();
+    const double* o = calibration.offset.data_;
+    const double* m = calibration.correction.data_;
+
+    // one pass: every thread fills its own partial sums and histograms,
+    // they are merged in chunk order afterwards
+    const int chunks = parallel::chunkCount(n);
+    std::vector<Partial> partials(chunks, empty_partial());
+    parallel::forChunks(n, chunks, [&](int begin, int end, int c) {
+        Partial& p = partials[c];
+        for (int i = begin; i < end; i++) {
+            p.moments.add(x[i], y[i], z[i]);
+            const double dx = x[i] - o[0];
+            const double dy = y[i] - o[1];
+            const double dz = z[i] - o[2];
+            const double cx = m[0] * dx + m[1] * dy + m[2] * dz;
+            const double cy = m[3] * dx + m[4] * dy + m[5] * dz;
+            const double cz = m[6] * dx + m[7] * dy + m[8] * dz;
+            const double norm = std::sqrt(cx * cx + cy * cy + cz * cz);
+            const double r = norm - 1;
+            p.residuals.fill(r);
+            p.squares += r * r;
+            p.max_deviation = std::max(p.max_deviation, std::fabs(r));
+            p.samples++;
+            if (norm == 0) continue;
+            // c - c / |c| is the residual along the radius, per axis
+            const double shrink = r / norm;
+            p.axis_squares[0] += cx * cx * shrink * shrink;
+            p.axis_squares[1] += cy * cy * shrink * shrink;
+            p.axis_squares[2] += cz * cz * shrink * shrink;
+            // atan2 gives pi on the negative x axis, the same direction as
+            // -pi, and the poles would fall just past the top bins
+            const double azimuth = std::atan2(cy, cx);
+            p.directions.fill(azimuth < pi ? azimuth : -pi,
+                              std::max(-1.0, std::min(cz / norm, below_one)));
+        }
+    });
+
+    Partial total = empty_partial();
+    for (const Partial& p : partials) {
+        total.residuals.merge(p.residuals);
+        total.directions.merge(p.directions);
+        total.moments.merge(p.moments);
+        total.squares += p.squares;
+        for (int axis = 0; axis < 3; axis++)
+            total.axis_squares[axis] += p.axis_squares[axis];
+        total.max_deviation = std::max(total.max_deviation, p.max_deviation);
+        total.samples += p.samples;
+    }
+
+    CalibrationQuality quality = {total.samples,
+                                  0,
+                                  {0, 0, 0},
+                                  total.max_deviation,
+                                  total.moments.condition(),
+                                  0,
+                                  total.residuals,
+                                  total.directions};
+    if (total.samples > 0) {
+        quality.rms = std::sqrt(total.squares / total.samples);
+        for (int axis = 0; axis < 3; axis++)
+            quality.axis_rms[axis] =
+                std::sqrt(total.axis_squares[axis] / total.samples);
+        quality.coverage = double(total.directions.occupied()) /
+            (azimuth_bins * elevation_bins);
+    }
+    return quality;
+}
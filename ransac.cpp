@@ -0,0 +1,163 @@
+#include "callib.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+struct Hypothesis {
+    double offset[3];
+    double inverse_scale[3];
+    double cost;
+    int iteration;
+};
+
+// |(p - o) / s| - 1, the radial distance from the unit sphere once calibrated
+inline double radial_residual(const Hypothesis& h, double x, double y,
+                              double z) {
+    const double u = (x - h.offset[0]) * h.inverse_scale[0];
+    const double v = (y - h.offset[1]) * h.inverse_scale[1];
+    const double w = (z - h.offset[2]) * h.inverse_scale[2];
+    return std::sqrt(u * u + v * v + w * w) - 1;
+}
+
+bool better(const Hypothesis& a, const Hypothesis& b) {
+    // ties go to the lowest iteration so the result does not depend on how
+    // iterations were spread over threads
+    return a.cost < b.cost || (a.cost == b.cost && a.iteration < b.iteration);
+}
+
+bool fit(const EllipsoidMoments& moments, Hypothesis& h) {
+    double scale[3];
+    if (!moments.solve_ellipsoid(h.offset, scale)) return false;
+    for (int i = 0; i < 3; ++i) {
+        h.inverse_scale[i] = 1 / scale[i];
+    }
+    return true;
+}
+
+// per-axis range of the samples without the outer percent on each side,
+// so that a few saturated frames don't stretch it
+void robust_range(const QVector<double>& values, double& low, double& high) {
+    std::vector<double> sorted(values.begin(), values.end());
+    const int trim = static_cast<int>(sorted.size() / 100);
+    std::nth_element(sorted.begin(), sorted.begin() + trim, sorted.end());
+    low = sorted[trim];
+    std::nth_element(sorted.begin() + trim, sorted.end() - 1 - trim,
+                     sorted.end());
+    high = sorted[sorted.size() - 1 - trim];
+}
+
+// minimal subsets often give huge, flat ellipsoids whose surface passes
+// close to every sample; reject the ones that don't match the data extent
+bool plausible(const Hypothesis& h, const double min[3], const double max[3]) {
+    for (int i = 0; i < 3; ++i) {
+        const double extent = max[i] - min[i];
+        const double scale = 1 / h.inverse_scale[i];
+        if (h.offset[i] < min[i] || h.offset[i] > max[i]) return false;
+        if (scale > extent || scale < extent / 8) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+RansacResult CalLib::calibrate_ransac(const QVector<double>& x,
+                                      const QVector<double>& y,
+                                      const QVector<double>& z,
+                                      const RansacOptions& options) {
+    const int n = x.size();
+    const int minimal = EllipsoidMoments::unknowns;
+    if (n < minimal)
+        throw std::runtime_error("Not enough samples to fit an ellipsoid");
+
+    double min[3], max[3];
+    robust_range(x, min[0], max[0]);
+    robust_range(y, min[1], max[1]);
+    robust_range(z, min[2], max[2]);
+
+    const double t = options.threshold;
+    Hypothesis best;
+    best.cost = std::numeric_limits<double>::infinity();
+    best.iteration = -1;
+    std::mutex best_mutex;
+
+    // hypotheses are independent, each thread draws and scores a contiguous
+    // range of them and keeps its best
+    parallel::forChunks(options.iterations, [&](int begin, int end, int) {
+        Hypothesis local_best;
+        local_best.cost = std::numeric_limits<double>::infinity();
+        local_best.iteration = -1;
+        int subset[minimal];
+        for (int iteration = begin; iteration < end; ++iteration) {
+            if (options.cancel && options.cancel->load()) break;
+            std::seed_seq seed = {options.seed, (unsigned) iteration};
+            std::mt19937 rng(seed);
+            std::uniform_int_distribution<int> pick(0, n - 1);
+            EllipsoidMoments moments;
+            for (int k = 0; k < minimal; ++k) {
+                bool duplicate;
+                do {
+                    subset[k] = pick(rng);
+                    duplicate = false;
+                    for (int j = 0; j < k; ++j) {
+                        duplicate = duplicate || subset[j] == subset[k];
+                    }
+                } while (duplicate);
+                moments.add(x[subset[k]], y[subset[k]], z[subset[k]]);
+            }
+
+            Hypothesis h;
+            if (!fit(moments, h) || !plausible(h, min, max)) continue;
+            h.iteration = iteration;
+            h.cost = 0;
+            for (int i = 0; i < n; ++i) {
+                const double r = std::fabs(radial_residual(h, x[i], y[i], z[i]));
+                if (options.msac) {
+                    h.cost += r < t ? r * r : t * t;
+                } else if (r >= t) {
+                    h.cost += 1;
+                }
+            }
+            if (better(h, local_best)) local_best = h;
+        }
+        std::lock_guard<std::mutex> lock(best_mutex);
+        if (better(local_best, best)) best = local_best;
+    });
+
+    if (options.cancel && options.cancel->load())
+        throw std::runtime_error("Calibration cancelled");
+    if (best.iteration < 0)
+        throw std::runtime_error("No ellipsoid hypothesis could be fitted");
+
+    // refit on the consensus set, then report the inliers of the refit
+    EllipsoidMoments consensus;
+    for (int i = 0; i < n; ++i) {
+        if (std::fabs(radial_residual(best, x[i], y[i], z[i])) < t) {
+            consensus.add(x[i], y[i], z[i]);
+        }
+    }
+    Hypothesis refit;
+    if (!fit(consensus, refit))
+        throw std::runtime_error("Cannot fit an ellipsoid to the inliers");
+
+    RansacResult result;
+    result.inliers = QVector<bool>(n, false);
+    result.inlier_count = 0;
+    for (int i = 0; i < n; ++i) {
+        if (std::fabs(radial_residual(refit, x[i], y[i], z[i])) < t) {
+            result.inliers[i] = true;
+            ++result.inlier_count;
+        }
+    }
+    result.offsets = {std::lround(refit.offset[0]), std::lround(refit.offset[1]),
+                      std::lround(refit.offset[2])};
+    result.scale = {1 / refit.inverse_scale[0], 1 / refit.inverse_scale[1],
+                    1 / refit.inverse_scale[2]};
+    return result;
+}
@@ -0,0 +1,159 @@
+#include "callib.h"
+#include "parallel.h"
+
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// parameters: offset o[0..2] and inverse scale k[0..2]
+const int parameters = 6;
+
+typedef matrices::FixedMatrix<double, parameters, parameters> Normal;
+typedef matrices::FixedMatrix<double, parameters, 1> Vector;
+
+struct Samples {
+    const QVector<double>& x;
+    const QVector<double>& y;
+    const QVector<double>& z;
+    const QVector<bool>& mask;
+};
+
+struct Sums {
+    Normal jtj; // only the upper triangle is accumulated
+    Vector jtr;
+    double cost;
+    long count;
+};
+
+// sum of squared residuals r = |k * (p - o)| - 1 and, with jacobian, the
+// Gauss-Newton normal equations J^T J, J^T r. Each thread accumulates its
+// own chunk of samples, the chunks are merged in order so the sums don't
+// depend on the scheduling.
+Sums accumulate(const Samples& s, const double theta[parameters],
+                bool jacobian) {
+    const int n = s.x.size();
+    std::vector<Sums> chunks(parallel::chunkCount(n));
+    parallel::forChunks(n, chunks.size(), [&](int begin, int end, int c) {
+        Sums& sums = chunks[c];
+        sums.cost = 0;
+        sums.count = 0;
+        for (int i = begin; i < end; i++) {
+            if (!s.mask.isEmpty() && !s.mask[i]) continue;
+            const double d[3] = {s.x[i] - theta[0], s.y[i] - theta[1],
+                                 s.z[i] - theta[2]};
+            const double u[3] = {theta[3] * d[0], theta[4] * d[1],
+                                 theta[5] * d[2]};
+            const double norm = std::sqrt(u[0] * u[0] + u[1] * u[1] +
+                                          u[2] * u[2]);
+            if (norm == 0) continue;
+            const double r = norm - 1;
+            sums.cost += r * r;
+            sums.count++;
+            if (!jacobian) continue;
+
+            double j[parameters];
+            for (int a = 0; a < 3; a++) {
+                j[a] = -theta[3 + a] * u[a] / norm;
+                j[3 + a] = u[a] * d[a] / norm;
+            }
+            for (int a = 0; a < parameters; a++) {
+                for (int b = a; b < parameters; b++)
+                    sums.jtj(a, b) += j[a] * j[b];
+                sums.jtr[a] += j[a] * r;
+            }
+        }
+    });
+
+    Sums total = {Normal(), Vector(), 0, 0};
+    for (const Sums& sums : chunks) {
+        total.jtj = total.jtj + sums.jtj;
+        total.jtr = total.jtr + sums.jtr;
+        total.cost += sums.cost;
+        total.count += sums.count;
+    }
+    for (int a = 0; a < parameters; a++)
+        for (int b = 0; b < a; b++)
+            total.jtj(a, b) = total.jtj(b, a);
+    return total;
+}
+
+} // namespace
+
+RefineResult CalLib::refine(const QVector<double>& x, const QVector<double>& y,
+                            const QVector<double>& z,
+                            const QVector<long>& offsets,
+                            const QVector<double>& scale,
+                            const QVector<bool>& mask,
+                            const RefineOptions& options) {
+    const auto start = std::chrono::steady_clock::now();
+    const Samples samples = {x, y, z, mask};
+
+    double theta[parameters];
+    for (int a = 0; a < 3; a++) {
+        theta[a] = offsets[a];
+        theta[3 + a] = 1 / scale[a];
+    }
+
+    RefineResult result;
+    result.iterations = 0;
+    result.converged = false;
+
+    Sums sums = accumulate(samples, theta, true);
+    if (sums.count < parameters)
+        throw std::runtime_error("Not enough samples to refine the fit");
+
+    double lambda = options.lambda;
+    while (result.iterations < options.max_iterations) {
+        if (options.cancel && options.cancel->load())
+            throw std::runtime_error("Calibration cancelled");
+        result.iterations++;
+
+        // Marquardt damping of the diagonal keeps the step invariant to the
+        // very different magnitudes of offsets and inverse scales
+        Normal a = sums.jtj;
+        for (int i = 0; i < parameters; i++)
+            a(i, i) += lambda * sums.jtj(i, i);
+        Vector step = sums.jtr * -1.0;
+        if (!matrices::solveSpd(a, step)) {
+            lambda *= 10;
+            continue;
+        }
+
+        double trial[parameters];
+        for (int i = 0; i < parameters; i++)
+            trial[i] = theta[i] + step[i];
+        const Sums trial_sums = accumulate(samples, trial, false);
+
+        if (trial_sums.count == sums.count && trial_sums.cost < sums.cost) {
+            const double decrease = (sums.cost - trial_sums.cost) / sums.cost;
+            for (int i = 0; i < parameters; i++)
+                theta[i] = trial[i];
+            lambda /= 10;
+            if (decrease < options.tolerance) {
+                sums = trial_sums;
+                result.converged = true;
+                break;
+            }
+            sums = accumulate(samples, theta, true);
+        } else {
+            lambda *= 10;
+            // no damping gives a decrease any more, we are at the minimum
+            if (lambda > 1e12) {
+                result.converged = true;
+                break;
+            }
+        }
+    }
+
+    result.offsets = {std::lround(theta[0]), std::lround(theta[1]),
+                      std::lround(theta[2])};
+    result.scale = {1 / theta[3], 1 / theta[4], 1 / theta[5]};
+    result.rms = std::sqrt(sums.cost / sums.count);
+    result.milliseconds = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    return result;
+}
@@ -0,0 +1,84 @@
+#include "simd.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef SIMD_DISPATCH
+#include <cpuid.h>
+#endif
+
+namespace simd {
+
+namespace {
+
+#ifdef SIMD_DISPATCH
+// register state the OS saves on context switches, XCR0
+unsigned long long enabledState() {
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+}
+#endif
+
+Level choose() {
+    Level level = detected();
+    const char* requested = std::getenv("FREEIMU_SIMD");
+    if (!requested) return level;
+    for (int candidate = Scalar; candidate <= AVX512; candidate++) {
+        if (std::strcmp(requested, name(Level(candidate))) == 0 &&
+            candidate < level)
+            return Level(candidate);
+    }
+    return level;
+}
+
+} // namespace
+
+Level detected() {
+#ifdef SIMD_DISPATCH
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return Scalar;
+    const bool sse42 = (edx & bit_SSE2) && (ecx & bit_SSE4_2);
+    if (!sse42) return Scalar;
+    // AVX registers are only usable once the OS saves them
+    const bool osxsave = ecx & bit_OSXSAVE;
+    const bool fma = ecx & bit_FMA;
+    const bool avx = ecx & bit_AVX;
+    if (!osxsave || !avx || !fma) return SSE42;
+    const unsigned long long state = enabledState();
+    if ((state & 0x6) != 0x6) return SSE42; // xmm and ymm
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return SSE42;
+    if (!(ebx & bit_AVX2)) return SSE42;
+    // opmask, upper zmm0-15 and zmm16-31
+    if ((ebx & bit_AVX512F) && (state & 0xe6) == 0xe6) return AVX512;
+    return AVX2;
+#elif defined(__AVX512F__)
+    return AVX512;
+#elif defined(__AVX2__) && defined(__FMA__)
+    return AVX2;
+#elif defined(__SSE4_2__)
+    return SSE42;
+#else
+    return Scalar;
+#endif
+}
+
+Level active() {
+    static const Level level = choose();
+    return level;
+}
+
+const char* name(Level level) {
+    switch (level) {
+    case SSE42:
+        return "sse4.2";
+    case AVX2:
+        return "avx2";
+    case AVX512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+} // namespace simd
@@ -0,0 +1,71 @@
+#pragma once
+
+// GCC and clang build every kernel variant in one translation unit, each
+// inside a target pragma region, and pick one at run time. Other compilers
+// only get the variants their flags enable, the binary then needs that
+// level.
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define SIMD_DISPATCH
+#endif
+
+#if defined(SIMD_DISPATCH) || defined(__SSE4_2__)
+#define SIMD_HAVE_SSE42
+#endif
+#if defined(SIMD_DISPATCH) || (defined(__AVX2__) && defined(__FMA__))
+#define SIMD_HAVE_AVX2
+#endif
+#if defined(SIMD_DISPATCH) || defined(__AVX512F__)
+#define SIMD_HAVE_AVX512
+#endif
+
+#if defined(SIMD_HAVE_SSE42) || defined(SIMD_HAVE_AVX2) ||                   \
+    defined(SIMD_HAVE_AVX512)
+#include <immintrin.h>
+#endif
+
+// functions defined between SIMD_TARGET_BEGIN("avx2,fma") and
+// SIMD_TARGET_END may use those instructions whatever the build flags
+#if defined(SIMD_DISPATCH) && defined(__clang__)
+// clang has no target pragma, the attribute goes on every function instead
+#define SIMD_PRAGMA(text) _Pragma(#text)
+#define SIMD_TARGET_BEGIN(isa)                                               \
+    SIMD_PRAGMA(clang attribute push(__attribute__((target(isa))),            \
+                                     apply_to = function))
+#define SIMD_TARGET_END SIMD_PRAGMA(clang attribute pop)
+#elif defined(SIMD_DISPATCH)
+#define SIMD_PRAGMA(text) _Pragma(#text)
+#define SIMD_TARGET_BEGIN(isa)                                               \
+    SIMD_PRAGMA(GCC push_options) SIMD_PRAGMA(GCC target(isa))
+#define SIMD_TARGET_END SIMD_PRAGMA(GCC pop_options)
+#else
+#define SIMD_TARGET_BEGIN(isa)
+#define SIMD_TARGET_END
+#endif
+
+namespace simd {
+
+/// <summary>
+/// Instruction set levels the numeric kernels are built for, in
+/// increasing order
+/// </summary>
+enum Level { Scalar, SSE42, AVX2, AVX512 };
+
+/// <summary>
+/// The best level both the CPU and the operating system support, from
+/// cpuid and xgetbv
+/// </summary>
+Level detected();
+
+/// <summary>
+/// The level the kernels run at, chosen on the first call: detected(),
+/// lowered by the FREEIMU_SIMD environment variable (scalar, sse4.2, avx2
+/// or avx512) to test the other paths. A level the CPU lacks is ignored.
+/// </summary>
+Level active();
+
+/// <summary>
+/// Name of a level as FREEIMU_SIMD spells it
+/// </summary>
+const char* name(Level level);
+
+} // namespace simd
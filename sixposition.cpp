@@ -0,0 +1,104 @@
+#include "sixposition.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// the gravity vector must be within about 25 degrees of an axis
+const double min_alignment = 0.9;
+
+const char* const face_names[SixPositionCalibrator::faces] = {
+    "+x", "-x", "+y", "-y", "+z", "-z"};
+
+} // namespace
+
+SixPositionCalibrator::SixPositionCalibrator(double gyro_threshold,
+                                             double acc_threshold)
+    : detector(gyro_threshold, acc_threshold) {
+}
+
+void SixPositionCalibrator::clear() {
+    detector.clear();
+    for (int i = 0; i < faces; ++i) {
+        poses[i].clear();
+    }
+}
+
+void SixPositionCalibrator::add(const double gyro[3], const double acc[3]) {
+    if (!detector.add(gyro, acc)) return;
+    const RunningStats& still = detector.acc();
+    const double* m = still.mean;
+    int axis = 0;
+    for (int i = 1; i < 3; ++i) {
+        if (std::fabs(m[i]) > std::fabs(m[axis])) axis = i;
+    }
+    const double norm = std::sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+    // tilted or in free fall, not one of the six poses
+    if (norm == 0 || std::fabs(m[axis]) < min_alignment * norm) return;
+    poses[2 * axis + (m[axis] < 0 ? 1 : 0)].merge(still);
+}
+
+long SixPositionCalibrator::face_samples(int face) const {
+    return poses[face].count;
+}
+
+int SixPositionCalibrator::captured() const {
+    int n = 0;
+    for (int i = 0; i < faces; ++i) {
+        if (poses[i].count >= min_samples) ++n;
+    }
+    return n;
+}
+
+bool SixPositionCalibrator::complete() const {
+    return captured() == faces;
+}
+
+QString SixPositionCalibrator::missing() const {
+    QString names;
+    for (int i = 0; i < faces; ++i) {
+        if (poses[i].count >= min_samples) continue;
+        if (!names.isEmpty()) names += " ";
+        names += face_names[i];
+    }
+    return names;
+}
+
+EllipsoidCalibration SixPositionCalibrator::solve() const {
+    if (!complete())
+        throw std::runtime_error("Not all six poses were captured");
+
+    // columns of M, and the bias from the three opposite pairs
+    double m[3][3];
+    double b[3] = {0, 0, 0};
+    for (int k = 0; k < 3; ++k) {
+        const double* up = poses[2 * k].mean;
+        const double* down = poses[2 * k + 1].mean;
+        for (int i = 0; i < 3; ++i) {
+            m[i][k] = (up[i] - down[i]) / 2;
+            b[i] += (up[i] + down[i]) / 6;
+        }
+    }
+
+    // correction = M^-1, from the adjugate
+    const double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+        m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+        m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    if (!(std::fabs(det) > 0))
+        throw std::runtime_error("Six position poses are degenerate");
+
+    EllipsoidCalibration result;
+    result.offset = {b[0], b[1], b[2]};
+    for (int i = 0; i < 3; ++i) {
+        const int i1 = (i + 1) % 3;
+        const int i2 = (i + 2) % 3;
+        for (int j = 0; j < 3; ++j) {
+            const int j1 = (j + 1) % 3;
+            const int j2 = (j + 2) % 3;
+            result.correction(j, i) =
+                (m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1]) / det;
+        }
+    }
+    return result;
+}
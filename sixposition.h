@@ -0,0 +1,40 @@
+#ifndef SIXPOSITION_H
+#define SIXPOSITION_H
+
+#include "callib.h"
+#include "gyrocalibrator.h"
+#include <QString>
+
+// Six-position accelerometer calibration. The board is held still with each
+// axis pointing up and then down; the detector recognizes those poses in
+// the SerialWorker stream and averages them, so the fit only uses six
+// points. With a = M g + b for the unit gravity vectors g = +-e_k,
+//   b = mean_k (a(+k) + a(-k)) / 2,    M e_k = (a(+k) - a(-k)) / 2,
+// which gives bias, scale and misalignment without any iteration.
+class SixPositionCalibrator {
+public:
+    static const int faces = 6;              // +x, -x, +y, -y, +z, -z
+    static const int min_samples = 4 * StillnessDetector::window;
+
+    explicit SixPositionCalibrator(double gyro_threshold = 15,
+                                   double acc_threshold = 100);
+    void clear();
+    void add(const double gyro[3], const double acc[3]);
+
+    // still samples averaged for a face so far
+    long face_samples(int face) const;
+    // faces with at least min_samples
+    int captured() const;
+    bool complete() const;
+    // e.g. "+x -y", the faces still missing
+    QString missing() const;
+
+    // throws unless complete()
+    EllipsoidCalibration solve() const;
+
+private:
+    StillnessDetector detector;
+    RunningStats poses[faces];
+};
+
+#endif // SIXPOSITION_H
@@ -0,0 +1,113 @@
+#include "callib.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+const double quarter_pi = 0.78539816339744830962;
+
+// cube-sphere cell of a direction: the cube face of the dominant axis, then
+// an equal-angle grid on that face so the cells have similar solid angles
+int direction_bin(double dx, double dy, double dz, int resolution) {
+    const double ax = std::fabs(dx), ay = std::fabs(dy), az = std::fabs(dz);
+    int face;
+    double u, v, w;
+    if (ax >= ay && ax >= az) {
+        face = dx > 0 ? 0 : 1;
+        u = dy;
+        v = dz;
+        w = ax;
+    } else if (ay >= az) {
+        face = dy > 0 ? 2 : 3;
+        u = dx;
+        v = dz;
+        w = ay;
+    } else {
+        face = dz > 0 ? 4 : 5;
+        u = dx;
+        v = dy;
+        w = az;
+    }
+    // atan maps the face [-1, 1] to [-pi/4, pi/4]
+    const double s = (std::atan(u / w) / quarter_pi + 1) / 2;
+    const double t = (std::atan(v / w) / quarter_pi + 1) / 2;
+    const int i = std::min(static_cast<int>(s * resolution), resolution - 1);
+    const int j = std::min(static_cast<int>(t * resolution), resolution - 1);
+    return (face * resolution + j) * resolution + i;
+}
+
+} // namespace
+
+int CalLib::subsample(QVector<double>& x, QVector<double>& y,
+                      QVector<double>& z, const SubsampleOptions& options) {
+    const int n = x.size();
+    if (options.resolution < 1 || options.per_bin < 1)
+        throw std::invalid_argument("Invalid subsampling options");
+    if (n == 0) return 0;
+
+    // directions are taken from the middle of the bounding box, close
+    // enough to the offset for binning
+    double min[3] = {x[0], y[0], z[0]};
+    double max[3] = {x[0], y[0], z[0]};
+    for (int i = 1; i < n; ++i) {
+        const double p[3] = {x[i], y[i], z[i]};
+        for (int k = 0; k < 3; ++k) {
+            min[k] = std::min(min[k], p[k]);
+            max[k] = std::max(max[k], p[k]);
+        }
+    }
+    const double center[3] = {(min[0] + max[0]) / 2, (min[1] + max[1]) / 2,
+                              (min[2] + max[2]) / 2};
+
+    // one reservoir per bin keeps a uniform sample of everything that fell
+    // in it, whatever the order and length of the capture
+    const int bins = 6 * options.resolution * options.resolution;
+    const int capacity = options.per_bin;
+    std::vector<int> reservoir(static_cast<size_t>(bins) * capacity);
+    std::vector<int> seen(bins, 0);
+    std::mt19937 rng(options.seed);
+    for (int i = 0; i < n; ++i) {
+        const double dx = x[i] - center[0];
+        const double dy = y[i] - center[1];
+        const double dz = z[i] - center[2];
+        if (dx == 0 && dy == 0 && dz == 0) continue;
+        const int bin = direction_bin(dx, dy, dz, options.resolution);
+        int* slots = &reservoir[static_cast<size_t>(bin) * capacity];
+        const int count = seen[bin]++;
+        if (count < capacity) {
+            slots[count] = i;
+        } else {
+            const int slot = std::uniform_int_distribution<int>(0, count)(rng);
+            if (slot < capacity) slots[slot] = i;
+        }
+    }
+
+    std::vector<int> kept;
+    int occupied = 0;
+    for (int bin = 0; bin < bins; ++bin) {
+        if (seen[bin] == 0) continue;
+        ++occupied;
+        const int* slots = &reservoir[static_cast<size_t>(bin) * capacity];
+        kept.insert(kept.end(), slots, slots + std::min(seen[bin], capacity));
+    }
+    // keep the capture order, the subset stays a valid time series
+    std::sort(kept.begin(), kept.end());
+
+    QVector<double> kept_x, kept_y, kept_z;
+    kept_x.reserve(kept.size());
+    kept_y.reserve(kept.size());
+    kept_z.reserve(kept.size());
+    for (int i : kept) {
+        kept_x.append(x[i]);
+        kept_y.append(y[i]);
+        kept_z.append(z[i]);
+    }
+    x = kept_x;
+    y = kept_y;
+    z = kept_z;
+    return occupied;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cmath>
+
+namespace matrices {
+
+/// <summary>
+/// Eigen decomposition of a fixed size symmetric matrix with the cyclic
+/// Jacobi method. Works on the stack only, so it is cheap for the small
+/// scatter and shape matrices used by the calibration fits.
+/// </summary>
+/// <param name="a">Symmetric input matrix, left untouched</param>
+/// <param name="values">Eigenvalues in ascending order</param>
+/// <param name="vectors">Eigenvectors, stored as columns in the order of
+/// values</param>
+/// <returns>Whether the off-diagonal norm converged</returns>
+template <int N>
+bool symmetricEigen(const double (&a)[N][N], double (&values)[N],
+                    double (&vectors)[N][N], int maxSweeps = 64) {
+    double m[N][N];
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) {
+            m[i][j] = a[i][j];
+            vectors[i][j] = i == j ? 1.0 : 0.0;
+        }
+    }
+
+    double norm = 0.0;
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+            norm += m[i][j] * m[i][j];
+
+    bool converged = false;
+    for (int sweep = 0; sweep < maxSweeps && !converged; sweep++) {
+        double off = 0.0;
+        for (int p = 0; p < N; p++)
+            for (int q = p + 1; q < N; q++)
+                off += m[p][q] * m[p][q];
+        if (off <= 1e-30 * norm) {
+            converged = true;
+            break;
+        }
+
+        for (int p = 0; p < N; p++) {
+            for (int q = p + 1; q < N; q++) {
+                if (m[p][q] == 0.0) continue;
+                // rotation angle which zeroes m[p][q]
+                double theta = (m[q][q] - m[p][p]) / (2.0 * m[p][q]);
+                double t = (theta >= 0 ? 1.0 : -1.0) /
+                    (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+                double c = 1.0 / std::sqrt(t * t + 1.0);
+                double s = t * c;
+
+                for (int k = 0; k < N; k++) {
+                    double mkp = m[k][p];
+                    double mkq = m[k][q];
+                    m[k][p] = c * mkp - s * mkq;
+                    m[k][q] = s * mkp + c * mkq;
+                }
+                for (int k = 0; k < N; k++) {
+                    double mpk = m[p][k];
+                    double mqk = m[q][k];
+                    m[p][k] = c * mpk - s * mqk;
+                    m[q][k] = s * mpk + c * mqk;
+                }
+                for (int k = 0; k < N; k++) {
+                    double vkp = vectors[k][p];
+                    double vkq = vectors[k][q];
+                    vectors[k][p] = c * vkp - s * vkq;
+                    vectors[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < N; i++)
+        values[i] = m[i][i];
+
+    // selection sort, N is tiny
+    for (int i = 0; i < N - 1; i++) {
+        int min = i;
+        for (int j = i + 1; j < N; j++)
+            if (values[j] < values[min]) min = j;
+        if (min == i) continue;
+        double tmp = values[i];
+        values[i] = values[min];
+        values[min] = tmp;
+        for (int k = 0; k < N; k++) {
+            tmp = vectors[k][i];
+            vectors[k][i] = vectors[k][min];
+            vectors[k][min] = tmp;
+        }
+    }
+    return converged;
+}
+
+} // namespace matrices
@@ -0,0 +1,35 @@
+#include "tests.h"
+
+#include <QCoreApplication>
+#include <QtTest>
+
+// Runs every test class, the exit code is the number of failed tests.
+// The arguments are passed on to every QTest::qExec.
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+
+    int failures = 0;
+    MatrixTest matrix;
+    failures += QTest::qExec(&matrix, argc, argv);
+    KernelTest kernels;
+    failures += QTest::qExec(&kernels, argc, argv);
+    CalibrationTest calibration;
+    failures += QTest::qExec(&calibration, argc, argv);
+    AlgorithmTest algorithms;
+    failures += QTest::qExec(&algorithms, argc, argv);
+    BootstrapTest bootstrap;
+    failures += QTest::qExec(&bootstrap, argc, argv);
+    CacheTest cache;
+    failures += QTest::qExec(&cache, argc, argv);
+    QualityTest quality;
+    failures += QTest::qExec(&quality, argc, argv);
+    ParserTest parser;
+    failures += QTest::qExec(&parser, argc, argv);
+    GyroTest gyro;
+    failures += QTest::qExec(&gyro, argc, argv);
+    SixPositionTest six_position;
+    failures += QTest::qExec(&six_position, argc, argv);
+    ParallelTest parallel;
+    failures += QTest::qExec(&parallel, argc, argv);
+    return failures;
+}
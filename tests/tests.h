@@ -0,0 +1,159 @@
+#ifndef TESTS_H
+#define TESTS_H
+
+#include <QObject>
+
+// One QtTest class per area, all run by main.cpp. The fixtures build their
+// inputs from fixed seeds so a failure always reproduces.
+
+// LU and Cholesky against the cofactor expansion they replaced, the
+// streaming QR, views and transposes
+class MatrixTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void luInverse();
+    void luDeterminant();
+    void luSingular();
+    void choleskyInverse();
+    void choleskyDeterminant();
+    void choleskyNotPositiveDefinite();
+    void qrSolve();
+    void qrMerge();
+    void qrCovariance();
+    void views();
+    void viewAssignment();
+    void transpose();
+    void transposeInPlace();
+};
+
+// gemm, syrk, the calibration apply and the quadric and weighted ellipsoid
+// moments against the naive loops, at the level picked by FREEIMU_SIMD. levels() runs the
+// tests again at every level the CPU supports.
+class KernelTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void gemm();
+    void gemmTransposed();
+    void syrk();
+    void matrixProducts();
+    void apply();
+    void quadricMoments();
+    void ellipsoidMoments();
+    void levels();
+};
+
+// the ellipsoid fits, their refinement and the reduction of the capture
+// before them, on synthetic captures with a known answer
+class CalibrationTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void ransacSaturatedFrames();
+    void fromFile();
+    void rotatedEllipsoid();
+    void refineUnevenCoverage();
+    void refineMask();
+    void refineCancel();
+    void subsampleBins();
+    void subsampleSeed();
+    void subsampleFit();
+};
+
+// the Poisson bootstrap: reproducible per seed, the table and the weighted
+// moments it feeds, and intervals that cover the true fit
+class BootstrapTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void reproducible();
+    void poissonTable();
+    void weightedMoments();
+    void coverage();
+};
+
+// the registry of fits and the automatic choice between them
+class AlgorithmTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void autoPicksRansac();
+    void addReplaces();
+    void throwingCandidate();
+    void failureMessage();
+};
+
+// the histograms and the quality metrics filled from them
+class QualityTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void histogramOverflow();
+    void histogramQuantile();
+    void histogramMerge();
+    void unitSphere();
+    void halfSphere();
+    void edgeDirections();
+};
+
+// the calibration cache: counting, the file and its versions, FIFO
+// eviction and the content hashes the keys are made of
+class CacheTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void hitsAndMisses();
+    void roundTrip();
+    void eviction();
+    void versionMismatch();
+    void hashAcrossReads();
+    void contentHash();
+};
+
+class ParserTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void numbers();
+    void endOfFile();
+    void invalidLines();
+    void missingFile();
+    void streaming();
+};
+
+// the running statistics and the gyro bias and noise estimates built on them
+class GyroTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void welford();
+    void chanMerge();
+    void biasAndNoise();
+};
+
+// the six-position solve on poses of a board with a known sensitivity
+class SixPositionTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void solve();
+    void tiltedPoses();
+    void incomplete();
+};
+
+// the chunk bounds of parallel::forChunks, loops started from several
+// threads at once or from inside a chunk and the workers they share, and
+// exceptions thrown by chunks
+class ParallelTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void chunks();
+    void concurrentLoops();
+    void nestedLoops();
+    void sharedWorkers();
+    void exceptions();
+};
+
+#endif // TESTS_H
@@ -0,0 +1,58 @@
+QT       -= gui
+QT       += core concurrent testlib
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tests
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    ../bootstrap.cpp \
+    ../calalgorithms.cpp \
+    ../calibrationcache.cpp \
+    ../callib.cpp \
+    ../calkernels.cpp \
+    ../captureparser.cpp \
+    ../gyrocalibrator.cpp \
+    ../histogram.cpp \
+    ../matrixkernels.cpp \
+    ../parallel.cpp \
+    ../quality.cpp \
+    ../ransac.cpp \
+    ../refine.cpp \
+    ../simd.cpp \
+    ../sixposition.cpp \
+    ../subsample.cpp \
+    main.cpp \
+    tst_algorithms.cpp \
+    tst_bootstrap.cpp \
+    tst_cache.cpp \
+    tst_calibration.cpp \
+    tst_gyro.cpp \
+    tst_kernels.cpp \
+    tst_matrix.cpp \
+    tst_parallel.cpp \
+    tst_parser.cpp \
+    tst_quality.cpp \
+    tst_sixposition.cpp
+
+HEADERS += \
+    ../calalgorithms.h \
+    ../calibrationcache.h \
+    ../callib.h \
+    ../calkernels.h \
+    ../factorization.h \
+    ../fixedmatrix.h \
+    ../gyrocalibrator.h \
+    ../histogram.h \
+    ../matrix.h \
+    ../matrixexpr.h \
+    ../matrixkernels.h \
+    ../parallel.h \
+    ../poissontable.h \
+    ../simd.h \
+    ../sixposition.h \
+    ../symmetriceigen.h \
+    tests.h
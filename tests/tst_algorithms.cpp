@@ -0,0 +1,146 @@
+#include "tests.h"
+#include "calalgorithms.h"
+
+#include <QtTest>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+const double offset[3] = {35, -120, 60};
+const double scale[3] = {500, 460, 530};
+
+// n readings of the field spread over the sphere, with sensor noise, and
+// every tenth one replaced by a glitch anywhere in the sensor range
+void capture(int n, unsigned seed, bool glitches, QVector<double>& x,
+             QVector<double>& y, QVector<double>& z) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> normal(0, 1);
+    std::uniform_real_distribution<double> range(-2000, 2000);
+    x.clear();
+    y.clear();
+    z.clear();
+    for (int i = 0; i < n; i++) {
+        if (glitches && i % 10 == 0) {
+            x.append(range(rng));
+            y.append(range(rng));
+            z.append(range(rng));
+            continue;
+        }
+        double d[3];
+        double norm = 0;
+        for (double& component : d) {
+            component = normal(rng);
+            norm += component * component;
+        }
+        norm = std::sqrt(norm);
+        x.append(offset[0] + scale[0] * d[0] / norm + 2 * normal(rng));
+        y.append(offset[1] + scale[1] * d[1] / norm + 2 * normal(rng));
+        z.append(offset[2] + scale[2] * d[2] / norm + 2 * normal(rng));
+    }
+}
+
+const CandidateScore* candidate(const AutoResult& result, const QString& id) {
+    for (const CandidateScore& score : result.candidates) {
+        if (score.id == id) return &score;
+    }
+    return nullptr;
+}
+
+AlgorithmFit fails(const QVector<double>&, const QVector<double>&,
+                   const QVector<double>&, const AlgorithmOptions&) {
+    throw std::runtime_error("test failure");
+}
+
+// a fit without an error whose score comes out as NaN
+AlgorithmFit no_score(const QVector<double>&, const QVector<double>&,
+                      const QVector<double>&, const AlgorithmOptions&) {
+    AlgorithmFit fit;
+    fit.offsets = {0, 0, 0};
+    fit.scale = {std::nan(""), 1, 1};
+    return fit;
+}
+
+} // namespace
+
+void AlgorithmTest::autoPicksRansac() {
+    // the glitches pull the least squares fits away, the consensus set
+    // of RANSAC leaves them out and scores best on the held-out samples
+    QVector<double> x, y, z;
+    capture(5000, 1, true, x, y, z);
+    const AutoResult result = CalAlgorithms::choose(x, y, z);
+    QCOMPARE(result.id, QString("ransac"));
+    const CandidateScore* ransac = candidate(result, "ransac");
+    const CandidateScore* sphere = candidate(result, "sphere");
+    QVERIFY(ransac && sphere);
+    QVERIFY(ransac->score < sphere->score);
+    for (int k = 0; k < 3; k++) {
+        QVERIFY(std::fabs(result.fit.offsets[k] - offset[k]) < 5);
+        QVERIFY(std::fabs(result.fit.scale[k] / scale[k] - 1) < 0.01);
+    }
+
+    // without glitches every fit is close and one of them wins
+    capture(5000, 2, false, x, y, z);
+    const AutoResult clean = CalAlgorithms::choose(x, y, z);
+    for (const CandidateScore& score : clean.candidates) {
+        if (score.id.startsWith("test-")) continue;
+        QVERIFY(score.error.isEmpty());
+        QVERIFY(score.score < 0.01);
+    }
+}
+
+void AlgorithmTest::addReplaces() {
+    const int registered = CalAlgorithms::all().size();
+    CalAlgorithms::add({"test-replaced", "First", no_score});
+    QCOMPARE(CalAlgorithms::all().size(), registered + 1);
+    CalAlgorithms::add({"test-replaced", "Second", fails});
+    QCOMPARE(CalAlgorithms::all().size(), registered + 1);
+
+    CalAlgorithm found;
+    QVERIFY(CalAlgorithms::find("test-replaced", found));
+    QCOMPARE(found.name, QString("Second"));
+    QVERIFY_EXCEPTION_THROWN(
+        found.fit(QVector<double>(), QVector<double>(), QVector<double>(),
+                  AlgorithmOptions()),
+        std::runtime_error);
+    // and keeps its place in the registry
+    QCOMPARE(CalAlgorithms::all()[registered].id, QString("test-replaced"));
+    QVERIFY(!CalAlgorithms::find("test-missing", found));
+}
+
+void AlgorithmTest::throwingCandidate() {
+    CalAlgorithms::add({"test-fails", "Failing", fails});
+    QVector<double> x, y, z;
+    capture(3000, 3, false, x, y, z);
+    const AutoResult result = CalAlgorithms::choose(x, y, z);
+    const CandidateScore* failed = candidate(result, "test-fails");
+    QVERIFY(failed);
+    QCOMPARE(failed->error, QString("test failure"));
+    QVERIFY(std::isinf(failed->score));
+    QVERIFY(result.id != "test-fails");
+    QVERIFY(candidate(result, result.id)->error.isEmpty());
+}
+
+void AlgorithmTest::failureMessage() {
+    // the first candidate fails without a message, the error reported is
+    // the first one that has one
+    const QVector<CalAlgorithm> saved = CalAlgorithms::all();
+    for (const CalAlgorithm& algorithm : saved) {
+        CalAlgorithms::add({algorithm.id, algorithm.name,
+                            algorithm.id == saved[0].id ? no_score : fails});
+    }
+    QVector<double> x, y, z;
+    capture(1000, 4, false, x, y, z);
+    QString message;
+    try {
+        CalAlgorithms::choose(x, y, z);
+    } catch (const std::runtime_error& e) {
+        message = e.what();
+    }
+    for (const CalAlgorithm& algorithm : saved) {
+        CalAlgorithms::add(algorithm);
+    }
+    QCOMPARE(message,
+             QString("No algorithm could fit the samples: test failure"));
+}
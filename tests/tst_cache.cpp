@@ -0,0 +1,289 @@
+#include "tests.h"
+#include "calibrationcache.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QTemporaryFile>
+#include <QtTest>
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+namespace {
+
+// an entry told apart by n, with a quality whose histograms have counts
+// in range, in the under/overflow and outside
+CalibrationCache::Entry entry(int n) {
+    CalibrationCache::Entry entry;
+    entry.offsets = {n, -n, 2 * n};
+    entry.scale = {400.0 + n, 410.0 + n, 420.0 + n};
+    entry.calibration = CalLib::to_rotated(entry.offsets, entry.scale);
+    entry.calibration.correction(0, 1) = 1e-4 * n;
+    entry.status = QString("status %1").arg(n);
+    entry.candidates = QString("candidates %1").arg(n);
+    CalibrationQuality& quality = entry.quality;
+    quality.samples = 1000 + n;
+    quality.rms = 0.01 * n;
+    for (int axis = 0; axis < 3; axis++)
+        quality.axis_rms[axis] = 0.001 * (n + axis);
+    quality.max_deviation = 0.1 * n;
+    quality.condition = 10.0 * n;
+    quality.coverage = 0.5;
+    quality.residuals = Histogram1D(60, -0.3, 0.3);
+    quality.directions = Histogram2D(36, -3.14, 3.14, 18, -1, 1);
+    for (int i = 0; i < 100; i++) {
+        quality.residuals.fill(-0.35 + 0.007 * i, n);
+        quality.directions.fill(-3.2 + 0.065 * i, -1.1 + 0.022 * i);
+    }
+    return entry;
+}
+
+bool same(const CalibrationCache::Entry& a, const CalibrationCache::Entry& b) {
+    if (a.offsets != b.offsets || a.scale != b.scale ||
+        a.status != b.status || a.candidates != b.candidates)
+        return false;
+    for (int i = 0; i < 3; i++)
+        if (a.calibration.offset[i] != b.calibration.offset[i]) return false;
+    for (int i = 0; i < 9; i++)
+        if (a.calibration.correction[i] != b.calibration.correction[i])
+            return false;
+    const CalibrationQuality& p = a.quality;
+    const CalibrationQuality& q = b.quality;
+    if (p.samples != q.samples || p.rms != q.rms ||
+        p.max_deviation != q.max_deviation || p.condition != q.condition ||
+        p.coverage != q.coverage)
+        return false;
+    for (int axis = 0; axis < 3; axis++)
+        if (p.axis_rms[axis] != q.axis_rms[axis]) return false;
+    const Histogram1D& r = p.residuals;
+    const Histogram1D& s = q.residuals;
+    if (r.bins() != s.bins() || r.low() != s.low() || r.high() != s.high() ||
+        r.underflow() != s.underflow() || r.overflow() != s.overflow())
+        return false;
+    for (int i = 0; i < r.bins(); i++)
+        if (r.count(i) != s.count(i)) return false;
+    const Histogram2D& d = p.directions;
+    const Histogram2D& e = q.directions;
+    if (d.xbins() != e.xbins() || d.ybins() != e.ybins() ||
+        d.xlow() != e.xlow() || d.xhigh() != e.xhigh() ||
+        d.ylow() != e.ylow() || d.yhigh() != e.yhigh() ||
+        d.outside() != e.outside())
+        return false;
+    for (int y = 0; y < d.ybins(); y++)
+        for (int x = 0; x < d.xbins(); x++)
+            if (d.count(x, y) != e.count(x, y)) return false;
+    return true;
+}
+
+// serves its data a few bytes per read, like a pipe or a socket
+class ShortReads : public QIODevice {
+public:
+    ShortReads(const QByteArray& data, int step) : data(data), step(step) {
+        open(QIODevice::ReadOnly);
+    }
+    bool isSequential() const override { return true; }
+
+protected:
+    qint64 readData(char* out, qint64 max) override {
+        const qint64 count =
+            std::min<qint64>(std::min<qint64>(max, step), data.size() - at);
+        std::memcpy(out, data.constData() + at, count);
+        at += count;
+        return count;
+    }
+    qint64 writeData(const char*, qint64) override { return -1; }
+
+private:
+    QByteArray data;
+    int step;
+    qint64 at = 0;
+};
+
+QByteArray random_bytes(int n, unsigned seed) {
+    std::mt19937 rng(seed);
+    QByteArray bytes;
+    for (int i = 0; i < n; i++)
+        bytes.append(char(rng()));
+    return bytes;
+}
+
+} // namespace
+
+void CacheTest::hitsAndMisses() {
+    CalibrationCache cache;
+    CalibrationCache::Entry found;
+    QVERIFY(!cache.find("a", found));
+    cache.insert("a", entry(1));
+    QVERIFY(cache.find("a", found));
+    QVERIFY(same(found, entry(1)));
+    QVERIFY(cache.find("a", found));
+    QVERIFY(!cache.find("b", found));
+    QCOMPARE(cache.hits(), 2L);
+    QCOMPARE(cache.misses(), 2L);
+
+    // inserting the same key replaces the entry
+    cache.insert("a", entry(2));
+    QVERIFY(cache.find("a", found));
+    QVERIFY(same(found, entry(2)));
+
+    cache.clear();
+    QCOMPARE(cache.hits(), 0L);
+    QCOMPARE(cache.misses(), 0L);
+    QVERIFY(!cache.find("a", found));
+}
+
+void CacheTest::roundTrip() {
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.close();
+    {
+        CalibrationCache cache(file.fileName());
+        cache.insert("1", entry(1));
+        cache.insert("2", entry(2));
+        cache.flush();
+        cache.insert("3", entry(3)); // flushed by the destructor
+    }
+
+    CalibrationCache loaded(file.fileName());
+    CalibrationCache::Entry found;
+    for (int n = 1; n <= 3; n++) {
+        QVERIFY(loaded.find(QString::number(n), found));
+        QVERIFY2(same(found, entry(n)), qPrintable(QString("entry %1").arg(n)));
+    }
+    QCOMPARE(loaded.hits(), 3L);
+}
+
+void CacheTest::eviction() {
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.close();
+    CalibrationCache::Entry found;
+    {
+        CalibrationCache cache(file.fileName(), 3);
+        for (int n = 0; n < 5; n++)
+            cache.insert(QString::number(n), entry(n));
+        // first in, first out: 0 and 1 are gone
+        QVERIFY(!cache.find("0", found));
+        QVERIFY(!cache.find("1", found));
+        for (int n = 2; n < 5; n++)
+            QVERIFY(cache.find(QString::number(n), found));
+
+        // a replaced entry keeps its place in the order
+        cache.insert("2", entry(7));
+        cache.insert("5", entry(5));
+        QVERIFY(!cache.find("2", found));
+        QVERIFY(cache.find("3", found));
+    }
+
+    // and the order survives the file
+    CalibrationCache loaded(file.fileName(), 3);
+    loaded.insert("6", entry(6));
+    QVERIFY(!loaded.find("3", found));
+    QVERIFY(loaded.find("4", found));
+    QVERIFY(loaded.find("5", found));
+    QVERIFY(loaded.find("6", found));
+}
+
+void CacheTest::versionMismatch() {
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.close();
+    {
+        CalibrationCache cache(file.fileName());
+        cache.insert("a", entry(1));
+    }
+
+    // the header of the file written above, with one field replaced
+    const quint32 headers[3][3] = {{0x46494343, 2, 1},
+                                   {0x12345678, 3, 1},
+                                   {0x46494343, 99, 1}};
+    for (const auto& header : headers) {
+        QFile out(file.fileName());
+        QVERIFY(out.open(QFile::WriteOnly));
+        QDataStream stream(&out);
+        stream << header[0] << header[1] << header[2] << QString("a");
+        stream << qint64(1) << 401.0;
+        out.close();
+        CalibrationCache cache(file.fileName());
+        CalibrationCache::Entry found;
+        QVERIFY(!cache.find("a", found));
+    }
+
+    // a truncated file keeps the entries read before the damage
+    {
+        CalibrationCache cache(file.fileName());
+        cache.insert("a", entry(1));
+        cache.insert("b", entry(2));
+    }
+    QFile in(file.fileName());
+    QVERIFY(in.open(QFile::ReadOnly));
+    const QByteArray contents = in.readAll();
+    in.close();
+    QFile out(file.fileName());
+    QVERIFY(out.open(QFile::WriteOnly));
+    out.write(contents.constData(), contents.size() - 10);
+    out.close();
+    CalibrationCache cache(file.fileName());
+    CalibrationCache::Entry found;
+    QVERIFY(cache.find("a", found));
+    QVERIFY(same(found, entry(1)));
+    QVERIFY(!cache.find("b", found));
+}
+
+void CacheTest::hashAcrossReads() {
+    // 8-byte words split between reads hash as if read at once, for every
+    // length of the last word
+    for (int n : {0, 1, 7, 8, 9, 1000, 1003}) {
+        const QByteArray data = random_bytes(n, n);
+        QTemporaryFile file;
+        QVERIFY(file.open());
+        file.write(data);
+        file.close();
+        quint64 whole;
+        QVERIFY(CalibrationCache::hash_file(file.fileName(), whole));
+        for (int step : {1, 3, 5, 8, 13}) {
+            ShortReads device(data, step);
+            quint64 pieces;
+            QVERIFY(CalibrationCache::hash_device(device, pieces));
+            QVERIFY2(pieces == whole,
+                     qPrintable(QString("%1 bytes read %2 at a time")
+                                    .arg(n)
+                                    .arg(step)));
+        }
+    }
+
+    // and a changed byte changes the hash
+    const QByteArray data = random_bytes(1003, 1);
+    QByteArray changed = data;
+    changed[1001] = char(changed[1001] ^ 1);
+    ShortReads a(data, 5), b(changed, 5);
+    quint64 first, second;
+    QVERIFY(CalibrationCache::hash_device(a, first));
+    QVERIFY(CalibrationCache::hash_device(b, second));
+    QVERIFY(first != second);
+}
+
+void CacheTest::contentHash() {
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(random_bytes(100, 2));
+    file.close();
+    CalibrationCache cache;
+    quint64 expected, hash;
+    QVERIFY(CalibrationCache::hash_file(file.fileName(), expected));
+    QVERIFY(cache.content_hash(file.fileName(), hash));
+    QCOMPARE(hash, expected);
+    QVERIFY(cache.content_hash(file.fileName(), hash));
+    QCOMPARE(hash, expected);
+
+    // a rewrite changing the size is hashed again
+    QFile out(file.fileName());
+    QVERIFY(out.open(QFile::WriteOnly));
+    const QByteArray longer = random_bytes(200, 3);
+    out.write(longer.constData(), longer.size());
+    out.close();
+    QVERIFY(CalibrationCache::hash_file(file.fileName(), expected));
+    QVERIFY(cache.content_hash(file.fileName(), hash));
+    QCOMPARE(hash, expected);
+    QVERIFY(!cache.content_hash(file.fileName() + ".missing", hash));
+}
@@ -0,0 +1,421 @@
+#include "tests.h"
+#include "callib.h"
+
+#include <QTemporaryFile>
+#include <QtTest>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <random>
+
+namespace {
+
+const double offset[3] = {120, -80, 35};
+const double scale[3] = {480, 510, 450};
+
+// n readings of the field spread over the sphere, with sensor noise
+void capture(int n, unsigned seed, QVector<double>& x, QVector<double>& y,
+             QVector<double>& z) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> normal(0, 1);
+    x.clear();
+    y.clear();
+    z.clear();
+    for (int i = 0; i < n; i++) {
+        double d[3];
+        double norm = 0;
+        for (double& component : d) {
+            component = normal(rng);
+            norm += component * component;
+        }
+        norm = std::sqrt(norm);
+        x.append(offset[0] + scale[0] * d[0] / norm + 2 * normal(rng));
+        y.append(offset[1] + scale[1] * d[1] / norm + 2 * normal(rng));
+        z.append(offset[2] + scale[2] * d[2] / norm + 2 * normal(rng));
+    }
+}
+
+// a capture that mostly saw one cap of the sphere, with noisy readings:
+// the algebraic fit weighs the dense cap and the noise unevenly and
+// drifts away from the true scales
+void uneven_capture(int n, unsigned seed, QVector<double>& x,
+                    QVector<double>& y, QVector<double>& z) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> normal(0, 1);
+    x.clear();
+    y.clear();
+    z.clear();
+    while (x.size() < n) {
+        double d[3];
+        double norm = 0;
+        for (double& component : d) {
+            component = normal(rng);
+            norm += component * component;
+        }
+        norm = std::sqrt(norm);
+        // one sample in ten anywhere, the rest above 60 degrees of latitude
+        if (x.size() % 10 != 0 && d[2] / norm < 0.85) continue;
+        x.append(offset[0] + scale[0] * d[0] / norm + 15 * normal(rng));
+        y.append(offset[1] + scale[1] * d[1] / norm + 15 * normal(rng));
+        z.append(offset[2] + scale[2] * d[2] / norm + 15 * normal(rng));
+    }
+}
+
+// most of a long capture spent around one direction, as when the board
+// sat still on the desk, and the rest spread over the sphere
+void clustered_capture(int n, unsigned seed, QVector<double>& x,
+                       QVector<double>& y, QVector<double>& z) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> normal(0, 1);
+    x.clear();
+    y.clear();
+    z.clear();
+    for (int i = 0; i < n; i++) {
+        double d[3];
+        double norm = 0;
+        for (double& component : d) {
+            component = normal(rng);
+            norm += component * component;
+        }
+        if (i % 20 != 0) {
+            // within about 15 degrees of +x
+            d[0] = std::fabs(d[0]) + 4 * std::sqrt(norm);
+            norm = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+        }
+        norm = std::sqrt(norm);
+        x.append(offset[0] + scale[0] * d[0] / norm + 10 * normal(rng));
+        y.append(offset[1] + scale[1] * d[1] / norm + 10 * normal(rng));
+        z.append(offset[2] + scale[2] * d[2] / norm + 10 * normal(rng));
+    }
+}
+
+// root mean square of |(p - offsets) / scale| - 1 over the samples
+double radial_rms(const QVector<double>& x, const QVector<double>& y,
+                  const QVector<double>& z, const QVector<long>& offsets,
+                  const QVector<double>& scale) {
+    double sum = 0;
+    for (int i = 0; i < x.size(); i++) {
+        const double u[3] = {(x[i] - offsets[0]) / scale[0],
+                             (y[i] - offsets[1]) / scale[1],
+                             (z[i] - offsets[2]) / scale[2]};
+        const double r =
+            std::sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]) - 1;
+        sum += r * r;
+    }
+    return std::sqrt(sum / x.size());
+}
+
+bool close(double actual, double expected, double tolerance) {
+    return std::fabs(actual - expected) <=
+        tolerance * std::max(1.0, std::fabs(expected));
+}
+
+} // namespace
+
+void CalibrationTest::ransacSaturatedFrames() {
+    QVector<double> x, y, z;
+    capture(2000, 1, x, y, z);
+    // a few frames clipped at the ADC range used to stretch the accepted
+    // scale range past every real hypothesis
+    for (int i = 0; i < 8; i++) {
+        x[i * 211] = 32767;
+        y[i * 211] = i % 2 ? 32767 : -32768;
+        z[i * 211] = -32768;
+    }
+
+    const RansacResult result = CalLib::calibrate_ransac(x, y, z);
+    for (int k = 0; k < 3; k++) {
+        QVERIFY(std::fabs(result.offsets[k] - offset[k]) < 5);
+        QVERIFY(std::fabs(result.scale[k] / scale[k] - 1) < 0.01);
+    }
+    QVERIFY(result.inlier_count > 1900);
+    for (int i = 0; i < 8; i++)
+        QVERIFY(!result.inliers[i * 211]);
+}
+
+void CalibrationTest::fromFile() {
+    QVector<double> x, y, z;
+    capture(50000, 2, x, y, z);
+    QByteArray contents;
+    for (int i = 0; i < x.size(); i++) {
+        contents.append(QByteArray::number(int(std::lround(x[i]))) + " ");
+        contents.append(QByteArray::number(int(std::lround(y[i]))) + " ");
+        contents.append(QByteArray::number(int(std::lround(z[i]))) + "\n");
+    }
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(contents);
+    file.close();
+    CalLib::load_samples(file.fileName(), x, y, z);
+    QCOMPARE(x.size(), 50000);
+
+    // streamed from the file, the same fits as on the loaded samples
+    const auto streamed = CalLib::calibrate_from_file(file.fileName());
+    const auto loaded = CalLib::calibrate(x, y, z);
+    for (int k = 0; k < 3; k++) {
+        QCOMPARE(streamed.first[k], loaded.first[k]);
+        QVERIFY(close(streamed.second[k], loaded.second[k], 1e-9));
+        QVERIFY(std::fabs(loaded.first[k] - offset[k]) < 2);
+    }
+
+    QuadricMoments moments;
+    moments.add(x.constData(), y.constData(), z.constData(), x.size());
+    const EllipsoidCalibration rotated =
+        CalLib::calibrate_rotated_from_file(file.fileName());
+    const EllipsoidCalibration reference = CalLib::calibrate_rotated(moments);
+    for (int i = 0; i < 3; i++)
+        QVERIFY(close(rotated.offset[i], reference.offset[i], 1e-9));
+    for (int i = 0; i < 9; i++)
+        QVERIFY(close(rotated.correction[i], reference.correction[i], 1e-9));
+}
+
+void CalibrationTest::rotatedEllipsoid() {
+    // soft iron: semi-axes of 300, 450 and 600 along axes rotated by 30
+    // degrees about z then 20 about x, so every raw axis mixes the others
+    const double a = std::acos(-1.0) / 6, b = std::acos(-1.0) / 9;
+    const double rz[3][3] = {{std::cos(a), -std::sin(a), 0},
+                             {std::sin(a), std::cos(a), 0},
+                             {0, 0, 1}};
+    const double rx[3][3] = {{1, 0, 0},
+                             {0, std::cos(b), -std::sin(b)},
+                             {0, std::sin(b), std::cos(b)}};
+    double r[3][3];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) {
+            r[i][j] = 0;
+            for (int k = 0; k < 3; k++)
+                r[i][j] += rx[i][k] * rz[k][j];
+        }
+    const double axes[3] = {300, 450, 600};
+    const double center[3] = {-150, 220, 75};
+    // raw = center + shape u for unit u, the correction is shape^-1, both
+    // symmetric: shape = R diag(axes) R^T
+    double shape[3][3], correction[3][3];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) {
+            shape[i][j] = 0;
+            correction[i][j] = 0;
+            for (int k = 0; k < 3; k++) {
+                shape[i][j] += r[i][k] * axes[k] * r[j][k];
+                correction[i][j] += r[i][k] / axes[k] * r[j][k];
+            }
+        }
+
+    std::mt19937 rng(4);
+    std::normal_distribution<double> normal(0, 1);
+    QVector<double> x, y, z;
+    double extent[3] = {0, 0, 0};
+    for (int n = 0; n < 20000; n++) {
+        double u[3];
+        double norm = 0;
+        for (double& component : u) {
+            component = normal(rng);
+            norm += component * component;
+        }
+        norm = std::sqrt(norm);
+        double p[3];
+        for (int i = 0; i < 3; i++) {
+            p[i] = 0;
+            for (int j = 0; j < 3; j++)
+                p[i] += shape[i][j] * u[j] / norm;
+            extent[i] = std::max(extent[i], std::fabs(p[i]));
+            p[i] += center[i] + 0.5 * normal(rng);
+        }
+        x.append(p[0]);
+        y.append(p[1]);
+        z.append(p[2]);
+    }
+
+    QuadricMoments moments;
+    moments.add(x.constData(), y.constData(), z.constData(), x.size());
+    const EllipsoidCalibration fit = CalLib::calibrate_rotated(moments);
+    for (int i = 0; i < 3; i++)
+        QVERIFY(std::fabs(fit.offset[i] - center[i]) < 1);
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            QVERIFY2(std::fabs(fit.correction(i, j) - correction[i][j]) <
+                         2e-3 / axes[0],
+                     qPrintable(QString("correction(%1, %2)").arg(i).arg(j)));
+
+    // the per-axis scales are the half extents of the raw ellipsoid, the
+    // largest reading seen along each axis
+    const QVector<double> scale = fit.scale();
+    for (int i = 0; i < 3; i++)
+        QVERIFY(std::fabs(scale[i] / extent[i] - 1) < 0.01);
+    // and for an axis-aligned calibration, the scales it was made from
+    const QVector<double> aligned =
+        CalLib::to_rotated({1, 2, 3}, {480, 510, 450}).scale();
+    QVERIFY(close(aligned[0], 480, 1e-12));
+    QVERIFY(close(aligned[1], 510, 1e-12));
+    QVERIFY(close(aligned[2], 450, 1e-12));
+}
+
+void CalibrationTest::refineUnevenCoverage() {
+    QVector<double> x, y, z;
+    uneven_capture(20000, 5, x, y, z);
+    const auto algebraic = CalLib::calibrate(x, y, z);
+    const RefineResult refined =
+        CalLib::refine(x, y, z, algebraic.first, algebraic.second);
+    QVERIFY(refined.converged);
+
+    // the refinement minimizes the radial residual the algebraic fit only
+    // approximates, and lands closer to the true scales
+    const double before =
+        radial_rms(x, y, z, algebraic.first, algebraic.second);
+    QVERIFY(close(refined.rms,
+                  radial_rms(x, y, z, refined.offsets, refined.scale),
+                  1e-3));
+    QVERIFY(refined.rms < before);
+    double algebraic_error = 0;
+    double refined_error = 0;
+    for (int k = 0; k < 3; k++) {
+        algebraic_error += std::fabs(algebraic.second[k] / scale[k] - 1);
+        refined_error += std::fabs(refined.scale[k] / scale[k] - 1);
+        QVERIFY(std::fabs(refined.scale[k] / scale[k] - 1) < 0.025);
+    }
+    QVERIFY2(refined_error < algebraic_error / 2,
+             qPrintable(QString("scale error %1 refined, %2 algebraic")
+                            .arg(refined_error)
+                            .arg(algebraic_error)));
+}
+
+void CalibrationTest::refineMask() {
+    QVector<double> x, y, z;
+    capture(3000, 6, x, y, z);
+    const auto start = CalLib::calibrate(x, y, z);
+    const RefineResult clean = CalLib::refine(x, y, z, start.first,
+                                              start.second);
+
+    // readings far off the sphere, masked out, leave the fit unchanged
+    QVector<double> xs, ys, zs;
+    QVector<bool> mask;
+    for (int i = 0; i < x.size(); i++) {
+        if (i % 10 == 3) {
+            xs.append(5000);
+            ys.append(-4000);
+            zs.append(3000);
+            mask.append(false);
+        }
+        xs.append(x[i]);
+        ys.append(y[i]);
+        zs.append(z[i]);
+        mask.append(true);
+    }
+    const RefineResult masked =
+        CalLib::refine(xs, ys, zs, start.first, start.second, mask);
+    for (int k = 0; k < 3; k++) {
+        QCOMPARE(masked.offsets[k], clean.offsets[k]);
+        QVERIFY(close(masked.scale[k], clean.scale[k], 1e-9));
+    }
+    QVERIFY(close(masked.rms, clean.rms, 1e-9));
+
+    // and pull it away once they count
+    const RefineResult unmasked =
+        CalLib::refine(xs, ys, zs, start.first, start.second);
+    long moved = 0;
+    for (int k = 0; k < 3; k++)
+        moved += std::labs(unmasked.offsets[k] - clean.offsets[k]);
+    QVERIFY(moved > 100);
+}
+
+void CalibrationTest::refineCancel() {
+    QVector<double> x, y, z;
+    capture(3000, 7, x, y, z);
+    const auto start = CalLib::calibrate(x, y, z);
+    std::atomic<bool> cancel(true);
+    RefineOptions options;
+    options.cancel = &cancel;
+    QVERIFY_EXCEPTION_THROWN(CalLib::refine(x, y, z, start.first,
+                                            start.second, QVector<bool>(),
+                                            options),
+                             std::runtime_error);
+}
+
+void CalibrationTest::subsampleBins() {
+    QVector<double> x, y, z;
+    clustered_capture(20000, 8, x, y, z);
+    const QVector<double> raw_x = x, raw_y = y, raw_z = z;
+
+    // one bin per cube face at resolution 1: the dominant axis of the
+    // direction from the middle of the bounding box
+    SubsampleOptions options;
+    options.resolution = 1;
+    options.per_bin = 50;
+    QCOMPARE(CalLib::subsample(x, y, z, options), 6);
+    QCOMPARE(x.size(), 6 * options.per_bin);
+    double center[3];
+    const QVector<double>* raw[3] = {&raw_x, &raw_y, &raw_z};
+    for (int k = 0; k < 3; k++) {
+        const auto range = std::minmax_element(raw[k]->begin(), raw[k]->end());
+        center[k] = (*range.first + *range.second) / 2;
+    }
+    int faces[6] = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < x.size(); i++) {
+        const double d[3] = {x[i] - center[0], y[i] - center[1],
+                             z[i] - center[2]};
+        int axis = 0;
+        for (int k = 1; k < 3; k++)
+            if (std::fabs(d[k]) > std::fabs(d[axis])) axis = k;
+        faces[2 * axis + (d[axis] > 0 ? 0 : 1)]++;
+    }
+    for (int face : faces)
+        QVERIFY(face <= options.per_bin);
+
+    // the kept samples are a subsequence of the capture
+    x = raw_x;
+    y = raw_y;
+    z = raw_z;
+    options = SubsampleOptions();
+    const int occupied = CalLib::subsample(x, y, z, options);
+    QVERIFY(occupied > 0 && x.size() <= occupied * options.per_bin);
+    QVERIFY(x.size() < raw_x.size() / 4);
+    int next = 0;
+    for (int i = 0; i < x.size(); i++) {
+        while (next < raw_x.size() &&
+               !(raw_x[next] == x[i] && raw_y[next] == y[i] &&
+                 raw_z[next] == z[i]))
+            next++;
+        QVERIFY2(next < raw_x.size(),
+                 qPrintable(QString("kept sample %1 out of order").arg(i)));
+        next++;
+    }
+}
+
+void CalibrationTest::subsampleSeed() {
+    QVector<double> x, y, z;
+    clustered_capture(20000, 9, x, y, z);
+    QVector<double> a_x = x, a_y = y, a_z = z;
+    QVector<double> b_x = x, b_y = y, b_z = z;
+    QVector<double> c_x = x, c_y = y, c_z = z;
+    SubsampleOptions options;
+    CalLib::subsample(a_x, a_y, a_z, options);
+    CalLib::subsample(b_x, b_y, b_z, options);
+    QVERIFY(a_x == b_x && a_y == b_y && a_z == b_z);
+    options.seed = 2;
+    CalLib::subsample(c_x, c_y, c_z, options);
+    QCOMPARE(c_x.size(), a_x.size());
+    QVERIFY(!(c_x == a_x));
+}
+
+void CalibrationTest::subsampleFit() {
+    // the cluster outweighs the rest of the sphere in the least squares
+    // and drags the fit, one reservoir per direction bin evens it out
+    QVector<double> x, y, z;
+    clustered_capture(50000, 10, x, y, z);
+    const auto clustered = CalLib::calibrate(x, y, z);
+    CalLib::subsample(x, y, z);
+    const auto reduced = CalLib::calibrate(x, y, z);
+
+    double clustered_error = 0;
+    double reduced_error = 0;
+    for (int k = 0; k < 3; k++) {
+        clustered_error += std::fabs(clustered.first[k] - offset[k]) +
+            std::fabs(clustered.second[k] - scale[k]);
+        reduced_error += std::fabs(reduced.first[k] - offset[k]) +
+            std::fabs(reduced.second[k] - scale[k]);
+    }
+    QVERIFY2(reduced_error < clustered_error / 2,
+             qPrintable(QString("error %1 reduced, %2 clustered")
+                            .arg(reduced_error)
+                            .arg(clustered_error)));
+}
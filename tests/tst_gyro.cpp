@@ -0,0 +1,153 @@
+#include "tests.h"
+#include "gyrocalibrator.h"
+
+#include <QtTest>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+
+// per-axis mean and sum of squared deviations, two passes in long double
+void two_pass(const std::vector<double>& values, double mean[3],
+              double m2[3]) {
+    const long n = values.size() / 3;
+    for (int k = 0; k < 3; k++) {
+        long double sum = 0;
+        for (long i = 0; i < n; i++)
+            sum += values[3 * i + k];
+        const long double m = sum / n;
+        long double squares = 0;
+        for (long i = 0; i < n; i++)
+            squares += (values[3 * i + k] - m) * (values[3 * i + k] - m);
+        mean[k] = static_cast<double>(m);
+        m2[k] = static_cast<double>(squares);
+    }
+}
+
+// a large offset over a small spread, where the naive sum of squares
+// cancels
+std::vector<double> readings(int n, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> normal(0, 3);
+    std::vector<double> values(3 * n);
+    for (int i = 0; i < n; i++) {
+        values[3 * i] = 1e6 + normal(rng);
+        values[3 * i + 1] = -250 + normal(rng);
+        values[3 * i + 2] = 7 + normal(rng);
+    }
+    return values;
+}
+
+bool close(double actual, double expected, double tolerance) {
+    return std::fabs(actual - expected) <=
+        tolerance * std::max(1.0, std::fabs(expected));
+}
+
+} // namespace
+
+void GyroTest::welford() {
+    const std::vector<double> values = readings(5000, 1);
+    RunningStats stats;
+    for (size_t i = 0; i < values.size(); i += 3)
+        stats.add(&values[i]);
+
+    double mean[3], m2[3];
+    two_pass(values, mean, m2);
+    QCOMPARE(stats.count, 5000L);
+    for (int k = 0; k < 3; k++) {
+        QVERIFY(close(stats.mean[k], mean[k], 1e-12));
+        QVERIFY(close(stats.m2[k], m2[k], 1e-9));
+        QVERIFY(close(stats.variance(k), m2[k] / 4999, 1e-9));
+    }
+
+    RunningStats one;
+    one.add(&values[0]);
+    QCOMPARE(one.variance(0), 0.0);
+    one.clear();
+    QCOMPARE(one.count, 0L);
+    QCOMPARE(one.mean[0], 0.0);
+}
+
+void GyroTest::chanMerge() {
+    const std::vector<double> values = readings(3001, 2);
+    RunningStats whole;
+    for (size_t i = 0; i < values.size(); i += 3)
+        whole.add(&values[i]);
+
+    // uneven splits, including an empty side and a single sample
+    const int splits[] = {0, 1, 64, 1500, 3000, 3001};
+    for (int split : splits) {
+        RunningStats left, right;
+        for (int i = 0; i < 3001; i++)
+            (i < split ? left : right).add(&values[3 * i]);
+        RunningStats merged = left;
+        merged.merge(right);
+        QCOMPARE(merged.count, whole.count);
+        for (int k = 0; k < 3; k++) {
+            QVERIFY2(close(merged.mean[k], whole.mean[k], 1e-12),
+                     qPrintable(QString("split %1").arg(split)));
+            QVERIFY2(close(merged.m2[k], whole.m2[k], 1e-9),
+                     qPrintable(QString("split %1").arg(split)));
+        }
+    }
+
+    // many windows folded in one by one, as GyroCalibrator does
+    RunningStats folded;
+    for (int start = 0; start < 3001; start += 64) {
+        RunningStats window;
+        for (int i = start; i < std::min(start + 64, 3001); i++)
+            window.add(&values[3 * i]);
+        folded.merge(window);
+    }
+    QCOMPARE(folded.count, whole.count);
+    for (int k = 0; k < 3; k++) {
+        QVERIFY(close(folded.mean[k], whole.mean[k], 1e-12));
+        QVERIFY(close(folded.m2[k], whole.m2[k], 1e-9));
+    }
+}
+
+void GyroTest::biasAndNoise() {
+    std::mt19937 rng(3);
+    std::normal_distribution<double> noise(0, 2);
+    const double bias[3] = {12, -7, 3};
+    const double gravity[3] = {0, 0, 16384};
+
+    GyroCalibrator calibrator;
+    calibrator.set_sample_rate(200);
+    double out[3];
+    QVERIFY(!calibrator.bias(out));
+    QVERIFY(!calibrator.noise(out));
+
+    // still stretches between rotations, which must not move the bias
+    const int windows = StillnessDetector::window;
+    for (int segment = 0; segment < 10; segment++) {
+        const bool moving = segment % 2;
+        for (int i = 0; i < 8 * windows; i++) {
+            double gyro[3], acc[3];
+            for (int k = 0; k < 3; k++) {
+                gyro[k] = bias[k] + noise(rng) +
+                    (moving ? 3000 * std::sin(0.05 * i + k) : 0);
+                acc[k] = gravity[k] + noise(rng) +
+                    (moving ? 4000 * std::cos(0.03 * i + k) : 0);
+            }
+            calibrator.add(gyro, acc);
+        }
+    }
+
+    QCOMPARE(calibrator.samples(), 80L * windows);
+    QCOMPARE(calibrator.stationary_samples(), 40L * windows);
+    QVERIFY(calibrator.bias(out));
+    for (int k = 0; k < 3; k++)
+        QVERIFY(std::fabs(out[k] - bias[k]) < 0.2);
+    QVERIFY(calibrator.noise(out));
+    for (int k = 0; k < 3; k++)
+        QVERIFY(std::fabs(out[k] - 2) < 0.1);
+    QVERIFY(calibrator.noise_density(out));
+    for (int k = 0; k < 3; k++)
+        QVERIFY(std::fabs(out[k] - 2 / std::sqrt(100.0)) < 0.01);
+
+    calibrator.clear();
+    QCOMPARE(calibrator.samples(), 0L);
+    QVERIFY(!calibrator.bias(out));
+}
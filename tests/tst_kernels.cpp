@@ -0,0 +1,370 @@
+#include "tests.h"
+#include "calkernels.h"
+#include "matrix.h"
+#include "simd.h"
+
+#include <QCoreApplication>
+#include <QProcess>
+#include <QtTest>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using matrices::Matrix;
+namespace kernels = matrices::kernels;
+
+namespace {
+
+std::vector<double> random_values(int count, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> value(-1, 1);
+    std::vector<double> values(count);
+    for (double& v : values)
+        v = value(rng);
+    return values;
+}
+
+// op(A) * op(B) the obvious way, in long double
+std::vector<double> reference(bool transA, bool transB, int m, int n, int k,
+                              const double* a, int lda, const double* b,
+                              int ldb) {
+    std::vector<double> c(m * n);
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < n; j++) {
+            long double sum = 0;
+            for (int p = 0; p < k; p++) {
+                const long double x = transA ? a[p * lda + i] : a[i * lda + p];
+                sum += x * (transB ? b[j * ldb + p] : b[p * ldb + j]);
+            }
+            c[i * n + j] = static_cast<double>(sum);
+        }
+    return c;
+}
+
+// the terms are below 1, so a sum of k of them is off by less than k^2 ulps
+// whatever order the kernel adds them in
+bool close(const double* actual, int ldc, const std::vector<double>& expected,
+           int m, int n, int k) {
+    const double tolerance = 4e-16 * k * k;
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < n; j++)
+            if (!(std::fabs(actual[i * ldc + j] - expected[i * n + j]) <=
+                  tolerance))
+                return false;
+    return true;
+}
+
+// edge sizes around the register and cache blocks, and a product large
+// enough to be split over the thread pool
+const int shapes[][3] = {{1, 1, 1},   {3, 5, 7},     {8, 8, 8},
+                         {17, 9, 33}, {65, 31, 129}, {130, 257, 64},
+                         {200, 210, 220}};
+
+// lengths that leave the 2, 4, 8 and 16 lane loops a partial tail
+const int lengths[] = {0, 1, 3, 5, 7, 9, 15, 17, 31, 33, 1001};
+
+// an offset and a sheared, scaled matrix, so every term counts
+calkernels::Transform transform() {
+    return {{12.5, -40.25, 7},
+            {1.1, 0.02, -0.03, 0.01, 0.95, 0.04, -0.02, 0.03, 1.05}};
+}
+
+// out = matrix * (raw - offset) the obvious way, in long double
+template <class In>
+std::vector<double> reference(const calkernels::Transform& t, const In* x,
+                              const In* y, const In* z, int n) {
+    std::vector<double> out(3 * n);
+    for (int i = 0; i < n; i++) {
+        const long double d[3] = {x[i] - (long double) t.offset[0],
+                                  y[i] - (long double) t.offset[1],
+                                  z[i] - (long double) t.offset[2]};
+        for (int r = 0; r < 3; r++)
+            out[r * n + i] = static_cast<double>(t.matrix[3 * r] * d[0] +
+                                                 t.matrix[3 * r + 1] * d[1] +
+                                                 t.matrix[3 * r + 2] * d[2]);
+    }
+    return out;
+}
+
+// outputs within tolerance of the reference, and the sentinel past the
+// end untouched
+template <class Out>
+bool close(const std::vector<Out> (&out)[3],
+           const std::vector<double>& expected, int n, double tolerance) {
+    for (int r = 0; r < 3; r++) {
+        for (int i = 0; i < n; i++)
+            if (!(std::fabs(out[r][i] - expected[r * n + i]) <= tolerance))
+                return false;
+        if (out[r][n] != Out(42)) return false;
+    }
+    return true;
+}
+
+QString at(int n) {
+    return QString("n %1 at %2").arg(n).arg(simd::name(simd::active()));
+}
+
+} // namespace
+
+void KernelTest::gemm() {
+    for (const auto& shape : shapes) {
+        const int m = shape[0], n = shape[1], k = shape[2];
+        // padded leading dimensions, the kernels must not touch the gaps
+        const int lda = k + 3, ldb = n + 1, ldc = n + 2;
+        const std::vector<double> a = random_values(m * lda, m);
+        const std::vector<double> b = random_values(k * ldb, n);
+        std::vector<double> c(m * ldc, 42);
+        kernels::gemm(m, n, k, a.data(), lda, b.data(), ldb, c.data(), ldc);
+        QVERIFY2(close(c.data(), ldc,
+                       reference(false, false, m, n, k, a.data(), lda,
+                                 b.data(), ldb),
+                       m, n, k),
+                 qPrintable(QString("%1x%2x%3 at %4")
+                                .arg(m)
+                                .arg(n)
+                                .arg(k)
+                                .arg(simd::name(simd::active()))));
+        for (int i = 0; i < m; i++)
+            for (int j = n; j < ldc; j++)
+                QCOMPARE(c[i * ldc + j], 42.0);
+    }
+}
+
+void KernelTest::gemmTransposed() {
+    for (const auto& shape : shapes) {
+        const int m = shape[0], n = shape[1], k = shape[2];
+        for (int flags = 0; flags < 4; flags++) {
+            const bool transA = flags & 1, transB = flags & 2;
+            const int lda = transA ? m : k, ldb = transB ? k : n;
+            const std::vector<double> a =
+                random_values((transA ? k : m) * lda, k);
+            const std::vector<double> b =
+                random_values((transB ? n : k) * ldb, m + n);
+            std::vector<double> c(m * n);
+            kernels::gemm(transA, transB, m, n, k, a.data(), lda, b.data(),
+                          ldb, c.data(), n);
+            QVERIFY2(close(c.data(), n,
+                           reference(transA, transB, m, n, k, a.data(), lda,
+                                     b.data(), ldb),
+                           m, n, k),
+                     qPrintable(QString("%1x%2x%3, flags %4 at %5")
+                                    .arg(m)
+                                    .arg(n)
+                                    .arg(k)
+                                    .arg(flags)
+                                    .arg(simd::name(simd::active()))));
+        }
+    }
+}
+
+void KernelTest::syrk() {
+    const int shapes[][2] = {{1, 1}, {5, 3}, {100, 6}, {33, 17}, {500, 70}};
+    for (const auto& shape : shapes) {
+        const int m = shape[0], n = shape[1];
+        const std::vector<double> a = random_values(m * n, m + n);
+        std::vector<double> c(n * n);
+        kernels::syrk(m, n, a.data(), n, c.data(), n);
+        QVERIFY2(close(c.data(), n,
+                       reference(true, false, n, n, m, a.data(), n, a.data(),
+                                 n),
+                       n, n, m),
+                 qPrintable(QString("%1x%2 at %3")
+                                .arg(m)
+                                .arg(n)
+                                .arg(simd::name(simd::active()))));
+        // the mirrored half is an exact copy
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < i; j++)
+                QCOMPARE(c[i * n + j], c[j * n + i]);
+    }
+}
+
+void KernelTest::matrixProducts() {
+    const int m = 70, n = 40, k = 90;
+    Matrix<double> a(k, m), b(n, k);
+    a.inner_ = random_values(m * k, 1);
+    b.inner_ = random_values(k * n, 2);
+
+    const Matrix<double> product = a * b;
+    QVERIFY(close(product.inner_.data(), n,
+                  reference(false, false, m, n, k, a.inner_.data(), k,
+                            b.inner_.data(), n),
+                  m, n, k));
+
+    const Matrix<double> gram = a.gram();
+    QVERIFY(close(gram.inner_.data(), k,
+                  reference(true, false, k, k, m, a.inner_.data(), k,
+                            a.inner_.data(), k),
+                  k, k, m));
+
+    const Matrix<double> transposed = a.transpose() * a;
+    QCOMPARE(transposed.rows(), k);
+    QVERIFY(close(transposed.inner_.data(), k,
+                  reference(true, false, k, k, m, a.inner_.data(), k,
+                            a.inner_.data(), k),
+                  k, k, m));
+}
+
+void KernelTest::apply() {
+    const calkernels::Transform t = transform();
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<int> reading(-32768, 32767);
+    for (int n : lengths) {
+        // readings of a few hundred counts and the full int16 range
+        std::vector<double> in[3];
+        std::vector<short> raw[3];
+        for (int r = 0; r < 3; r++) {
+            in[r] = random_values(n, 10 * n + r);
+            for (double& v : in[r])
+                v *= 500;
+            raw[r].resize(n);
+            for (short& v : raw[r])
+                v = static_cast<short>(reading(rng));
+            if (n > 0) raw[r][0] = r ? 32767 : -32768;
+        }
+
+        // the terms reach 4e4, where a double ulp is 7e-12
+        std::vector<double> out[3];
+        for (auto& o : out)
+            o.assign(n + 1, 42);
+        calkernels::apply(t, in[0].data(), in[1].data(), in[2].data(),
+                          out[0].data(), out[1].data(), out[2].data(), n);
+        QVERIFY2(close(out,
+                       reference(t, in[0].data(), in[1].data(), in[2].data(),
+                                 n),
+                       n, 1e-10),
+                 qPrintable("double " + at(n)));
+
+        // in place gives the same values bit for bit
+        std::vector<double> inPlace[3];
+        for (int r = 0; r < 3; r++) {
+            inPlace[r] = in[r];
+            inPlace[r].push_back(42);
+        }
+        calkernels::apply(t, inPlace[0].data(), inPlace[1].data(),
+                          inPlace[2].data(), n);
+        for (int r = 0; r < 3; r++)
+            QVERIFY2(inPlace[r] == out[r], qPrintable("in place " + at(n)));
+
+        const std::vector<double> expected =
+            reference(t, raw[0].data(), raw[1].data(), raw[2].data(), n);
+        for (auto& o : out)
+            o.assign(n + 1, 42);
+        calkernels::apply(t, raw[0].data(), raw[1].data(), raw[2].data(),
+                          out[0].data(), out[1].data(), out[2].data(), n);
+        QVERIFY2(close(out, expected, n, 1e-10),
+                 qPrintable("int16 to double " + at(n)));
+
+        // the float kernels compute in single precision, and the terms
+        // reach 4e4 where a float ulp is 4e-3
+        std::vector<float> single[3];
+        for (auto& o : single)
+            o.assign(n + 1, 42);
+        calkernels::apply(t, raw[0].data(), raw[1].data(), raw[2].data(),
+                          single[0].data(), single[1].data(),
+                          single[2].data(), n);
+        QVERIFY2(close(single, expected, n, 0.02),
+                 qPrintable("int16 to float " + at(n)));
+    }
+}
+
+void KernelTest::quadricMoments() {
+    for (int n : lengths) {
+        const std::vector<double> x = random_values(n, 3 * n);
+        const std::vector<double> y = random_values(n, 3 * n + 1);
+        const std::vector<double> z = random_values(n, 3 * n + 2);
+
+        // the kernel adds to the sums it is given
+        long double expected[calkernels::quadricSums];
+        double sums[calkernels::quadricSums];
+        for (int k = 0; k < calkernels::quadricSums; k++)
+            expected[k] = sums[k] = k;
+        for (int s = 0; s < n; s++) {
+            const long double d[calkernels::quadricTerms] = {
+                x[s] * x[s],     y[s] * y[s],     z[s] * z[s], 2 * y[s] * z[s],
+                2 * x[s] * z[s], 2 * x[s] * y[s], 2 * x[s],    2 * y[s],
+                2 * z[s],        1};
+            long double* sum = expected;
+            for (int i = 0; i < calkernels::quadricTerms; i++)
+                for (int j = i; j < calkernels::quadricTerms; j++)
+                    *sum++ += d[i] * d[j];
+        }
+        calkernels::quadricMoments(x.data(), y.data(), z.data(), n, sums);
+
+        // the products are below 16, each sum is off by a few ulps of 16
+        // per sample whatever order the lanes add them in
+        for (int k = 0; k < calkernels::quadricSums; k++)
+            QVERIFY2(std::fabs(sums[k] - static_cast<double>(expected[k])) <=
+                         1e-14 * (n + 1),
+                     qPrintable(QString("sum %1, ").arg(k) + at(n)));
+    }
+}
+
+void KernelTest::ellipsoidMoments() {
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> drawn(0, 4);
+    for (int n : lengths) {
+        const std::vector<double> x = random_values(n, 5 * n);
+        const std::vector<double> y = random_values(n, 5 * n + 1);
+        const std::vector<double> z = random_values(n, 5 * n + 2);
+        std::vector<unsigned char> copies(n);
+        // bootstrap counts, zeros included, and the largest a byte holds
+        for (unsigned char& c : copies)
+            c = static_cast<unsigned char>(drawn(rng));
+        if (n > 1) copies[n / 2] = 255;
+
+        long double expected[calkernels::ellipsoidSums];
+        double sums[calkernels::ellipsoidSums];
+        for (int k = 0; k < calkernels::ellipsoidSums; k++)
+            expected[k] = sums[k] = k;
+        long double total = 0;
+        for (int s = 0; s < n; s++) {
+            const long double h[calkernels::ellipsoidTerms] = {
+                x[s], y[s], z[s], -y[s] * y[s], -z[s] * z[s], 1};
+            const long double w = x[s] * x[s];
+            long double* sum = expected;
+            for (int i = 0; i < calkernels::ellipsoidTerms; i++) {
+                for (int j = i; j < calkernels::ellipsoidTerms; j++)
+                    *sum++ += copies[s] * h[i] * h[j];
+                expected[calkernels::ellipsoidSums -
+                         calkernels::ellipsoidTerms + i] +=
+                    copies[s] * h[i] * w;
+            }
+            total += copies[s];
+        }
+        calkernels::ellipsoidMoments(x.data(), y.data(), z.data(),
+                                     copies.data(), n, sums);
+
+        // the products are at most 1, each weighted sum is off by a few
+        // ulps per copy whatever order the lanes add them in
+        for (int k = 0; k < calkernels::ellipsoidSums; k++)
+            QVERIFY2(std::fabs(sums[k] - static_cast<double>(expected[k])) <=
+                         1e-15 * (static_cast<double>(total) + k + 1),
+                     qPrintable(QString("sum %1, ").arg(k) + at(n)));
+    }
+}
+
+void KernelTest::levels() {
+    // the child processes run every test at one level, including this one,
+    // which then has nothing to do
+    if (qEnvironmentVariableIsSet("FREEIMU_SIMD"))
+        QSKIP("FREEIMU_SIMD is set, this run covers a single level");
+
+    for (int level = simd::Scalar; level < simd::detected(); level++) {
+        const char* name = simd::name(simd::Level(level));
+        QProcessEnvironment environment =
+            QProcessEnvironment::systemEnvironment();
+        environment.insert("FREEIMU_SIMD", name);
+        QProcess child;
+        child.setProcessEnvironment(environment);
+        child.setProcessChannelMode(QProcess::MergedChannels);
+        child.start(QCoreApplication::applicationFilePath(), QStringList());
+        QVERIFY(child.waitForFinished(10 * 60 * 1000));
+        QVERIFY2(child.exitStatus() == QProcess::NormalExit &&
+                     child.exitCode() == 0,
+                 qPrintable(QString("FREEIMU_SIMD=%1\n%2")
+                                .arg(name)
+                                .arg(QString::fromLocal8Bit(
+                                    child.readAll()))));
+    }
+}
@@ -0,0 +1,332 @@
+#include "tests.h"
+#include "matrix.h"
+
+#include <QtTest>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using matrices::Cholesky;
+using matrices::LU;
+using matrices::LeastSquaresQR;
+using matrices::Matrix;
+
+namespace {
+
+Matrix<double> random_matrix(int rows, int cols, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> value(-1, 1);
+    Matrix<double> m(cols, rows);
+    for (double& element : m.inner_)
+        element = value(rng);
+    return m;
+}
+
+// A^T A + n I, symmetric positive definite and well conditioned
+Matrix<double> random_spd(int n, unsigned seed) {
+    const Matrix<double> a = random_matrix(n, n, seed);
+    Matrix<double> spd(n, n);
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++) {
+            double sum = i == j ? n : 0;
+            for (int k = 0; k < n; k++)
+                sum += a.coeff(k, i) * a.coeff(k, j);
+            spd.inner_[i * n + j] = sum;
+        }
+    return spd;
+}
+
+Matrix<double> minor_of(const Matrix<double>& m, int row, int col) {
+    const int n = m.rows();
+    Matrix<double> minor(n - 1, n - 1);
+    for (int i = 0, r = 0; i < n; i++) {
+        if (i == row) continue;
+        for (int j = 0, c = 0; j < n; j++) {
+            if (j == col) continue;
+            minor.inner_[r * (n - 1) + c++] = m.coeff(i, j);
+        }
+        r++;
+    }
+    return minor;
+}
+
+// the Laplace expansion the factorizations replaced, the reference here
+double cofactor_determinant(const Matrix<double>& m) {
+    const int n = m.rows();
+    if (n == 1) return m.coeff(0, 0);
+    double det = 0;
+    for (int j = 0; j < n; j++) {
+        const double sign = j % 2 ? -1 : 1;
+        det += sign * m.coeff(0, j) * cofactor_determinant(minor_of(m, 0, j));
+    }
+    return det;
+}
+
+// adjugate / determinant
+Matrix<double> cofactor_inverse(const Matrix<double>& m) {
+    const int n = m.rows();
+    const double det = cofactor_determinant(m);
+    Matrix<double> inverse(n, n);
+    if (n == 1) {
+        inverse.inner_[0] = 1 / det;
+        return inverse;
+    }
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++) {
+            const double sign = (i + j) % 2 ? -1 : 1;
+            inverse.inner_[j * n + i] =
+                sign * cofactor_determinant(minor_of(m, i, j)) / det;
+        }
+    return inverse;
+}
+
+bool close(double actual, double expected, double tolerance = 1e-9) {
+    return std::fabs(actual - expected) <=
+        tolerance * std::max(1.0, std::fabs(expected));
+}
+
+bool close(const Matrix<double>& actual, const Matrix<double>& expected,
+           double tolerance = 1e-9) {
+    if (actual.rows() != expected.rows() || actual.cols() != expected.cols())
+        return false;
+    for (int i = 0; i < actual.rows(); i++)
+        for (int j = 0; j < actual.cols(); j++)
+            if (!close(actual.coeff(i, j), expected.coeff(i, j), tolerance))
+                return false;
+    return true;
+}
+
+} // namespace
+
+void MatrixTest::luInverse() {
+    for (int n = 1; n <= 6; n++) {
+        Matrix<double> m = random_matrix(n, n, 10 + n);
+        QVERIFY2(close(LU<double>(m).inverse(), cofactor_inverse(m)),
+                 qPrintable(QString("n = %1").arg(n)));
+        QVERIFY(close(m.invert(), cofactor_inverse(m)));
+    }
+}
+
+void MatrixTest::luDeterminant() {
+    for (int n = 1; n <= 7; n++) {
+        Matrix<double> m = random_matrix(n, n, 20 + n);
+        QVERIFY(close(LU<double>(m).determinant(), cofactor_determinant(m)));
+        QVERIFY(close(m.getDeterminant(), cofactor_determinant(m)));
+    }
+    // a row swap flips the sign
+    Matrix<double> swap(2, 2);
+    swap.inner_ = {0, 1, 1, 0};
+    QCOMPARE(LU<double>(swap).determinant(), -1.0);
+}
+
+void MatrixTest::luSingular() {
+    Matrix<double> m(3, 3);
+    m.inner_ = {1, 2, 3, 2, 4, 6, 1, 0, 1};
+    LU<double> lu(m);
+    QVERIFY(lu.isSingular());
+    QCOMPARE(lu.determinant(), 0.0);
+    QVERIFY_EXCEPTION_THROWN(lu.inverse(), std::domain_error);
+    QVERIFY_EXCEPTION_THROWN(LU<double>(Matrix<double>(2, 3)),
+                             std::invalid_argument);
+}
+
+void MatrixTest::choleskyInverse() {
+    for (int n = 1; n <= 6; n++) {
+        const Matrix<double> m = random_spd(n, 30 + n);
+        Cholesky<double> cholesky(m);
+        QVERIFY(cholesky.isPositiveDefinite());
+        QVERIFY(close(cholesky.inverse(), cofactor_inverse(m)));
+    }
+}
+
+void MatrixTest::choleskyDeterminant() {
+    for (int n = 1; n <= 7; n++) {
+        const Matrix<double> m = random_spd(n, 40 + n);
+        QVERIFY(close(Cholesky<double>(m).determinant(),
+                      cofactor_determinant(m)));
+        QVERIFY(close(Cholesky<double>(m).determinant(),
+                      LU<double>(m).determinant()));
+    }
+}
+
+void MatrixTest::choleskyNotPositiveDefinite() {
+    Matrix<double> m(2, 2);
+    m.inner_ = {1, 2, 2, 1}; // eigenvalues 3 and -1
+    Cholesky<double> cholesky(m);
+    QVERIFY(!cholesky.isPositiveDefinite());
+    QVERIFY_EXCEPTION_THROWN(cholesky.determinant(), std::domain_error);
+}
+
+void MatrixTest::qrSolve() {
+    // an exactly consistent overdetermined system recovers its solution
+    const int k = 4;
+    const std::vector<double> truth = {1.5, -2, 0.25, 3};
+    const Matrix<double> a = random_matrix(500, k, 50);
+    LeastSquaresQR<double> qr(k, 16);
+    for (int i = 0; i < a.rows(); i++) {
+        double target = 0;
+        for (int j = 0; j < k; j++)
+            target += a.coeff(i, j) * truth[j];
+        qr.addRow(&a.inner_[i * k], target);
+    }
+    QCOMPARE(qr.rows(), 500L);
+    std::vector<double> solution;
+    QVERIFY(qr.solve(solution));
+    for (int j = 0; j < k; j++)
+        QVERIFY(close(solution[j], truth[j], 1e-10));
+    QVERIFY(qr.residualNorm() < 1e-10);
+
+    // fewer rows than unknowns, and a repeated column
+    LeastSquaresQR<double> few(k);
+    few.addRow(&a.inner_[0], 1);
+    QVERIFY(!few.solve(solution));
+    LeastSquaresQR<double> deficient(2);
+    for (int i = 0; i < 10; i++) {
+        const double row[2] = {double(i), double(i)};
+        deficient.addRow(row, i);
+    }
+    QVERIFY(!deficient.solve(solution));
+}
+
+void MatrixTest::qrMerge() {
+    // the normal equations of a noisy system give the reference, and a
+    // split and merged problem the same answer as a single one
+    const int k = 3;
+    const Matrix<double> a = random_matrix(300, k, 60);
+    std::mt19937 rng(61);
+    std::normal_distribution<double> noise(0, 0.1);
+    std::vector<double> b(a.rows());
+    for (double& target : b)
+        target = 1 + noise(rng);
+
+    LeastSquaresQR<double> whole(k), first(k, 7), second(k, 5);
+    for (int i = 0; i < a.rows(); i++) {
+        whole.addRow(&a.inner_[i * k], b[i]);
+        (i < 120 ? first : second).addRow(&a.inner_[i * k], b[i]);
+    }
+    first.merge(second);
+    QCOMPARE(first.rows(), whole.rows());
+
+    Matrix<double> ata(k, k);
+    std::vector<double> atb(k, 0);
+    for (int i = 0; i < a.rows(); i++)
+        for (int r = 0; r < k; r++) {
+            atb[r] += a.coeff(i, r) * b[i];
+            for (int c = 0; c < k; c++)
+                ata.inner_[r * k + c] += a.coeff(i, r) * a.coeff(i, c);
+        }
+    const std::vector<double> reference = LU<double>(ata).solve(atb);
+
+    std::vector<double> merged, single;
+    QVERIFY(first.solve(merged));
+    QVERIFY(whole.solve(single));
+    for (int j = 0; j < k; j++) {
+        QVERIFY(close(single[j], reference[j], 1e-10));
+        QVERIFY(close(merged[j], reference[j], 1e-10));
+    }
+    QVERIFY(close(first.residualNorm(), whole.residualNorm(), 1e-10));
+}
+
+void MatrixTest::qrCovariance() {
+    // s^2 (A^T A)^-1
+    const int k = 3;
+    const Matrix<double> a = random_matrix(50, k, 70);
+    std::mt19937 rng(71);
+    std::normal_distribution<double> noise(0, 1);
+    LeastSquaresQR<double> qr(k);
+    Matrix<double> ata(k, k);
+    for (int i = 0; i < a.rows(); i++) {
+        qr.addRow(&a.inner_[i * k], noise(rng));
+        for (int r = 0; r < k; r++)
+            for (int c = 0; c < k; c++)
+                ata.inner_[r * k + c] += a.coeff(i, r) * a.coeff(i, c);
+    }
+    const double residual = qr.residualNorm();
+    Matrix<double> expected = cofactor_inverse(ata);
+    expected *= residual * residual / (a.rows() - k);
+    QVERIFY(close(qr.covariance(), expected, 1e-9));
+
+    LeastSquaresQR<double> exact(k);
+    for (int i = 0; i < k; i++)
+        exact.addRow(&a.inner_[i * k], 0);
+    QVERIFY_EXCEPTION_THROWN(exact.covariance(), std::domain_error);
+}
+
+void MatrixTest::views() {
+    Matrix<double> m(4, 3); // 3 rows, 4 columns
+    for (int i = 0; i < 12; i++)
+        m.inner_[i] = i;
+
+    const auto row = m.row(1);
+    QCOMPARE(row.size(), 4);
+    QCOMPARE(row[2], 6.0);
+    const auto col = m.col(3);
+    QCOMPARE(col.size(), 3);
+    QCOMPARE(col[2], 11.0);
+
+    const auto block = m.block(1, 1, 2, 2);
+    QCOMPARE(block(0, 0), 5.0);
+    QCOMPARE(block(1, 1), 10.0);
+    QCOMPARE(block.transposed()(0, 1), 9.0);
+    QCOMPARE(block.col(1)[1], 10.0);
+
+    // views alias the storage
+    m.row(0)[0] = -1;
+    QCOMPARE(m.coeff(0, 0), -1.0);
+    block(0, 0) = -5;
+    QCOMPARE(m.coeff(1, 1), -5.0);
+
+    QVERIFY_EXCEPTION_THROWN(m.row(3), std::out_of_range);
+    QVERIFY_EXCEPTION_THROWN(m.col(-1), std::out_of_range);
+    QVERIFY_EXCEPTION_THROWN(m.block(2, 2, 2, 2), std::out_of_range);
+}
+
+void MatrixTest::viewAssignment() {
+    Matrix<double> m(3, 3);
+    for (int i = 0; i < 9; i++)
+        m.inner_[i] = i;
+    const Matrix<double> original(m);
+
+    // the right hand side is evaluated first, so an overlapping swap works
+    m.row(0) = original.row(2);
+    m.row(2) = original.row(0);
+    for (int j = 0; j < 3; j++) {
+        QCOMPARE(m.coeff(0, j), original.coeff(2, j));
+        QCOMPARE(m.coeff(2, j), original.coeff(0, j));
+    }
+    m = original;
+    m.view() = m.view().transposed();
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            QCOMPARE(m.coeff(i, j), original.coeff(j, i));
+
+    QVERIFY_EXCEPTION_THROWN(m.row(0) = original.col(0), std::invalid_argument);
+}
+
+void MatrixTest::transpose() {
+    // sizes around the recursion leaf of the cache-oblivious kernel
+    const int sizes[][2] = {{1, 1}, {1, 17}, {15, 16}, {33, 17}, {64, 100}};
+    for (const auto& size : sizes) {
+        const Matrix<double> m = random_matrix(size[0], size[1], size[0]);
+        const Matrix<double> t(m.transpose());
+        QCOMPARE(t.rows(), m.cols());
+        QCOMPARE(t.cols(), m.rows());
+        for (int i = 0; i < m.rows(); i++)
+            for (int j = 0; j < m.cols(); j++)
+                QCOMPARE(t.coeff(j, i), m.coeff(i, j));
+    }
+}
+
+void MatrixTest::transposeInPlace() {
+    const int sizes[][2] = {{1, 1}, {16, 16}, {37, 37}, {5, 40}, {70, 3}};
+    for (const auto& size : sizes) {
+        const Matrix<double> m = random_matrix(size[0], size[1], size[1]);
+        Matrix<double> t(m);
+        t.transposeInPlace();
+        QCOMPARE(t.rows(), m.cols());
+        QCOMPARE(t.cols(), m.rows());
+        for (int i = 0; i < m.rows(); i++)
+            for (int j = 0; j < m.cols(); j++)
+                QCOMPARE(t.coeff(j, i), m.coeff(i, j));
+    }
+}
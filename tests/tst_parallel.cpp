@@ -0,0 +1,185 @@
+#include "tests.h"
+#include "parallel.h"
+
+#include <QtTest>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// runs [0, count) in the given number of chunks and checks that every index
+// is visited once, in contiguous chunks that cover the range in order
+bool covers(int count, int chunks) {
+    std::vector<std::atomic<int>> visits(count);
+    for (auto& v : visits)
+        v.store(0);
+    std::vector<int> bounds(2 * chunks, -1);
+    const int used = parallel::forChunks(
+        count, chunks, [&](int begin, int end, int chunk) {
+            bounds[2 * chunk] = begin;
+            bounds[2 * chunk + 1] = end;
+            for (int i = begin; i < end; i++)
+                visits[i]++;
+        });
+    if (used != std::min(count, chunks)) return false;
+    int next = 0;
+    for (int c = 0; c < used; c++) {
+        if (bounds[2 * c] != next || bounds[2 * c + 1] <= next) return false;
+        next = bounds[2 * c + 1];
+    }
+    if (next != count) return false;
+    for (auto& v : visits)
+        if (v.load() != 1) return false;
+    return true;
+}
+
+// parties that each wait until all of them arrived, or give up after a
+// while: chunks run one after the other never all arrive
+class Barrier {
+public:
+    explicit Barrier(int parties) : parties(parties) {}
+
+    bool arrive() {
+        std::unique_lock<std::mutex> guard(lock);
+        if (++arrived == parties) all.notify_all();
+        return all.wait_for(guard, std::chrono::seconds(10),
+                            [&]() { return arrived >= parties; });
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable all;
+    const int parties;
+    int arrived = 0;
+};
+
+} // namespace
+
+void ParallelTest::chunks() {
+    // more chunks than cores run on the calling thread in turn
+    const int counts[] = {1, 2, 7, 64, 1000};
+    for (int count : counts)
+        for (int chunks = 1; chunks <= 9; chunks++)
+            QVERIFY2(covers(count, chunks),
+                     qPrintable(QString("%1 in %2").arg(count).arg(chunks)));
+
+    int calls = 0;
+    QCOMPARE(parallel::forChunks(0, 4, [&](int, int, int) { calls++; }), 0);
+    QCOMPARE(parallel::forChunks(5, 0, [&](int, int, int) { calls++; }), 0);
+    QCOMPARE(calls, 0);
+
+    QCOMPARE(parallel::chunkCount(0), 0);
+    QCOMPARE(parallel::chunkCount(1), 1);
+    parallel::setMaxThreads(1);
+    QCOMPARE(parallel::chunkCount(100), 1);
+    parallel::setMaxThreads(0);
+    QCOMPARE(parallel::chunkCount(100),
+             std::min(100, parallel::threadCount()));
+}
+
+void ParallelTest::concurrentLoops() {
+    // loops started together from several threads share the pool, and all
+    // of them see every index once
+    const int threads = 4;
+    std::atomic<int> failures(0);
+    std::vector<std::thread> callers;
+    for (int t = 0; t < threads; t++)
+        callers.emplace_back([&, t]() {
+            for (int round = 0; round < 50; round++)
+                if (!covers(1000 + t, 8)) failures++;
+        });
+    for (auto& caller : callers)
+        caller.join();
+    QCOMPARE(failures.load(), 0);
+}
+
+void ParallelTest::nestedLoops() {
+    // a loop inside a chunk shares the pool with the outer loop
+    const int outer = 6, inner = 50;
+    std::vector<std::atomic<int>> visits(outer * inner);
+    for (auto& v : visits)
+        v.store(0);
+    parallel::forChunks(outer, outer, [&](int begin, int end, int) {
+        for (int o = begin; o < end; o++) {
+            parallel::forChunks(inner, 4, [&](int b, int e, int) {
+                for (int i = b; i < e; i++)
+                    visits[o * inner + i]++;
+            });
+        }
+    });
+    for (auto& v : visits)
+        QCOMPARE(v.load(), 1);
+}
+
+void ParallelTest::sharedWorkers() {
+    if (parallel::threadCount() < 4)
+        QSKIP("needs four hardware threads");
+
+    // two loops started at once from two threads: the chunks of both are
+    // running together, so the second loop got workers too
+    Barrier concurrent(4);
+    std::atomic<int> arrived(0);
+    std::vector<std::thread> callers;
+    for (int t = 0; t < 2; t++)
+        callers.emplace_back([&]() {
+            parallel::forChunks(2, 2, [&](int, int, int) {
+                if (concurrent.arrive()) arrived++;
+            });
+        });
+    for (auto& caller : callers)
+        caller.join();
+    QCOMPARE(arrived.load(), 4);
+
+    // the same for the loops inside the two chunks of an outer loop
+    Barrier nested(4);
+    arrived.store(0);
+    parallel::forChunks(2, 2, [&](int, int, int) {
+        parallel::forChunks(2, 2, [&](int, int, int) {
+            if (nested.arrive()) arrived++;
+        });
+    });
+    QCOMPARE(arrived.load(), 4);
+}
+
+void ParallelTest::exceptions() {
+    // every chunk still runs, the exception reaches the caller
+    std::atomic<int> ran(0);
+    QVERIFY_EXCEPTION_THROWN(
+        parallel::forChunks(100, 4,
+                            [&](int, int, int chunk) {
+                                ran++;
+                                if (chunk == 2)
+                                    throw std::runtime_error("chunk 2");
+                            }),
+        std::runtime_error);
+    QCOMPARE(ran.load(), 4);
+
+    // the lowest chunk's exception wins when several throw
+    try {
+        parallel::forChunks(100, 4, [&](int, int, int chunk) {
+            if (chunk >= 1) throw std::invalid_argument("later");
+            throw std::runtime_error("first");
+        });
+        QFAIL("nothing was thrown");
+    } catch (const std::invalid_argument&) {
+        QFAIL("a later chunk's exception was rethrown");
+    } catch (const std::runtime_error& e) {
+        QCOMPARE(QString(e.what()), QString("first"));
+    }
+
+    // a nested loop's exception crosses both levels, the pool stays usable
+    QVERIFY_EXCEPTION_THROWN(
+        parallel::forChunks(8, 2,
+                            [&](int, int, int) {
+                                parallel::forChunks(8, 2, [&](int, int, int) {
+                                    throw std::runtime_error("inner");
+                                });
+                            }),
+        std::runtime_error);
+    QVERIFY(covers(1000, 8));
+}
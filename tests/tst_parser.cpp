@@ -0,0 +1,142 @@
+#include "tests.h"
+#include "callib.h"
+
+#include <QTemporaryFile>
+#include <QtTest>
+#include <random>
+#include <vector>
+
+namespace {
+
+// writes contents to a temporary capture and loads it
+void load(const QByteArray& contents, QVector<double>& x, QVector<double>& y,
+          QVector<double>& z) {
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(contents);
+    file.close();
+    CalLib::load_samples(file.fileName(), x, y, z);
+}
+
+} // namespace
+
+void ParserTest::numbers() {
+    QVector<double> x, y, z;
+    load("1 -2 +3\n"
+         "123456 -654321 1234567\n"
+         "0.5 -1.25e2 3E-1\n"
+         "\t7  8\t 9 \r\n"
+         "10 11 12",
+         x, y, z);
+    QCOMPARE(x.size(), 5);
+    QCOMPARE(x[0], 1.0);
+    QCOMPARE(y[0], -2.0);
+    QCOMPARE(z[0], 3.0);
+    QCOMPARE(x[1], 123456.0);
+    QCOMPARE(y[1], -654321.0);
+    QCOMPARE(z[1], 1234567.0);
+    QCOMPARE(x[2], 0.5);
+    QCOMPARE(y[2], -125.0);
+    QCOMPARE(z[2], 0.3);
+    QCOMPARE(x[3], 7.0);
+    QCOMPARE(z[3], 9.0);
+    // the last line needs no newline
+    QCOMPARE(x[4], 10.0);
+    QCOMPARE(z[4], 12.0);
+}
+
+void ParserTest::endOfFile() {
+    // a six digit reading ends exactly on a page boundary, the end of the
+    // mapping
+    QByteArray contents;
+    for (int i = 0; i < 681; i++)
+        contents.append("1 2 3\n");
+    contents.append("1 2 123456");
+    QCOMPARE(contents.size(), 4096);
+
+    QVector<double> x, y, z;
+    load(contents, x, y, z);
+    QCOMPARE(x.size(), 682);
+    QCOMPARE(z[681], 123456.0);
+
+    load("-1 -2 -654321", x, y, z);
+    QCOMPARE(x.size(), 1);
+    QCOMPARE(z[0], -654321.0);
+}
+
+void ParserTest::invalidLines() {
+    QVector<double> x, y, z;
+    load("1 2\n"
+         "1 2 3 4\n"
+         "a b c\n"
+         "1 2 3x\n"
+         "- 2 3\n"
+         "1e 2 3\n"
+         "\n"
+         "4 5 6\n",
+         x, y, z);
+    QCOMPARE(x.size(), 1);
+    QCOMPARE(x[0], 4.0);
+    QCOMPARE(y[0], 5.0);
+    QCOMPARE(z[0], 6.0);
+
+    load("", x, y, z);
+    QVERIFY(x.isEmpty());
+}
+
+void ParserTest::missingFile() {
+    QVector<double> x(3), y(3), z(3);
+    CalLib::load_samples("/nonexistent/capture.txt", x, y, z);
+    QVERIFY(x.isEmpty() && y.isEmpty() && z.isEmpty());
+}
+
+void ParserTest::streaming() {
+    // long enough for several blocks per chunk, with lines to skip
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int> reading(-32768, 32767);
+    QByteArray contents;
+    for (int i = 0; i < 30000; i++) {
+        if (i % 997 == 0) contents.append("garbage\n");
+        for (int k = 0; k < 3; k++) {
+            contents.append(QByteArray::number(reading(rng)));
+            contents.append(k < 2 ? ' ' : '\n');
+        }
+    }
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(contents);
+    file.close();
+    QVector<double> x, y, z;
+    CalLib::load_samples(file.fileName(), x, y, z);
+    QCOMPARE(x.size(), 30000);
+
+    // the blocks of every chunk, in chunk order, are the whole capture
+    for (int chunks = 1; chunks <= 8; chunks *= 2) {
+        std::vector<QVector<double>> parts(3 * chunks);
+        CalLib::stream_samples(
+            file.fileName(), chunks,
+            [&](const double* bx, const double* by, const double* bz,
+                int count, int chunk) {
+                for (int i = 0; i < count; i++) {
+                    parts[3 * chunk].append(bx[i]);
+                    parts[3 * chunk + 1].append(by[i]);
+                    parts[3 * chunk + 2].append(bz[i]);
+                }
+            });
+        QVector<double> sx, sy, sz;
+        for (int c = 0; c < chunks; c++) {
+            sx.append(parts[3 * c]);
+            sy.append(parts[3 * c + 1]);
+            sz.append(parts[3 * c + 2]);
+        }
+        QVERIFY(sx == x);
+        QVERIFY(sy == y);
+        QVERIFY(sz == z);
+    }
+
+    int calls = 0;
+    CalLib::stream_samples("/nonexistent/capture.txt", 4,
+                           [&](const double*, const double*, const double*,
+                               int, int) { calls++; });
+    QCOMPARE(calls, 0);
+}
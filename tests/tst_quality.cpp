@@ -0,0 +1,163 @@
+#include "tests.h"
+#include "callib.h"
+#include "histogram.h"
+
+#include <QtTest>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+const QVector<long> offset = {10, -20, 30};
+const QVector<double> scale = {200, 300, 400};
+
+// the raw reading of the unit direction u on the ellipsoid of offset and
+// scale, which the calibration maps back to u exactly
+void append(double ux, double uy, double uz, QVector<double>& x,
+            QVector<double>& y, QVector<double>& z) {
+    x.append(offset[0] + scale[0] * ux);
+    y.append(offset[1] + scale[1] * uy);
+    z.append(offset[2] + scale[2] * uz);
+}
+
+// n directions uniform over the sphere, or over its upper half
+void sphere(int n, bool upper, QVector<double>& x, QVector<double>& y,
+            QVector<double>& z) {
+    std::mt19937 rng(1);
+    std::normal_distribution<double> normal(0, 1);
+    for (int i = 0; i < n; i++) {
+        double d[3];
+        double norm = 0;
+        for (double& component : d) {
+            component = normal(rng);
+            norm += component * component;
+        }
+        norm = std::sqrt(norm);
+        const double uz = upper ? std::fabs(d[2]) / norm : d[2] / norm;
+        append(d[0] / norm, d[1] / norm, uz, x, y, z);
+    }
+}
+
+} // namespace
+
+void QualityTest::histogramOverflow() {
+    Histogram1D histogram(10, -1, 1);
+    histogram.fill(-1);    // the low edge is in range
+    histogram.fill(-1.5);  // underflow
+    histogram.fill(1);     // the high edge is not
+    histogram.fill(std::numeric_limits<double>::quiet_NaN());
+    histogram.fill(std::numeric_limits<double>::infinity(), 2);
+    histogram.fill(0.05, 3);
+    QCOMPARE(histogram.count(0), 1.0);
+    QCOMPARE(histogram.count(5), 3.0);
+    QCOMPARE(histogram.underflow(), 1.0);
+    QCOMPARE(histogram.overflow(), 4.0);
+    QCOMPARE(histogram.entries(), 9.0);
+    QCOMPARE(histogram.max_count(), 3.0);
+
+    Histogram2D directions(4, 0, 4, 2, 0, 2);
+    directions.fill(std::numeric_limits<double>::quiet_NaN(), 1);
+    directions.fill(1, std::numeric_limits<double>::quiet_NaN());
+    directions.fill(4, 1);
+    directions.fill(3.5, 1.5);
+    QCOMPARE(directions.outside(), 3.0);
+    QCOMPARE(directions.count(3, 1), 1.0);
+    QCOMPARE(directions.occupied(), 1);
+}
+
+void QualityTest::histogramQuantile() {
+    // uniform over [0, 10) in ten bins, the quantiles interpolate linearly
+    Histogram1D histogram(10, 0, 10);
+    for (int i = 0; i < 1000; i++)
+        histogram.fill((i + 0.5) / 100);
+    histogram.fill(-5, 100); // the under/overflow don't count
+    histogram.fill(50, 100);
+    QCOMPARE(histogram.quantile(0), 0.0);
+    QVERIFY(std::fabs(histogram.quantile(0.5) - 5) < 1e-12);
+    QVERIFY(std::fabs(histogram.quantile(0.25) - 2.5) < 1e-12);
+    QVERIFY(std::fabs(histogram.quantile(1) - 10) < 1e-12);
+
+    // empty bins are skipped rather than interpolated through
+    Histogram1D gaps(4, 0, 4);
+    gaps.fill(0.5);
+    gaps.fill(3.5);
+    QVERIFY(std::fabs(gaps.quantile(0.75) - 3.5) < 1e-12);
+    QCOMPARE(Histogram1D(4, 0, 4).quantile(0.5), 0.0);
+}
+
+void QualityTest::histogramMerge() {
+    Histogram1D a(10, 0, 1), b(10, 0, 1);
+    a.fill(0.15);
+    b.fill(0.15, 2);
+    b.fill(2);
+    a.merge(b);
+    QCOMPARE(a.count(1), 3.0);
+    QCOMPARE(a.overflow(), 1.0);
+
+    QVERIFY_EXCEPTION_THROWN(a.merge(Histogram1D(20, 0, 1)),
+                             std::invalid_argument);
+    QVERIFY_EXCEPTION_THROWN(a.merge(Histogram1D(10, 0, 2)),
+                             std::invalid_argument);
+    QVERIFY_EXCEPTION_THROWN(a.merge(Histogram1D(10, -1, 1)),
+                             std::invalid_argument);
+    Histogram2D c(4, 0, 1, 2, 0, 1);
+    QVERIFY_EXCEPTION_THROWN(c.merge(Histogram2D(4, 0, 1, 3, 0, 1)),
+                             std::invalid_argument);
+    QVERIFY_EXCEPTION_THROWN(c.merge(Histogram2D(4, 0, 2, 2, 0, 1)),
+                             std::invalid_argument);
+    QVERIFY_EXCEPTION_THROWN(Histogram1D(0, 0, 1), std::invalid_argument);
+    QVERIFY_EXCEPTION_THROWN(Histogram1D(4, 1, 1), std::invalid_argument);
+}
+
+void QualityTest::unitSphere() {
+    QVector<double> x, y, z;
+    sphere(50000, false, x, y, z);
+    const CalibrationQuality quality =
+        CalLib::quality(x, y, z, CalLib::to_rotated(offset, scale));
+    QCOMPARE(quality.samples, 50000L);
+    QVERIFY(quality.rms < 1e-12);
+    QVERIFY(quality.max_deviation < 1e-12);
+    for (int axis = 0; axis < 3; axis++)
+        QVERIFY(quality.axis_rms[axis] < 1e-12);
+    QCOMPARE(quality.coverage, 1.0);
+    QCOMPARE(quality.directions.outside(), 0.0);
+    QCOMPARE(quality.residuals.entries(), 50000.0);
+}
+
+void QualityTest::halfSphere() {
+    QVector<double> x, y, z;
+    sphere(50000, true, x, y, z);
+    const CalibrationQuality quality =
+        CalLib::quality(x, y, z, CalLib::to_rotated(offset, scale));
+    QVERIFY(std::fabs(quality.coverage - 0.5) < 0.01);
+    QVERIFY(quality.rms < 1e-12);
+}
+
+void QualityTest::edgeDirections() {
+    // the negative x axis, where atan2 returns pi, and the poles land in
+    // the edge bins instead of outside the direction histogram
+    QVector<double> x, y, z;
+    append(-1, 0, 0, x, y, z);
+    append(0, 0, 1, x, y, z);
+    append(0, 0, -1, x, y, z);
+    append(std::cos(pi - 1e-9), std::sin(pi - 1e-9), 0, x, y, z);
+    const CalibrationQuality quality =
+        CalLib::quality(x, y, z, CalLib::to_rotated(offset, scale));
+    const Histogram2D& directions = quality.directions;
+    QCOMPARE(directions.outside(), 0.0);
+    QCOMPARE(directions.entries(), 4.0);
+    const int last = directions.xbins() - 1;
+    const int equator = directions.ybins() / 2;
+    QCOMPARE(directions.count(0, equator), 1.0);
+    QCOMPARE(directions.count(last, equator), 1.0);
+    double top = 0, bottom = 0;
+    for (int bin = 0; bin <= last; bin++) {
+        top += directions.count(bin, directions.ybins() - 1);
+        bottom += directions.count(bin, 0);
+    }
+    QCOMPARE(top, 1.0);
+    QCOMPARE(bottom, 1.0);
+}
@@ -0,0 +1,109 @@
+#include "tests.h"
+#include "sixposition.h"
+
+#include <QtTest>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+// a = M g + b, with cross-axis terms and a bias on every axis
+const double sensitivity[3][3] = {
+    {16300, 120, -90}, {-60, 16500, 150}, {80, -110, 16200}};
+const double bias[3] = {250, -400, 600};
+
+class Board {
+public:
+    explicit Board(unsigned seed) : rng(seed), noise(0, 20) {}
+
+    // holds the board still with gravity along g for n frames
+    void hold(SixPositionCalibrator& poses, const double g[3], int n) {
+        for (int i = 0; i < n; i++) {
+            double gyro[3], acc[3];
+            for (int k = 0; k < 3; k++) {
+                gyro[k] = 5 + noise(rng) / 10;
+                acc[k] = bias[k] + noise(rng);
+                for (int j = 0; j < 3; j++)
+                    acc[k] += sensitivity[k][j] * g[j];
+            }
+            poses.add(gyro, acc);
+        }
+    }
+
+    // turns the board over, nothing of it may be taken for a pose. n is
+    // a multiple of the window so the next pose starts a window.
+    void turn(SixPositionCalibrator& poses, int n) {
+        for (int i = 0; i < n; i++) {
+            double gyro[3], acc[3];
+            for (int k = 0; k < 3; k++) {
+                gyro[k] = 2000 * std::sin(0.1 * i + k);
+                acc[k] = 12000 * std::cos(0.07 * i + 2 * k);
+            }
+            poses.add(gyro, acc);
+        }
+    }
+
+private:
+    std::mt19937 rng;
+    std::normal_distribution<double> noise;
+};
+
+const double faces[SixPositionCalibrator::faces][3] = {
+    {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+
+} // namespace
+
+void SixPositionTest::solve() {
+    SixPositionCalibrator poses;
+    Board board(1);
+    const int n = SixPositionCalibrator::min_samples;
+    for (const auto& g : faces) {
+        board.turn(poses, 5 * StillnessDetector::window);
+        board.hold(poses, g, n);
+    }
+    QVERIFY(poses.complete());
+    QCOMPARE(poses.missing(), QString());
+    for (int face = 0; face < SixPositionCalibrator::faces; face++)
+        QCOMPARE(poses.face_samples(face), long(n));
+
+    const EllipsoidCalibration result = poses.solve();
+    for (int i = 0; i < 3; i++)
+        QVERIFY(std::fabs(result.offset[i] - bias[i]) < 5);
+    // the correction undoes the sensitivity, misalignment included
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) {
+            double product = 0;
+            for (int k = 0; k < 3; k++)
+                product += result.correction(i, k) * sensitivity[k][j];
+            QVERIFY(std::fabs(product - (i == j)) < 1e-3);
+        }
+}
+
+void SixPositionTest::tiltedPoses() {
+    SixPositionCalibrator poses;
+    Board board(2);
+    // 45 degrees between two axes, not one of the six poses
+    const double tilted[3] = {std::sqrt(0.5), std::sqrt(0.5), 0};
+    board.hold(poses, tilted, 4 * SixPositionCalibrator::min_samples);
+    for (int face = 0; face < SixPositionCalibrator::faces; face++)
+        QCOMPARE(poses.face_samples(face), 0L);
+}
+
+void SixPositionTest::incomplete() {
+    SixPositionCalibrator poses;
+    Board board(3);
+    const int n = SixPositionCalibrator::min_samples;
+    for (int face = 0; face < 5; face++)
+        board.hold(poses, faces[face], n);
+    // too short to count
+    board.hold(poses, faces[5], n / 2);
+    QCOMPARE(poses.captured(), 5);
+    QVERIFY(!poses.complete());
+    QCOMPARE(poses.missing(), QString("-z"));
+    QVERIFY_EXCEPTION_THROWN(poses.solve(), std::runtime_error);
+
+    poses.clear();
+    QCOMPARE(poses.captured(), 0);
+    QCOMPARE(poses.missing(), QString("+x -x +y -y +z -z"));
+}